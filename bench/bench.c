@@ -0,0 +1,171 @@
+//===---------------------------------------------------*- C -*---===
+//: bench
+//
+// DESCRIPTION
+// Measure the converter in libmd2mdoc. Every input is loaded into
+// memory first, then converted `iterations` times with the output
+// sent to a counting sink, so only the conversion itself is timed.
+// Throughput (MB/s and lines/s) and per-file latency percentiles are
+// reported.
+//
+// OPTIONS
+//  -n iterations
+//      Number of passes over the inputs (default 5).
+//  file ...
+//      Markdown files to convert (see gencorpus).
+//===-------------------------------------------------------------===
+
+#include "md2mdoc.h"
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+/*
+ * input --
+ *      One benchmark input held in memory.
+ */
+struct input {
+  char *data;
+  size_t len;
+  size_t lines;
+};
+
+/**
+ * countsink --
+ *      Sink that only counts the bytes it is given.
+ */
+static int countsink(void *arg, const char *buf, size_t len) {
+  (void)buf;
+  *(size_t *)arg += len;
+  return 0;
+}
+
+/**
+ * now --
+ *      Monotonic time in nanoseconds.
+ */
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/**
+ * loadinput --
+ *      Read a whole file into memory and count its lines.
+ */
+static void loadinput(const char *path, struct input *in) {
+  struct stat st;
+  ssize_t n;
+  size_t off = 0;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+    err(1, "%s", path);
+  in->len = (size_t)st.st_size;
+  if ((in->data = malloc(in->len ? in->len : 1)) == NULL)
+    err(1, NULL);
+  while (off < in->len) {
+    if ((n = read(fd, in->data + off, in->len - off)) <= 0)
+      err(1, "%s", path);
+    off += (size_t)n;
+  }
+  close(fd);
+
+  in->lines = 0;
+  for (off = 0; off < in->len; off++)
+    if (in->data[off] == '\n')
+      in->lines++;
+}
+
+static int cmpdouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * percentile --
+ *      Value at percentile `p` of the sorted array `v`.
+ */
+static double percentile(const double *v, size_t n, double p) {
+  size_t i = (size_t)(p / 100.0 * (double)(n - 1) + 0.5);
+  return v[i < n ? i : n - 1];
+}
+
+//------------------------------------------------------*- C -*------
+// Main
+//-------------------------------------------------------------------
+int main(int argc, char *argv[]) {
+  struct input *inputs;
+  md2mdoc_ctx *ctx;
+  double *lat, start, t, total = 0;
+  size_t bytesin = 0, bytesout = 0, lines = 0, nlat = 0;
+  long iterations = 5, it;
+  int ninputs, i, ch;
+
+  while ((ch = getopt(argc, argv, "n:")) != -1) {
+    switch (ch) {
+      case 'n': iterations = strtol(optarg, NULL, 10); break;
+      default:
+        fprintf(stderr, "Usage: %s [-n iterations] file ...\n", argv[0]);
+        return 1;
+    }
+  }
+  argc -= optind;
+  argv += optind;
+  if (argc < 1 || iterations < 1) {
+    fprintf(stderr, "Usage: bench [-n iterations] file ...\n");
+    return 1;
+  }
+
+  ninputs = argc;
+  if ((inputs = calloc(ninputs, sizeof(*inputs))) == NULL ||
+      (lat = calloc((size_t)ninputs * iterations, sizeof(*lat))) == NULL ||
+      (ctx = md2mdoc_ctx_new()) == NULL)
+    err(1, NULL);
+  for (i = 0; i < ninputs; i++)
+    loadinput(argv[i], &inputs[i]);
+
+  for (it = 0; it < iterations; it++) {
+    for (i = 0; i < ninputs; i++) {
+      start = now();
+      if (md2mdoc_convert(ctx, inputs[i].data, inputs[i].len, countsink, &bytesout) == -1)
+        errx(1, "%s: conversion failed", argv[i]);
+      t = now() - start;
+      lat[nlat++] = t;
+      total += t;
+      bytesin += inputs[i].len;
+      lines += inputs[i].lines;
+    }
+  }
+  qsort(lat, nlat, sizeof(*lat), cmpdouble);
+
+  printf("md2mdoc %s: %d files x %ld iterations\n", md2mdoc_version(), ninputs, iterations);
+  printf("input        %12.2f MB\n", bytesin / 1e6);
+  printf("output       %12.2f MB\n", bytesout / 1e6);
+  printf("throughput   %12.2f MB/s\n", bytesin / 1e6 / (total / 1e9));
+  printf("lines        %12.0f lines/s\n", lines / (total / 1e9));
+  printf("latency p50  %12.1f us\n", percentile(lat, nlat, 50) / 1e3);
+  printf("latency p90  %12.1f us\n", percentile(lat, nlat, 90) / 1e3);
+  printf("latency p99  %12.1f us\n", percentile(lat, nlat, 99) / 1e3);
+  printf("latency max  %12.1f us\n", lat[nlat - 1] / 1e3);
+
+  md2mdoc_ctx_free(ctx);
+  for (i = 0; i < ninputs; i++)
+    free(inputs[i].data);
+  free(inputs);
+  free(lat);
+  return 0;
+} ///:~
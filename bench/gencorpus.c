@@ -0,0 +1,227 @@
+//===---------------------------------------------------*- C -*---===
+//: gencorpus
+//
+// DESCRIPTION
+// Write a synthetic markdown corpus for benchmarking md2mdoc. Every
+// construct the converter recognizes is exercised: the preamble,
+// section and subsection headers, the NAME line, synopsis lines
+// (`[-abc [arg]]`), option, dash and enum lists, both kinds of code
+// blocks, comments and prose with inline `*`, `_`, `` ` ``, `^`, `$`
+// and `@` markers.
+//
+// OPTIONS
+//  -n files
+//      Number of files to write (default 100).
+//  -s kbytes
+//      Approximate size of each file in KiB (default 64).
+//  -r seed
+//      Seed for the generator, so a corpus can be reproduced.
+//  -o outdir
+//      Directory to write `pageNNNNN.md` files into (default
+//      `corpus`).
+//===-------------------------------------------------------------===
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+//-------------------------------------------------------------------
+// Global Variables
+//-------------------------------------------------------------------
+static unsigned long long rngstate = 0x9e3779b97f4a7c15ULL;
+
+static const char *words[] = {
+  "file", "buffer", "option", "the", "output", "line", "section",
+  "reads", "writes", "converts", "markdown", "manual", "page", "list",
+  "value", "default", "when", "is", "given", "each", "program", "flag",
+  "argument", "mode", "path", "index", "stream", "format", "block",
+};
+#define NWORDS (sizeof(words) / sizeof(words[0]))
+
+/**
+ * rnd --
+ *      A small xorshift generator; returns a value in [0, n).
+ */
+static unsigned rnd(unsigned n) {
+  rngstate ^= rngstate << 13;
+  rngstate ^= rngstate >> 7;
+  rngstate ^= rngstate << 17;
+  return (unsigned)(rngstate % n);
+}
+
+static const char *word(void) {
+  return words[rnd(NWORDS)];
+}
+
+/**
+ * prose --
+ *      Write one line of text with a sprinkling of inline markers.
+ *      The first word is capitalized, like a sentence.
+ */
+static void prose(FILE *fp, unsigned nwords) {
+  const char *w;
+  unsigned i;
+
+  for (i = 0; i < nwords; i++) {
+    w = word();
+    if (i > 0)
+      fputc(' ', fp);
+    switch (rnd(24)) {
+      case 0: fprintf(fp, "*%s*", w); break;
+      case 1: fprintf(fp, "_%s_", w); break;
+      case 2: fprintf(fp, "`%s`", w); break;
+      case 3: fprintf(fp, "^%s(%u)^", w, rnd(8) + 1); break;
+      case 4: fprintf(fp, "$%s", rnd(2) ? "name" : w); break;
+      case 5: fprintf(fp, "@%s", w); break;
+      case 6: fprintf(fp, "\\*%s", w); break;
+      default:
+        if (i == 0)
+          fprintf(fp, "%c%s", w[0] - 'a' + 'A', w + 1);
+        else
+          fputs(w, fp);
+        break;
+    }
+  }
+  fputs(".\n", fp);
+}
+
+/**
+ * optionlist --
+ *      Write a tag list of options, closed with a single dash.
+ */
+static void optionlist(FILE *fp) {
+  unsigned i, n = rnd(6) + 2;
+
+  for (i = 0; i < n; i++) {
+    switch (rnd(4)) {
+      case 0: fprintf(fp, "-%c\n", 'a' + rnd(26)); break;
+      case 1: fprintf(fp, "-%c %s\n", 'a' + rnd(26), word()); break;
+      case 2: fprintf(fp, "-%c --%s %s\n", 'a' + rnd(26), word(), word()); break;
+      default: fprintf(fp, "- %s\n", word()); break;
+    }
+    fputs("    ", fp);
+    prose(fp, rnd(12) + 4);
+  }
+  fputs("-\n\n", fp);
+}
+
+/**
+ * codeblock --
+ *      Write a literal display, fenced either with backticks or with
+ *      the `<`/`>` pair.
+ */
+static void codeblock(FILE *fp) {
+  unsigned i, n = rnd(10) + 2;
+  int fenced = rnd(2);
+
+  fputs(fenced ? "```c\n" : "<c\n", fp);
+  for (i = 0; i < n; i++)
+    fprintf(fp, "    unsigned long   %s_%s;    /* %s %s */\n",
+            word(), word(), word(), word());
+  fputs(fenced ? "```\n\n" : ">\n\n", fp);
+}
+
+/**
+ * genfile --
+ *      Write one page of roughly `size` bytes.
+ */
+static void genfile(FILE *fp, unsigned num, long size) {
+  unsigned i, n;
+
+  fprintf(fp, "<!--\n    generated page %u\n-->\n", num);
+  fprintf(fp, "date: Jan %u 2024\n", rnd(28) + 1);
+  fprintf(fp, "title: page%u %u\n", num, rnd(8) + 1);
+  fprintf(fp, "author: Generated\n\n");
+  fprintf(fp, "# NAME\npage%u -- %s %s %s\n\n", num, word(), word(), word());
+  fprintf(fp, "# SYNOPSIS\npage%u\n[-abc [%s]]\n[-f %s]\n[%s]\n%s\n\n",
+          num, word(), word(), word(), word());
+
+  while (ftell(fp) < size) {
+    switch (rnd(10)) {
+      case 0:
+        fprintf(fp, "# %s %s\n", word(), word());
+        break;
+      case 1:
+        fprintf(fp, "## %s\n", word());
+        break;
+      case 2:
+        optionlist(fp);
+        break;
+      case 3:
+        n = rnd(4) + 2;
+        for (i = 0; i < n; i++) {
+          fputs("~ ", fp);
+          prose(fp, rnd(6) + 2);
+        }
+        fputs("~\n\n", fp);
+        break;
+      case 4:
+        n = rnd(4) + 2;
+        for (i = 0; i < n; i++) {
+          fprintf(fp, "%u. ", i + 1);
+          prose(fp, rnd(6) + 2);
+        }
+        fputs("\n", fp);
+        break;
+      case 5:
+        codeblock(fp);
+        break;
+      case 6:
+        fputs("<!--\n", fp);
+        prose(fp, rnd(8) + 2);
+        fputs("-->\n", fp);
+        break;
+      default:
+        n = rnd(5) + 1;
+        for (i = 0; i < n; i++)
+          prose(fp, rnd(14) + 4);
+        fputs("\n", fp);
+        break;
+    }
+  }
+  fprintf(fp, "# SEE ALSO\n^mdoc(7)^, ^mandoc(1)^\n");
+}
+
+//------------------------------------------------------*- C -*------
+// Main
+//-------------------------------------------------------------------
+int main(int argc, char *argv[]) {
+  const char *outdir = "corpus";
+  char path[1024];
+  long nfiles = 100, kbytes = 64;
+  FILE *fp;
+  long i;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "n:s:r:o:")) != -1) {
+    switch (ch) {
+      case 'n': nfiles = strtol(optarg, NULL, 10); break;
+      case 's': kbytes = strtol(optarg, NULL, 10); break;
+      case 'r': rngstate ^= strtoull(optarg, NULL, 10); break;
+      case 'o': outdir = optarg; break;
+      default:
+        fprintf(stderr, "Usage: %s [-n files] [-s kbytes] [-r seed] [-o outdir]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (nfiles < 1 || kbytes < 1)
+    errx(1, "file count and size must be positive");
+  if (mkdir(outdir, 0755) == -1 && errno != EEXIST)
+    err(1, "%s", outdir);
+
+  for (i = 0; i < nfiles; i++) {
+    snprintf(path, sizeof(path), "%s/page%05ld.md", outdir, i);
+    if ((fp = fopen(path, "w")) == NULL)
+      err(1, "%s", path);
+    genfile(fp, (unsigned)i, kbytes * 1024);
+    if (fclose(fp) == EOF)
+      err(1, "%s", path);
+  }
+  return 0;
+} ///:~
@@ -0,0 +1,185 @@
+//===---------------------------------------------------*- C -*---===
+//: incrcheck
+//
+// DESCRIPTION
+// Check that an incremental context (`md2mdoc_ctx_incremental`)
+// writes what a fresh one does. Each input is converted once, then
+// every section of it in turn is edited and the document converted
+// again, by the incremental context and by a fresh context, to all
+// formats at once. The pages and what the contexts learned from the
+// NAME and `title:` lines must be the same. The edits include lines
+// that open a list, a literal block or a comment and do not close
+// them, so a change runs into the sections after it. The original is
+// converted again after each edit, so sections are also reused after
+// being replaced.
+//
+// OPTIONS
+//  file ...
+//      Markdown files to check (see gencorpus).
+//===-------------------------------------------------------------===
+
+#include "md2mdoc.h"
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+//-------------------------------------------------------------------
+// Global Variables
+//-------------------------------------------------------------------
+static const char *edits[] = {                          /* Inserted after a section's heading. */
+  "An *edited* line of `text` with a ^ref(1)^ in it.\n",
+  "\n",
+  "- -x\n    a list item left open\n",
+  "```\n",                                              /* Runs to the next fence, or the end. */
+  "<!--\n",                                             /* Drops the rest of the page. */
+  "# NAME\nedited -- a page renamed in the middle\n",
+  "title: EDITED 8\n",
+};
+#define NEDITS (sizeof(edits) / sizeof(edits[0]))
+
+static struct md2mdoc_buf incrpages[MD2MDOC_NFORMATS];  /* Reused by every conversion. */
+static struct md2mdoc_buf freshpages[MD2MDOC_NFORMATS];
+
+/**
+ * loadinput --
+ *      Read a whole file into memory.
+ */
+static char *loadinput(const char *path, size_t *len) {
+  struct stat st;
+  ssize_t n;
+  size_t off = 0;
+  char *data;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1 || fstat(fd, &st) == -1)
+    err(1, "%s", path);
+  *len = (size_t)st.st_size;
+  if ((data = malloc(*len ? *len : 1)) == NULL)
+    err(1, NULL);
+  while (off < *len) {
+    if ((n = read(fd, data + off, *len - off)) <= 0)
+      err(1, "%s", path);
+    off += (size_t)n;
+  }
+  close(fd);
+  return data;
+}
+
+/**
+ * convert --
+ *      Convert `doc` with `ctx` to every format, one buffer each.
+ */
+static int convert(md2mdoc_ctx *ctx, const char *doc, size_t len, struct md2mdoc_buf *bufs) {
+  struct md2mdoc_output outs[MD2MDOC_NFORMATS];
+  int f;
+
+  for (f = 0; f < MD2MDOC_NFORMATS; f++) {
+    bufs[f].len = 0;
+    outs[f].format = f;
+    outs[f].sink = md2mdoc_buf_sink;
+    outs[f].arg = &bufs[f];
+  }
+  return md2mdoc_convert_to(ctx, doc, len, outs, MD2MDOC_NFORMATS);
+}
+
+/**
+ * same --
+ *      Convert `doc` incrementally with `incr` and with a fresh
+ *      context, and compare the two.
+ *
+ * Returns:
+ *  1 if they agree, 0 if not (which is reported).
+ */
+static int same(md2mdoc_ctx *incr, const char *doc, size_t len, const char *what) {
+  struct md2mdoc_buf *a = incrpages, *b = freshpages;
+  md2mdoc_ctx *fresh;
+  int ra, rb, f, ok = 1;
+
+  if ((fresh = md2mdoc_ctx_new()) == NULL)
+    err(1, NULL);
+  ra = convert(incr, doc, len, a);
+  rb = convert(fresh, doc, len, b);
+  if (ra != rb) {
+    warnx("%s: only one conversion failed", what);
+    ok = 0;
+  }
+  for (f = 0; f < MD2MDOC_NFORMATS && ok; f++) {
+    if (a[f].len != b[f].len || (a[f].len > 0 && memcmp(a[f].data, b[f].data, a[f].len) != 0)) {
+      warnx("%s: %s page differs", what, md2mdoc_format_name(f));
+      ok = 0;
+    }
+  }
+  if (ok && (strcmp(md2mdoc_section(incr), md2mdoc_section(fresh)) != 0 ||
+             strcmp(md2mdoc_names(incr), md2mdoc_names(fresh)) != 0 ||
+             strcmp(md2mdoc_description(incr), md2mdoc_description(fresh)) != 0 ||
+             strcmp(md2mdoc_title(incr), md2mdoc_title(fresh)) != 0)) {
+    warnx("%s: NAME or title: differs", what);
+    ok = 0;
+  }
+  md2mdoc_ctx_free(fresh);
+  return ok;
+}
+
+//------------------------------------------------------*- C -*------
+// Main
+//-------------------------------------------------------------------
+int main(int argc, char *argv[]) {
+  md2mdoc_ctx *incr;
+  char *data, *doc, what[PATH_MAX + 64];
+  const char *p, *nl;
+  size_t len, at, elen;
+  unsigned long nsec, nbad = 0, nconv = 0;
+  int i;
+
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s file ...\n", argv[0]);
+    return 1;
+  }
+  if ((incr = md2mdoc_ctx_new()) == NULL)
+    err(1, NULL);
+  md2mdoc_ctx_incremental(incr, 1);
+
+  for (i = 1; i < argc; i++) {
+    data = loadinput(argv[i], &len);
+    snprintf(what, sizeof(what), "%s", argv[i]);
+    nbad += !same(incr, data, len, what);
+    nconv++;
+    for (p = data, nsec = 0; p < data + len; p = nl + 1) { /* Each line starting a section. */
+      nl = memchr(p, '\n', (size_t)(data + len - p));
+      if (*p == '#' && p + 1 < data + len && p[1] == ' ') {
+        at = nl != NULL ? (size_t)(nl + 1 - data) : len;
+        elen = strlen(edits[nsec % NEDITS]);
+        if ((doc = malloc(len + elen)) == NULL)
+          err(1, NULL);
+        memcpy(doc, data, at);
+        memcpy(doc + at, edits[nsec % NEDITS], elen);
+        memcpy(doc + at + elen, data + at, len - at);
+        snprintf(what, sizeof(what), "%s: section %lu edited", argv[i], ++nsec);
+        nbad += !same(incr, doc, len + elen, what);
+        snprintf(what, sizeof(what), "%s: section %lu restored", argv[i], nsec);
+        nbad += !same(incr, data, len, what);
+        nconv += 2;
+        free(doc);
+      }
+      if (nl == NULL)
+        break;
+    }
+    free(data);
+  }
+
+  printf("incrcheck: %lu conversions, %lu differ\n", nconv, nbad);
+  md2mdoc_ctx_free(incr);
+  for (i = 0; i < MD2MDOC_NFORMATS; i++) {
+    free(incrpages[i].data);
+    free(freshpages[i].data);
+  }
+  return nbad > 0 ? 1 : 0;
+} ///:~
@@ -0,0 +1,630 @@
+//===---------------------------------------------------*- C -*---===
+//: batchio.c
+//
+// DESCRIPTION
+// io_uring engine for the file I/O of a batch conversion (see
+// batchio.h). One thread owns the ring. It keeps up to BIO_WINDOW
+// inputs opened or being read, handing each to the converters once it
+// is whole, and carries every page it is given through open, write,
+// close and rename, creating the directories an open finds missing. Each file is a small state machine driven by its
+// completions; everything ready to go is submitted with one call.
+//===-------------------------------------------------------------===
+
+#include "batchio.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#ifdef HAVE_LIBURING
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <liburing.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+
+//-------------------------------------------------------------------
+// Constants Declarations
+//-------------------------------------------------------------------
+#define OP_WAKE  0                                      /* `op.kind`: the eventfd read, */
+#define OP_READ  1                                      /*   an input */
+#define OP_WRITE 2                                      /*   or a page. */
+
+#define WR_OPEN   0                                     /* `wr.stage`: what the page is waiting on. */
+#define WR_WRITE  1
+#define WR_CLOSE  2
+#define WR_RENAME 3
+#define WR_MKDIR  4                                     /* One of the directories leading up to it. */
+
+#define IOCHUNK (1U << 30)                              /* Most bytes asked of one read or write. */
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+/*
+ * op --
+ *      Head of everything a completion can belong to.
+ */
+struct op {
+  int kind;                                             /* OP_*. */
+};
+
+/*
+ * rd --
+ *      An input being loaded, then waiting to be handed out.
+ */
+struct rd {
+  struct op op;
+  struct rd *next;                                      /* On the ready list. */
+  int fd;                                               /* -1 while it is being opened. */
+  size_t cap;                                           /* Size of `in.data`. */
+  struct bio_in in;
+};
+
+/*
+ * wr --
+ *      A page waiting to be written, or being written.
+ */
+struct wr {
+  struct op op;
+  struct wr *next;                                      /* On the queue. */
+  int fd;
+  int stage;                                            /* WR_*. */
+  size_t done;                                          /* Bytes written so far. */
+  char *data;
+  size_t len;
+  char *tmp;                                            /* All three follow the structure. */
+  char *final;
+  char *dir;                                            /* Copy of `tmp` cut at the directory made. */
+  size_t dirlen;                                        /* Length of that directory's name. */
+  int mkdirs;                                           /* Set once the directories were made. */
+};
+
+/*
+ * batchio --
+ *      The engine. The ring, `nextpath` and `writing` belong to its
+ *      thread; the rest is shared and guarded by `lock`.
+ */
+struct batchio {
+  struct io_uring ring;
+  const char *const *paths;
+  size_t npaths;
+  size_t nextpath;                                      /* Next input to open. */
+  size_t handed;                                        /* Inputs handed out by `bio_next`. */
+  size_t held;                                          /* Inputs loading or loaded, not released. */
+  size_t writing;                                       /* Pages between open and rename. */
+  struct rd *ready, **readytail;                        /* Loaded inputs, in the order they were. */
+  struct wr *queue, **queuetail;                        /* Pages not started yet. */
+  int closing;                                          /* Set by `bio_close`. */
+  int failed;                                           /* Set if a page could not be written. */
+  int efd;                                              /* Wakes the engine out of its wait. */
+  uint64_t evcount;                                     /* Read from `efd`. */
+  struct op wake;
+  pthread_t tid;
+  pthread_mutex_t lock;
+  pthread_cond_t cv;                                    /* Signalled when an input is ready. */
+};
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static void *engine(void *arg);                         /* Thread owning the ring. */
+static struct io_uring_sqe *getsqe(struct batchio *bio);
+static void wake(struct batchio *bio);
+static void armwake(struct batchio *bio);
+static void startread(struct batchio *bio, size_t index);
+static void readdone(struct batchio *bio, struct rd *rd, int res);
+static void readfailed(struct batchio *bio, struct rd *rd, int error);
+static void pushready(struct batchio *bio, struct rd *rd);
+static void startwrite(struct batchio *bio, struct wr *wr);
+static void nextdir(struct batchio *bio, struct wr *wr);
+static void writedone(struct batchio *bio, struct wr *wr, int res);
+static void writefailed(struct batchio *bio, struct wr *wr, int error);
+
+/**
+ * bio_open --
+ *      Start an engine loading `paths`, in order.
+ *
+ * Returns:
+ *  The engine, or NULL if io_uring (or an operation the engine needs)
+ *  is not available.
+ */
+struct batchio *bio_open(const char *const *paths, size_t npaths) {
+  struct io_uring_probe *probe;
+  struct batchio *bio;
+  int ok;
+
+  if ((bio = calloc(1, sizeof(*bio))) == NULL)
+    return NULL;
+  if (io_uring_queue_init(BIO_RINGSIZE, &bio->ring, 0) < 0) {
+    free(bio);
+    return NULL;
+  }
+  probe = io_uring_get_probe_ring(&bio->ring);          /* mkdirat needs Linux 5.15. */
+  ok = probe != NULL && io_uring_opcode_supported(probe, IORING_OP_OPENAT) &&
+       io_uring_opcode_supported(probe, IORING_OP_READ) &&
+       io_uring_opcode_supported(probe, IORING_OP_WRITE) &&
+       io_uring_opcode_supported(probe, IORING_OP_CLOSE) &&
+       io_uring_opcode_supported(probe, IORING_OP_RENAMEAT) &&
+       io_uring_opcode_supported(probe, IORING_OP_MKDIRAT);
+  if (probe != NULL)
+    io_uring_free_probe(probe);
+  if (!ok || (bio->efd = eventfd(0, EFD_CLOEXEC)) == -1) {
+    io_uring_queue_exit(&bio->ring);
+    free(bio);
+    return NULL;
+  }
+
+  bio->paths = paths;
+  bio->npaths = npaths;
+  bio->readytail = &bio->ready;
+  bio->queuetail = &bio->queue;
+  bio->wake.kind = OP_WAKE;
+  pthread_mutex_init(&bio->lock, NULL);
+  pthread_cond_init(&bio->cv, NULL);
+  if (pthread_create(&bio->tid, NULL, engine, bio) != 0) {
+    pthread_cond_destroy(&bio->cv);
+    pthread_mutex_destroy(&bio->lock);
+    close(bio->efd);
+    io_uring_queue_exit(&bio->ring);
+    free(bio);
+    return NULL;
+  }
+  return bio;
+}
+
+/**
+ * bio_next --
+ *      Take the next loaded input, waiting for one if need be. Inputs
+ *      come out in the order they finished loading; `in->index` says
+ *      which path each is. One that could not be loaded has `error`
+ *      set and no data.
+ *
+ * Returns:
+ *  1 with an input, 0 once every input has been handed out.
+ */
+int bio_next(struct batchio *bio, struct bio_in *in) {
+  struct rd *rd;
+
+  pthread_mutex_lock(&bio->lock);
+  while (bio->ready == NULL && bio->handed < bio->npaths)
+    pthread_cond_wait(&bio->cv, &bio->lock);
+  if ((rd = bio->ready) == NULL) {
+    pthread_mutex_unlock(&bio->lock);
+    return 0;
+  }
+  if ((bio->ready = rd->next) == NULL)
+    bio->readytail = &bio->ready;
+  if (++bio->handed == bio->npaths)
+    pthread_cond_broadcast(&bio->cv);                   /* Let the other converters finish. */
+  pthread_mutex_unlock(&bio->lock);
+  *in = rd->in;
+  free(rd);
+  return 1;
+}
+
+/**
+ * bio_release --
+ *      Give back an input taken with `bio_next`, making room for the
+ *      engine to load another.
+ */
+void bio_release(struct batchio *bio, struct bio_in *in) {
+  free(in->data);
+  in->data = NULL;
+  pthread_mutex_lock(&bio->lock);
+  bio->held--;
+  pthread_mutex_unlock(&bio->lock);
+  wake(bio);
+}
+
+/**
+ * bio_write --
+ *      Have a page written to `tmp` (which must not exist) and renamed
+ *      to `final`. Failures are reported by the engine and make
+ *      `bio_close` fail.
+ * Parameters:
+ *  bio     -   the engine
+ *  tmp     -   temporary name, next to `final`
+ *  final   -   name of the page
+ *  data    -   its contents; freed by the engine
+ *  len     -   their length
+ */
+void bio_write(struct batchio *bio, const char *tmp, const char *final, char *data, size_t len) {
+  size_t tlen = strlen(tmp) + 1, flen = strlen(final) + 1;
+  struct wr *wr;
+
+  if ((wr = malloc(sizeof(*wr) + 2 * tlen + flen)) == NULL)
+    err(1, NULL);
+  wr->op.kind = OP_WRITE;
+  wr->next = NULL;
+  wr->fd = -1;
+  wr->stage = WR_OPEN;
+  wr->done = 0;
+  wr->data = data;
+  wr->len = len;
+  wr->tmp = (char *)(wr + 1);
+  wr->final = wr->tmp + tlen;
+  wr->dir = wr->final + flen;
+  wr->dirlen = 0;
+  wr->mkdirs = 0;
+  memcpy(wr->tmp, tmp, tlen);
+  memcpy(wr->final, final, flen);
+  memcpy(wr->dir, tmp, tlen);
+
+  pthread_mutex_lock(&bio->lock);
+  *bio->queuetail = wr;
+  bio->queuetail = &wr->next;
+  pthread_mutex_unlock(&bio->lock);
+  wake(bio);
+}
+
+/**
+ * bio_close --
+ *      Wait for every page handed to the engine to be written, then
+ *      stop it. Every input must have been released.
+ *
+ * Returns:
+ *  0 if every page was written, -1 otherwise.
+ */
+int bio_close(struct batchio *bio) {
+  int rv;
+
+  pthread_mutex_lock(&bio->lock);
+  bio->closing = 1;
+  pthread_mutex_unlock(&bio->lock);
+  wake(bio);
+  pthread_join(bio->tid, NULL);
+
+  rv = bio->failed ? -1 : 0;
+  io_uring_queue_exit(&bio->ring);                      /* Also drops the read of `efd`. */
+  close(bio->efd);
+  pthread_cond_destroy(&bio->cv);
+  pthread_mutex_destroy(&bio->lock);
+  free(bio);
+  return rv;
+}
+
+/**
+ * engine --
+ *      Start what there is room for, submit it together with whatever
+ *      the completions asked for, wait, and handle the completions;
+ *      until `bio_close` and every page is written.
+ */
+static void *engine(void *arg) {
+  struct batchio *bio = arg;
+  struct io_uring_cqe *cqe;
+  struct op *op;
+  struct wr *wr;
+  int res, done;
+
+  armwake(bio);
+  for (;;) {
+    pthread_mutex_lock(&bio->lock);
+    while (bio->queue != NULL && bio->writing < BIO_WRITES) {
+      wr = bio->queue;
+      if ((bio->queue = wr->next) == NULL)
+        bio->queuetail = &bio->queue;
+      bio->writing++;
+      startwrite(bio, wr);
+    }
+    while (bio->nextpath < bio->npaths && bio->held < BIO_WINDOW) {
+      bio->held++;
+      startread(bio, bio->nextpath++);
+    }
+    done = bio->closing && bio->queue == NULL && bio->writing == 0;
+    pthread_mutex_unlock(&bio->lock);
+    if (done)
+      break;
+
+    io_uring_submit_and_wait(&bio->ring, 1);
+    while (io_uring_peek_cqe(&bio->ring, &cqe) == 0) {
+      op = io_uring_cqe_get_data(cqe);
+      res = cqe->res;
+      io_uring_cqe_seen(&bio->ring, cqe);
+      switch (op->kind) {
+        case OP_WAKE:
+          armwake(bio);
+          break;
+        case OP_READ:
+          readdone(bio, (struct rd *)op, res);
+          break;
+        case OP_WRITE:
+          writedone(bio, (struct wr *)op, res);
+          break;
+      }
+    }
+  }
+  return NULL;
+}
+
+/**
+ * getsqe --
+ *      A submission queue entry, submitting what is queued if the
+ *      queue is full.
+ */
+static struct io_uring_sqe *getsqe(struct batchio *bio) {
+  struct io_uring_sqe *sqe;
+
+  while ((sqe = io_uring_get_sqe(&bio->ring)) == NULL)
+    io_uring_submit(&bio->ring);
+  return sqe;
+}
+
+/**
+ * wake --
+ *      Get the engine out of its wait to look at the shared state.
+ */
+static void wake(struct batchio *bio) {
+  uint64_t one = 1;
+
+  if (write(bio->efd, &one, sizeof(one)) == -1)
+    warn("eventfd");
+}
+
+/**
+ * armwake --
+ *      Queue the read of `efd` that `wake` completes.
+ */
+static void armwake(struct batchio *bio) {
+  struct io_uring_sqe *sqe = getsqe(bio);
+
+  io_uring_prep_read(sqe, bio->efd, &bio->evcount, sizeof(bio->evcount), 0);
+  io_uring_sqe_set_data(sqe, &bio->wake);
+}
+
+/**
+ * startread --
+ *      Queue the open of an input.
+ */
+static void startread(struct batchio *bio, size_t index) {
+  struct io_uring_sqe *sqe;
+  struct rd *rd;
+
+  if ((rd = calloc(1, sizeof(*rd))) == NULL)
+    err(1, NULL);
+  rd->op.kind = OP_READ;
+  rd->fd = -1;
+  rd->in.index = index;
+  sqe = getsqe(bio);
+  io_uring_prep_openat(sqe, AT_FDCWD, bio->paths[index], O_RDONLY | O_CLOEXEC, 0);
+  io_uring_sqe_set_data(sqe, rd);
+}
+
+/**
+ * readdone --
+ *      Move an input on once its open or read has completed: size the
+ *      buffer from the open file, read until end of file (growing the
+ *      buffer if the file grew) and then hand the input out.
+ * Parameters:
+ *  bio     -   the engine
+ *  rd      -   the input
+ *  res     -   result of the operation (-errno on failure)
+ */
+static void readdone(struct batchio *bio, struct rd *rd, int res) {
+  struct io_uring_sqe *sqe;
+  struct stat st;
+  size_t n;
+  char *p;
+
+  if (res < 0) {
+    readfailed(bio, rd, -res);
+    return;
+  }
+  if (rd->fd == -1) {                                   /* Opened. */
+    rd->fd = res;
+    if (fstat(rd->fd, &st) == -1) {
+      readfailed(bio, rd, errno);
+      return;
+    }
+    rd->cap = S_ISREG(st.st_mode) && st.st_size > 0 ? (size_t)st.st_size + 1 : 64 * 1024;
+    if ((rd->in.data = malloc(rd->cap)) == NULL) {      /* One spare byte sees the end of file. */
+      readfailed(bio, rd, errno);
+      return;
+    }
+  } else if (res == 0) {                                /* End of file. */
+    close(rd->fd);
+    pushready(bio, rd);
+    return;
+  } else {
+    rd->in.len += (size_t)res;
+  }
+
+  if (rd->in.len == rd->cap) {
+    if ((p = realloc(rd->in.data, rd->cap * 2)) == NULL) {
+      readfailed(bio, rd, errno);
+      return;
+    }
+    rd->in.data = p;
+    rd->cap *= 2;
+  }
+  n = rd->cap - rd->in.len;
+  sqe = getsqe(bio);
+  io_uring_prep_read(sqe, rd->fd, rd->in.data + rd->in.len, n > IOCHUNK ? IOCHUNK : (unsigned int)n,
+                     (uint64_t)-1);                     /* From the file position: pipes too. */
+  io_uring_sqe_set_data(sqe, rd);
+}
+
+/**
+ * readfailed --
+ *      Hand out an input that could not be loaded, with its error.
+ */
+static void readfailed(struct batchio *bio, struct rd *rd, int error) {
+  if (rd->fd != -1)
+    close(rd->fd);
+  free(rd->in.data);
+  rd->in.data = NULL;
+  rd->in.len = 0;
+  rd->in.error = error;
+  pushready(bio, rd);
+}
+
+/**
+ * pushready --
+ *      Put a loaded input on the ready list for `bio_next`.
+ */
+static void pushready(struct batchio *bio, struct rd *rd) {
+  rd->next = NULL;
+  pthread_mutex_lock(&bio->lock);
+  *bio->readytail = rd;
+  bio->readytail = &rd->next;
+  pthread_cond_signal(&bio->cv);
+  pthread_mutex_unlock(&bio->lock);
+}
+
+/**
+ * startwrite --
+ *      Queue the creation of a page's temporary file.
+ */
+static void startwrite(struct batchio *bio, struct wr *wr) {
+  struct io_uring_sqe *sqe = getsqe(bio);
+
+  io_uring_prep_openat(sqe, AT_FDCWD, wr->tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  io_uring_sqe_set_data(sqe, wr);
+}
+
+/**
+ * nextdir --
+ *      Queue the creation of the next directory leading up to a page,
+ *      outermost first, or the page's open again once they all exist.
+ */
+static void nextdir(struct batchio *bio, struct wr *wr) {
+  struct io_uring_sqe *sqe;
+  char *slash;
+
+  if (wr->dirlen > 0)
+    wr->dir[wr->dirlen] = '/';
+  if ((slash = strchr(wr->dir + wr->dirlen + 1, '/')) == NULL) {
+    wr->stage = WR_OPEN;
+    startwrite(bio, wr);
+    return;
+  }
+  *slash = '\0';
+  wr->dirlen = (size_t)(slash - wr->dir);
+  sqe = getsqe(bio);
+  io_uring_prep_mkdirat(sqe, AT_FDCWD, wr->dir, 0755);
+  io_uring_sqe_set_data(sqe, wr);
+}
+
+/**
+ * writedone --
+ *      Move a page on to its next stage once the last one completed.
+ * Parameters:
+ *  bio     -   the engine
+ *  wr      -   the page
+ *  res     -   result of the operation (-errno on failure)
+ */
+static void writedone(struct batchio *bio, struct wr *wr, int res) {
+  struct io_uring_sqe *sqe;
+  size_t n;
+
+  if (wr->stage == WR_OPEN && res == -ENOENT && !wr->mkdirs) { /* A directory is missing. */
+    wr->mkdirs = 1;
+    wr->stage = WR_MKDIR;
+    nextdir(bio, wr);
+    return;
+  }
+  if (wr->stage == WR_MKDIR && res == -EEXIST)
+    res = 0;
+  if (res < 0 || (wr->stage == WR_WRITE && res == 0)) {
+    writefailed(bio, wr, res < 0 ? -res : EIO);
+    return;
+  }
+  switch (wr->stage) {
+    case WR_OPEN:
+      wr->fd = res;
+      fchmod(wr->fd, 0644);                             /* As mkstemp(3) pages are: not the umask. */
+      wr->stage = WR_WRITE;
+      break;
+    case WR_WRITE:
+      wr->done += (size_t)res;
+      break;
+    case WR_CLOSE:
+      wr->fd = -1;
+      wr->stage = WR_RENAME;
+      sqe = getsqe(bio);
+      io_uring_prep_renameat(sqe, AT_FDCWD, wr->tmp, AT_FDCWD, wr->final, 0);
+      io_uring_sqe_set_data(sqe, wr);
+      return;
+    case WR_RENAME:
+      free(wr->data);
+      free(wr);
+      bio->writing--;
+      return;
+    case WR_MKDIR:
+      nextdir(bio, wr);
+      return;
+  }
+
+  sqe = getsqe(bio);
+  if (wr->done < wr->len) {
+    n = wr->len - wr->done;
+    io_uring_prep_write(sqe, wr->fd, wr->data + wr->done, n > IOCHUNK ? IOCHUNK : (unsigned int)n,
+                        wr->done);
+  } else {
+    wr->stage = WR_CLOSE;
+    io_uring_prep_close(sqe, wr->fd);
+  }
+  io_uring_sqe_set_data(sqe, wr);
+}
+
+/**
+ * writefailed --
+ *      Report a page that could not be written and drop it, removing
+ *      its temporary file if it was created.
+ */
+static void writefailed(struct batchio *bio, struct wr *wr, int error) {
+  errno = error;
+  warn("%s", wr->stage == WR_RENAME ? wr->final : wr->stage == WR_MKDIR ? wr->dir : wr->tmp);
+  if (wr->stage == WR_WRITE)
+    close(wr->fd);
+  if (wr->stage != WR_OPEN && wr->stage != WR_MKDIR)    /* The file is ours: it was made O_EXCL. */
+    unlink(wr->tmp);
+  free(wr->data);
+  free(wr);
+  bio->writing--;
+  bio->failed = 1;
+}
+
+#else /* !HAVE_LIBURING */
+
+/*
+ * Without liburing there is no engine: `bio_open` always fails and
+ * the caller does its own I/O, so the rest is never reached.
+ */
+struct batchio *bio_open(const char *const *paths, size_t npaths) {
+  (void)paths;
+  (void)npaths;
+  return NULL;
+}
+
+int bio_next(struct batchio *bio, struct bio_in *in) {
+  (void)bio;
+  (void)in;
+  return 0;
+}
+
+void bio_release(struct batchio *bio, struct bio_in *in) {
+  (void)bio;
+  free(in->data);
+}
+
+void bio_write(struct batchio *bio, const char *tmp, const char *final, char *data, size_t len) {
+  (void)bio;
+  (void)tmp;
+  (void)final;
+  (void)len;
+  free(data);
+}
+
+int bio_close(struct batchio *bio) {
+  (void)bio;
+  return 0;
+}
+
+#endif /* HAVE_LIBURING */
+///:~
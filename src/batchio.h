@@ -0,0 +1,44 @@
+//===---------------------------------------------------*- C -*---===
+//: batchio.h
+//
+// DESCRIPTION
+// Batched file I/O for md2mdoc's -d mode. An engine thread opens and
+// reads the inputs of a batch ahead of the converters, and writes the
+// pages they hand back (temporary file, then rename into place), so
+// the converting threads never wait on the file system. Opens, reads,
+// writes, closes and renames go through io_uring(7) in batches.
+//
+// The engine is only built with HAVE_LIBURING (see the makefile);
+// otherwise, or when the kernel has no io_uring, `bio_open` fails and
+// the caller does its own I/O with plain POSIX calls.
+//===-------------------------------------------------------------===
+#ifndef MD2MDOC_BATCHIO_H
+#define MD2MDOC_BATCHIO_H
+
+#include <stddef.h>
+
+#define BIO_WINDOW 32                                   /* Inputs loaded ahead of the converters. */
+#define BIO_WRITES 64                                   /* Pages being written at once. */
+#define BIO_RINGSIZE 256                                /* Submission queue entries. */
+
+struct batchio;
+
+/*
+ * bio_in --
+ *      One loaded input.
+ */
+struct bio_in {
+  size_t index;                                         /* Which of the paths given to `bio_open`. */
+  char *data;                                           /* Its contents (malloc'd). */
+  size_t len;
+  int error;                                            /* errno of a failed open or read, or 0. */
+};
+
+struct batchio *bio_open(const char *const *paths, size_t npaths); /* NULL: do the I/O yourself. */
+int bio_next(struct batchio *bio, struct bio_in *in);   /* 0 once every input was handed out. */
+void bio_release(struct batchio *bio, struct bio_in *in); /* Done with an input. */
+void bio_write(struct batchio *bio, const char *tmp, const char *final,
+               char *data, size_t len);                 /* Takes `data` (malloc'd). */
+int bio_close(struct batchio *bio);                     /* -1 if any page could not be written. */
+
+#endif /* MD2MDOC_BATCHIO_H */
@@ -0,0 +1,327 @@
+//===---------------------------------------------------*- C -*---===
+//: cache.c
+//
+// DESCRIPTION
+// A directory of converted pages keyed on their input. Each entry is
+// two files: `<key>` holds the mdoc output and `<key>.meta` what
+// batch mode needs besides it, one line each: the manual section
+// taken from the page's `title:` line (it names the output), the
+// names and description of its NAME section and its title (for
+// --whatis). Both are written to a temporary name and renamed into
+// place, the metadata first, so a reader that
+// finds `<key>` always finds a complete entry; several md2mdoc
+// processes may share one cache.
+//===-------------------------------------------------------------===
+
+#include "cache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+//-------------------------------------------------------------------
+// Constants Declarations
+//-------------------------------------------------------------------
+#define HASHMUL 0x9e3779b97f4a7c15ULL                   /* Odd constant used to spread the bits. */
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static uint64_t hash64(const char *p, size_t len, uint64_t h);
+static int entrypath(char *path, size_t cap, const char *dir, const char *key, const char *suffix);
+static int putfile(const char *path, const char *data, size_t len);
+static int copyfile(const char *src, const char *dst);
+static const char *metaline(const char *p, const char *end, char *dst, size_t cap);
+
+/**
+ * hash64 --
+ *      Hash `len` bytes eight at a time, continuing from `h`. Not
+ *      cryptographic; it only has to tell edited pages apart.
+ */
+static uint64_t hash64(const char *p, size_t len, uint64_t h) {
+  uint64_t w;
+
+  for (; len >= 8; p += 8, len -= 8) {
+    memcpy(&w, p, 8);
+    h = (h ^ w) * HASHMUL;
+    h ^= h >> 29;
+  }
+  w = 0;
+  memcpy(&w, p, len);
+  h = (h ^ w ^ ((uint64_t)len << 56)) * HASHMUL;
+  h ^= h >> 32;                                         /* Final mix so every input bit reaches */
+  h *= HASHMUL;                                         /*   every output bit. */
+  h ^= h >> 29;
+  return h;
+}
+
+/**
+ * cache_key --
+ *      Make the cache key of an input.
+ * Parameters:
+ *  data    -   the markdown
+ *  len     -   its length
+ *  salt    -   anything else the output depends on (the md2mdoc
+ *              version), so a new release does not reuse old pages
+ *  key     -   where the key is written (CACHE_KEYMAX bytes)
+ *  keycap  -   size of `key`
+ */
+void cache_key(const char *data, size_t len, const char *salt, char *key, size_t keycap) {
+  uint64_t h;
+
+  h = hash64(salt, strlen(salt), 0);
+  h = hash64(data, len, h);
+  snprintf(key, keycap, "%016llx-%llx", (unsigned long long)h, (unsigned long long)len);
+}
+
+/**
+ * entrypath --
+ *      Build the path of a cache file.
+ *
+ * Returns:
+ *  0 on success, -1 if the name does not fit.
+ */
+static int entrypath(char *path, size_t cap, const char *dir, const char *key, const char *suffix) {
+  if (snprintf(path, cap, "%s/%s%s", dir, key, suffix) >= (int)cap) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * cache_lookup --
+ *      Check for an entry.
+ * Parameters:
+ *  dir     -   cache directory
+ *  key     -   key from `cache_key`
+ *  meta    -   receives what was stored with the page
+ *
+ * Returns:
+ *  0 on a hit, -1 on a miss.
+ */
+int cache_lookup(const char *dir, const char *key, struct cache_meta *meta) {
+  char path[PATH_MAX], buf[sizeof(*meta) + 4];
+  const char *p;
+  ssize_t n;
+  int fd;
+
+  if (entrypath(path, sizeof(path), dir, key, "") == -1 || access(path, R_OK) == -1)
+    return -1;
+  if (entrypath(path, sizeof(path), dir, key, ".meta") == -1 ||
+      (fd = open(path, O_RDONLY)) == -1)
+    return -1;
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  if (n < 0)
+    return -1;
+  p = metaline(buf, buf + n, meta->section, sizeof(meta->section));
+  p = metaline(p, buf + n, meta->names, sizeof(meta->names));
+  p = metaline(p, buf + n, meta->desc, sizeof(meta->desc));
+  metaline(p, buf + n, meta->title, sizeof(meta->title));
+  return 0;
+}
+
+/**
+ * metaline --
+ *      Copy one line of an entry's metadata, truncated to fit.
+ *
+ * Returns:
+ *  The start of the next line.
+ */
+static const char *metaline(const char *p, const char *end, char *dst, size_t cap) {
+  const char *nl;
+  size_t n;
+
+  if ((nl = memchr(p, '\n', (size_t)(end - p))) == NULL)
+    nl = end;
+  n = (size_t)(nl - p);
+  if (n > cap - 1)
+    n = cap - 1;
+  memcpy(dst, p, n);
+  dst[n] = '\0';
+  return nl < end ? nl + 1 : end;
+}
+
+/**
+ * putfile --
+ *      Write `data` to `path` by way of a temporary file.
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+static int putfile(const char *path, const char *data, size_t len) {
+  char tmp[PATH_MAX];
+  ssize_t n;
+  int fd, saved;
+
+  if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  if ((fd = mkstemp(tmp)) == -1)
+    return -1;
+  fchmod(fd, 0644);
+  while (len > 0) {
+    if ((n = write(fd, data, len)) == -1) {
+      if (errno == EINTR)
+        continue;
+      goto fail;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+  if (close(fd) == -1) {
+    fd = -1;
+    goto fail;
+  }
+  if (rename(tmp, path) == -1) {
+    fd = -1;
+    goto fail;
+  }
+  return 0;
+
+fail:
+  saved = errno;
+  if (fd != -1)
+    close(fd);
+  unlink(tmp);
+  errno = saved;
+  return -1;
+}
+
+/**
+ * cache_store --
+ *      Add a converted page to the cache.
+ * Parameters:
+ *  dir     -   cache directory
+ *  key     -   key from `cache_key`
+ *  meta    -   what to keep with the page
+ *  data    -   the mdoc output
+ *  len     -   its length
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+int cache_store(const char *dir, const char *key, const struct cache_meta *meta,
+                const char *data, size_t len) {
+  char path[PATH_MAX], buf[sizeof(*meta) + 4];
+  int n;
+
+  n = snprintf(buf, sizeof(buf), "%s\n%s\n%s\n%s\n", meta->section, meta->names,
+               meta->desc, meta->title);
+  if (entrypath(path, sizeof(path), dir, key, ".meta") == -1 ||
+      putfile(path, buf, (size_t)n) == -1)
+    return -1;
+  if (entrypath(path, sizeof(path), dir, key, "") == -1 ||
+      putfile(path, data, len) == -1)
+    return -1;
+  return 0;
+}
+
+/**
+ * copyfile --
+ *      Copy `src` into the new file `dst`.
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+static int copyfile(const char *src, const char *dst) {
+  char buf[64 * 1024];
+  ssize_t n, w, off;
+  int in, out, saved;
+
+  if ((in = open(src, O_RDONLY)) == -1)
+    return -1;
+  if ((out = open(dst, O_WRONLY | O_CREAT | O_EXCL, 0644)) == -1) {
+    saved = errno;
+    close(in);
+    errno = saved;
+    return -1;
+  }
+  while ((n = read(in, buf, sizeof(buf))) != 0) {
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      goto fail;
+    }
+    for (off = 0; off < n; off += w) {
+      if ((w = write(out, buf + off, (size_t)(n - off))) == -1) {
+        if (errno == EINTR) {
+          w = 0;
+          continue;
+        }
+        goto fail;
+      }
+    }
+  }
+  close(in);
+  if (close(out) == -1) {
+    saved = errno;
+    unlink(dst);
+    errno = saved;
+    return -1;
+  }
+  return 0;
+
+fail:
+  saved = errno;
+  close(in);
+  close(out);
+  unlink(dst);
+  errno = saved;
+  return -1;
+}
+
+/**
+ * cache_fetch --
+ *      Put a copy of the cached page at `dst`, which must not exist
+ *      yet. The page is not hard linked: an output sharing the
+ *      entry's inode would carry any later write to it (say by
+ *      `md2mdoc -o`, which truncates in place) into the cache.
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+int cache_fetch(const char *dir, const char *key, const char *dst) {
+  char path[PATH_MAX];
+
+  if (entrypath(path, sizeof(path), dir, key, "") == -1)
+    return -1;
+  return copyfile(path, dst);
+}
+
+/**
+ * cache_write --
+ *      Copy the cached page to `out`.
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+int cache_write(const char *dir, const char *key, FILE *out) {
+  char path[PATH_MAX], buf[64 * 1024];
+  size_t n;
+  FILE *in;
+  int rv = 0;
+
+  if (entrypath(path, sizeof(path), dir, key, "") == -1 ||
+      (in = fopen(path, "r")) == NULL)
+    return -1;
+  while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+    if (fwrite(buf, 1, n, out) != n) {
+      rv = -1;
+      break;
+    }
+  if (ferror(in))
+    rv = -1;
+  fclose(in);
+  return rv;
+} ///:~
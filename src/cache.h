@@ -0,0 +1,38 @@
+//===---------------------------------------------------*- C -*---===
+//: cache.h
+//
+// DESCRIPTION
+// Conversion cache used by md2mdoc's --cache-dir option. A page is
+// stored under a key made from a hash of its markdown and the
+// md2mdoc version, so an unchanged input can be copied from the
+// cache instead of being converted again.
+//===-------------------------------------------------------------===
+#ifndef MD2MDOC_CACHE_H
+#define MD2MDOC_CACHE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define CACHE_KEYMAX 64                                 /* Room for a key and its NUL. */
+
+/*
+ * cache_meta --
+ *      What batch mode needs to know about a page besides its output:
+ *      the section names the output file, the rest goes into --whatis.
+ *      Each field is "" when the page has none.
+ */
+struct cache_meta {
+  char section[16];
+  char names[128];                                      /* From the NAME section. */
+  char desc[256];
+  char title[64];                                       /* From the `title:` line. */
+};
+
+void cache_key(const char *data, size_t len, const char *salt, char *key, size_t keycap); /* Key of an input. */
+int cache_lookup(const char *dir, const char *key, struct cache_meta *meta); /* 0 on a hit. */
+int cache_fetch(const char *dir, const char *key, const char *dst); /* Copy a hit to `dst`. */
+int cache_write(const char *dir, const char *key, FILE *out); /* Copy a hit to a stream. */
+int cache_store(const char *dir, const char *key, const struct cache_meta *meta,
+                const char *data, size_t len);          /* Add a converted page. */
+
+#endif /* MD2MDOC_CACHE_H */
@@ -0,0 +1,315 @@
+//===---------------------------------------------------*- C -*---===
+//: gzout.c
+//
+// DESCRIPTION
+// Compresses pages to gzip format with zlib (see gzout.h). The
+// converting thread and the deflating thread share a ring of
+// GZ_NCHUNKS chunks: the converter fills the chunk at `head` and
+// hands it over when it is full, the deflater empties the chunk at
+// `tail`. The converter waits only when every chunk is still waiting
+// to be deflated, so the memory used stays the same however large
+// the page.
+//===-------------------------------------------------------------===
+
+#include "gzout.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+//-------------------------------------------------------------------
+// Constants Declarations
+//-------------------------------------------------------------------
+#define GZ_WINDOW (15 + 16)                             /* Largest window, gzip header and trailer. */
+#define GZ_MEMLEVEL 8                                   /* zlib's default. */
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+/*
+ * gzout --
+ *      One compressed stream and its deflating thread.
+ */
+struct gzout {
+  FILE *out;
+  z_stream zs;                                          /* Used by the deflating thread only. */
+  char ring[GZ_NCHUNKS][GZ_CHUNK];
+  size_t len[GZ_NCHUNKS];                               /* Bytes in each chunk. */
+  unsigned char zbuf[GZ_CHUNK];                         /* Compressed bytes on their way to `out`. */
+  unsigned long head;                                   /* Chunks handed over (the next is being filled). */
+  unsigned long tail;                                   /* Chunks deflated. */
+  int done;                                             /* Set when no more chunks will come. */
+  int error;                                            /* errno of the first failure, or 0. */
+  pthread_mutex_t lock;
+  pthread_cond_t filled;                                /* `head` or `done` changed. */
+  pthread_cond_t drained;                               /* `tail` changed. */
+  pthread_t thread;
+};
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static void *deflater(void *arg);                       /* Body of the deflating thread. */
+static int squeeze(struct gzout *gz, const char *data, size_t len, int flush);
+static int handover(struct gzout *gz);
+
+/**
+ * gz_open --
+ *      Start a gzip stream into `out` and the thread that compresses
+ *      it.
+ * Parameters:
+ *  out     -   where the compressed page goes (written by the
+ *              thread until `gz_close`)
+ *  level   -   compression level, 1 (fastest) to 9 (smallest)
+ *
+ * Returns:
+ *  The stream, or NULL with errno set.
+ */
+struct gzout *gz_open(FILE *out, int level) {
+  struct gzout *gz;
+  int rc;
+
+  if ((gz = calloc(1, sizeof(*gz))) == NULL)
+    return NULL;
+  gz->out = out;
+  if (deflateInit2(&gz->zs, level, Z_DEFLATED, GZ_WINDOW, GZ_MEMLEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+    free(gz);
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&gz->lock, NULL);
+  pthread_cond_init(&gz->filled, NULL);
+  pthread_cond_init(&gz->drained, NULL);
+  if ((rc = pthread_create(&gz->thread, NULL, deflater, gz)) != 0) {
+    deflateEnd(&gz->zs);
+    pthread_mutex_destroy(&gz->lock);
+    pthread_cond_destroy(&gz->filled);
+    pthread_cond_destroy(&gz->drained);
+    free(gz);
+    errno = rc;
+    return NULL;
+  }
+  return gz;
+}
+
+/**
+ * gz_sink --
+ *      md2mdoc sink feeding a gzip stream: the bytes are copied into
+ *      the chunk being filled, which is handed to the thread when
+ *      full.
+ * Parameters:
+ *  arg     -   the stream (struct gzout *)
+ *  buf     -   bytes to compress
+ *  len     -   number of bytes
+ *
+ * Returns:
+ *  0 on success, -1 if the stream has failed (errno set).
+ */
+int gz_sink(void *arg, const char *buf, size_t len) {
+  struct gzout *gz = arg;
+  size_t slot, n;
+
+  while (len > 0) {
+    slot = gz->head % GZ_NCHUNKS;                       /* Only this thread moves `head`. */
+    n = GZ_CHUNK - gz->len[slot];
+    if (n > len)
+      n = len;
+    memcpy(gz->ring[slot] + gz->len[slot], buf, n);
+    gz->len[slot] += n;
+    buf += n;
+    len -= n;
+    if (gz->len[slot] == GZ_CHUNK && handover(gz) == -1)
+      return -1;
+  }
+  return 0;
+}
+
+/**
+ * handover --
+ *      Give the chunk being filled to the thread, and wait for a free
+ *      one if every chunk is now waiting.
+ *
+ * Returns:
+ *  0 on success, -1 if the stream has failed (errno set).
+ */
+static int handover(struct gzout *gz) {
+  int error;
+
+  pthread_mutex_lock(&gz->lock);
+  gz->head++;
+  pthread_cond_signal(&gz->filled);
+  while (gz->head - gz->tail == GZ_NCHUNKS)
+    pthread_cond_wait(&gz->drained, &gz->lock);
+  error = gz->error;
+  pthread_mutex_unlock(&gz->lock);
+  if (error != 0) {
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * gz_close --
+ *      Hand over what is left, end the stream and wait for the thread
+ *      to write it. `out` is left open.
+ *
+ * Returns:
+ *  0 on success, -1 if anything could not be compressed or written
+ *  (errno set).
+ */
+int gz_close(struct gzout *gz) {
+  int error;
+
+  pthread_mutex_lock(&gz->lock);
+  if (gz->len[gz->head % GZ_NCHUNKS] > 0)
+    gz->head++;
+  gz->done = 1;
+  pthread_cond_signal(&gz->filled);
+  pthread_mutex_unlock(&gz->lock);
+  pthread_join(gz->thread, NULL);
+
+  error = gz->error;
+  deflateEnd(&gz->zs);
+  pthread_mutex_destroy(&gz->lock);
+  pthread_cond_destroy(&gz->filled);
+  pthread_cond_destroy(&gz->drained);
+  free(gz);
+  if (error != 0) {
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * deflater --
+ *      Deflate the chunks as they are handed over, then finish the
+ *      stream. After a failure the chunks are only dropped, so the
+ *      converter never waits for good.
+ * Parameters:
+ *  arg     -   the stream (struct gzout *)
+ *
+ * Returns:
+ * NULL
+ */
+static void *deflater(void *arg) {
+  struct gzout *gz = arg;
+  size_t slot;
+  int last, error = 0;
+
+  for (;;) {
+    pthread_mutex_lock(&gz->lock);
+    while (gz->tail == gz->head && !gz->done)
+      pthread_cond_wait(&gz->filled, &gz->lock);
+    last = gz->tail == gz->head;                        /* Done, and nothing left. */
+    pthread_mutex_unlock(&gz->lock);
+    if (last)
+      break;
+
+    slot = gz->tail % GZ_NCHUNKS;
+    if (error == 0 && squeeze(gz, gz->ring[slot], gz->len[slot], Z_NO_FLUSH) == -1)
+      error = errno;
+    pthread_mutex_lock(&gz->lock);
+    gz->len[slot] = 0;
+    gz->tail++;
+    gz->error = error;
+    pthread_cond_signal(&gz->drained);
+    pthread_mutex_unlock(&gz->lock);
+  }
+  if (error == 0 && squeeze(gz, NULL, 0, Z_FINISH) == -1) {
+    pthread_mutex_lock(&gz->lock);
+    gz->error = errno;
+    pthread_mutex_unlock(&gz->lock);
+  }
+  return NULL;
+}
+
+/**
+ * squeeze --
+ *      Deflate `len` bytes and write out what zlib makes of them.
+ * Parameters:
+ *  gz      -   the stream
+ *  data    -   bytes to compress
+ *  len     -   number of bytes
+ *  flush   -   Z_NO_FLUSH, or Z_FINISH to end the stream
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+static int squeeze(struct gzout *gz, const char *data, size_t len, int flush) {
+  size_t n;
+  int rc;
+
+  gz->zs.next_in = (Bytef *)(uintptr_t)data;            /* zlib does not write to its input. */
+  gz->zs.avail_in = (uInt)len;                          /* At most GZ_CHUNK. */
+  do {
+    gz->zs.next_out = gz->zbuf;
+    gz->zs.avail_out = sizeof(gz->zbuf);
+    if ((rc = deflate(&gz->zs, flush)) == Z_STREAM_ERROR) {
+      errno = EIO;
+      return -1;
+    }
+    n = sizeof(gz->zbuf) - gz->zs.avail_out;
+    errno = 0;
+    if (n > 0 && fwrite(gz->zbuf, 1, n, gz->out) != n) {
+      if (errno == 0)
+        errno = EIO;
+      return -1;
+    }
+  } while (rc != Z_STREAM_END && (gz->zs.avail_out == 0 || flush == Z_FINISH));
+  return 0;
+}
+
+/**
+ * gz_buf --
+ *      Replace a whole page in memory by its gzip form.
+ * Parameters:
+ *  mb      -   the page
+ *  level   -   compression level, 1 to 9
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set; the page is unchanged).
+ */
+int gz_buf(struct md2mdoc_buf *mb, int level) {
+  z_stream zs;
+  uLong cap;
+  char *data;
+  int rc;
+
+  if (mb->len > UINT_MAX) {
+    errno = EFBIG;
+    return -1;
+  }
+  memset(&zs, 0, sizeof(zs));
+  if (deflateInit2(&zs, level, Z_DEFLATED, GZ_WINDOW, GZ_MEMLEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+    errno = ENOMEM;
+    return -1;
+  }
+  cap = deflateBound(&zs, (uLong)mb->len);
+  if ((data = malloc(cap)) == NULL) {
+    deflateEnd(&zs);
+    return -1;
+  }
+  zs.next_in = (Bytef *)mb->data;
+  zs.avail_in = (uInt)mb->len;
+  zs.next_out = (Bytef *)data;
+  zs.avail_out = (uInt)cap;
+  rc = deflate(&zs, Z_FINISH);
+  deflateEnd(&zs);
+  if (rc != Z_STREAM_END) {
+    free(data);
+    errno = EIO;
+    return -1;
+  }
+  free(mb->data);
+  mb->data = data;
+  mb->len = zs.total_out;
+  mb->cap = cap;
+  return 0;
+} ///:~
@@ -0,0 +1,31 @@
+//===---------------------------------------------------*- C -*---===
+//: gzout.h
+//
+// DESCRIPTION
+// gzip output behind md2mdoc's -z option. A page being converted is
+// handed to `gz_sink`, which only copies it into a small ring of
+// chunks; a thread of its own deflates the full chunks and writes
+// them out, so compressing overlaps with parsing instead of following
+// it. A page that is already whole in memory (batch pages, cache
+// entries) is compressed in place with `gz_buf`.
+//===-------------------------------------------------------------===
+#ifndef MD2MDOC_GZOUT_H
+#define MD2MDOC_GZOUT_H
+
+#include "md2mdoc.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define GZ_CHUNK (64 * 1024)                            /* Bytes deflated at a time. */
+#define GZ_NCHUNKS 4                                    /* Chunks between the converter and the thread. */
+#define GZ_LEVEL 6                                      /* Level of -z without --gzip-level, as gzip(1). */
+
+struct gzout;
+
+struct gzout *gz_open(FILE *out, int level);            /* Start compressing into `out`. */
+int gz_sink(void *arg, const char *buf, size_t len);    /* `arg` is a struct gzout *. */
+int gz_close(struct gzout *gz);                         /* Finish the stream; -1 if it failed. */
+int gz_buf(struct md2mdoc_buf *mb, int level);          /* Compress a whole page in place. */
+
+#endif /* MD2MDOC_GZOUT_H */
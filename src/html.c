@@ -0,0 +1,515 @@
+//===---------------------------------------------------*- C -*---===
+//: html.c
+//
+// DESCRIPTION
+// The HTML emitter, for publishing pages on the web. The constructs
+// the mdoc macros stand for map onto plain HTML elements:
+//
+//      .Sh / .Ss               ->  <h2> / <h3>
+//      .Pp                     ->  <p>
+//      .Bl -tag / .It Fl Ar    ->  <dl>, <dt><b>-flag</b> <i>arg</i>, <dd>
+//      .Bl -enum / -dash, .It  ->  <ol> / <ul>, <li>
+//      .Op                     ->  [...]
+//      .Bd -literal / .Ed      ->  <pre> / </pre>
+//      .Nm / .Nd               ->  name &#8212; description
+//      .Sy .Cm / .Em .Sx / .Li ->  <b> / <i> / <code>
+//      mapped macros           ->  <b>, <i> or plain text
+//      .Xr page n              ->  <b>page</b>(n)
+//      .Dt / .Dd / .Au         ->  <title>, <meta name="date">, <meta name="author">
+//
+// Elements whose end tag HTML lets us leave out (<p>, <dt>, <dd>,
+// <li>) are not closed. Text is escaped, and roff comment lines are
+// dropped. A heading closes an open list, which is opened again by the
+// next item, since the markdown lets a list run across sections.
+//===-------------------------------------------------------------===
+
+#include "ir.h"
+#include "markup.h"
+
+#include <string.h>
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static void put(struct emitter *em, const char *p, size_t n);
+static void putsanitized(struct emitter *em, const char *p, size_t n);
+static void escaped(struct emitter *em, const char *p, size_t n);
+static void body(struct emitter *em);
+static void setfont(struct emitter *em, int font);
+static void space(struct emitter *em);
+static void meta(struct emitter *em, const char *name, const char *p, size_t n);
+static void endline(struct emitter *em);
+static void text(struct emitter *em, const char *p, size_t n);
+static void element(struct emitter *em, const char *open, const char *close, const struct token *t);
+static void xref(struct emitter *em, const struct token *t);
+static void beginlist(struct emitter *em);
+static void endlist(struct emitter *em);
+static void begin_html(struct emitter *em);
+static void emit_html(struct emitter *em, const struct token *tok, size_t n);
+static void end_html(struct emitter *em);
+
+//-------------------------------------------------------------------
+// Global Variables
+//-------------------------------------------------------------------
+const struct format fmt_html = { "html", begin_html, emit_html, end_html };
+
+#define PUTLIT(em, lit) put((em), (lit), sizeof(lit) - 1)
+
+/**
+ * put --
+ *      Write bytes and remember the last one.
+ */
+static void put(struct emitter *em, const char *p, size_t n) {
+  if (n == 0)
+    return;
+  bufwrite(&em->out, p, n);
+  em->last = p[n - 1];
+  em->bol = em->last == '\n';
+}
+
+/**
+ * putsanitized --
+ *      Write bytes through `bufsanitized` (which leaves nothing that
+ *      needs escaping).
+ */
+static void putsanitized(struct emitter *em, const char *p, size_t n) {
+  if (n == 0)
+    return;
+  bufsanitized(&em->out, p, n);
+  em->last = ' ';
+  em->bol = 0;
+}
+
+/**
+ * escaped --
+ *      Write text with the characters special to HTML escaped. NULs
+ *      are dropped.
+ */
+static void escaped(struct emitter *em, const char *p, size_t n) {
+  const char *end = p + n, *run;
+
+  while (p < end) {
+    for (run = p; p < end && *p != '&' && *p != '<' && *p != '>' && *p != '"' && *p != '\0'; p++)
+      ;
+    put(em, run, (size_t)(p - run));
+    if (p == end)
+      break;
+    switch (*p++) {
+      case '&': PUTLIT(em, "&amp;"); break;
+      case '<': PUTLIT(em, "&lt;"); break;
+      case '>': PUTLIT(em, "&gt;"); break;
+      case '"': PUTLIT(em, "&quot;"); break;
+    }
+  }
+}
+
+/**
+ * body --
+ *      Close the <head> and open the <body>, once. Everything up to
+ *      the first visible content may still go into the <head>.
+ */
+static void body(struct emitter *em) {
+  if (!em->head)
+    return;
+  PUTLIT(em, "</head>\n<body>\n");
+  em->head = 0;
+}
+
+/**
+ * setfont --
+ *      Switch the font of a list tag or synopsis line.
+ */
+static void setfont(struct emitter *em, int font) {
+  if (em->font == font)
+    return;
+  if (em->font == FONT_B)
+    PUTLIT(em, "</b>");
+  else if (em->font == FONT_I)
+    PUTLIT(em, "</i>");
+  if (font == FONT_B)
+    PUTLIT(em, "<b>");
+  else if (font == FONT_I)
+    PUTLIT(em, "<i>");
+  em->font = (unsigned char)font;
+}
+
+/**
+ * space --
+ *      Separate a flag or argument from what is before it on the line.
+ */
+static void space(struct emitter *em) {
+  int sep = !em->bol && em->last != ' ' && em->last != '[' &&
+            (em->last != '>' || em->font != FONT_R);     /* In a font, '>' is text's end, not <dt>'s. */
+
+  setfont(em, FONT_R);                                  /* Writes a '>' of its own. */
+  if (sep)
+    PUTLIT(em, " ");
+}
+
+/**
+ * meta --
+ *      Write a <meta> element into the <head>.
+ */
+static void meta(struct emitter *em, const char *name, const char *p, size_t n) {
+  while (n > 0 && *p == ' ') {
+    p++;
+    n--;
+  }
+  PUTLIT(em, "<meta name=\"");
+  put(em, name, strlen(name));
+  PUTLIT(em, "\" content=\"");
+  escaped(em, p, trimlen(p, n));
+  PUTLIT(em, "\">\n");
+}
+
+/**
+ * endline --
+ *      Finish the current line.
+ */
+static void endline(struct emitter *em) {
+  const char *p = em->cap;
+  size_t n = em->caplen;
+
+  switch (em->line) {
+    case LINE_DATE:
+      if (em->head)
+        meta(em, "date", p, n);
+      break;
+    case LINE_AUTHOR:
+      if (em->head)
+        meta(em, "author", p, n);
+      break;
+    case LINE_TITLE:
+      while (n > 0 && *p == ' ') {
+        p++;
+        n--;
+      }
+      if (em->head) {
+        PUTLIT(em, "<title>");
+        escaped(em, p, trimlen(p, n));
+        PUTLIT(em, "</title>\n");
+      }
+      break;
+    case LINE_TAG:
+      setfont(em, FONT_R);
+      PUTLIT(em, "\n<dd>\n");
+      break;
+    case LINE_SYNOPSIS:
+      setfont(em, FONT_R);
+      PUTLIT(em, "]\n");
+      break;
+    case LINE_ROFF:                                     /* Not a comment after all. */
+      body(em);
+      escaped(em, p, n);
+      PUTLIT(em, "\n");
+      break;
+    case LINE_COMMENT:
+      break;
+    default:
+      PUTLIT(em, "\n");
+      break;
+  }
+  em->line = LINE_TEXT;
+  em->caplen = 0;
+}
+
+/**
+ * text --
+ *      Write text, a line at a time.
+ */
+static void text(struct emitter *em, const char *p, size_t n) {
+  const char *end = p + n, *nl, *q;
+  size_t len, i;
+
+  while (p < end) {
+    nl = memchr(p, '\n', (size_t)(end - p));
+    len = (size_t)((nl ? nl : end) - p);
+    if (em->line == LINE_TEXT && em->bol && !em->lit && len > 0 && *p == '.')
+      em->line = LINE_ROFF;
+    if (em->line == LINE_ROFF) {                        /* Perhaps a roff comment. */
+      for (i = 0; i < len && em->caplen < 3 && p[i] == ".\\\""[em->caplen]; i++)
+        em->cap[em->caplen++] = p[i];
+      p += i;
+      len -= i;
+      if (em->caplen == 3)
+        em->line = LINE_COMMENT;
+      else if (len > 0) {
+        body(em);
+        escaped(em, em->cap, em->caplen);
+        em->line = LINE_TEXT;
+        em->caplen = 0;
+      }
+    }
+    switch (em->line) {
+      case LINE_ROFF:
+      case LINE_COMMENT:
+        break;
+      case LINE_DATE:
+      case LINE_TITLE:
+      case LINE_AUTHOR:
+        em->caplen = capture(em->cap, em->caplen, sizeof(em->cap), p, len);
+        break;
+      case LINE_NAME:
+        em->namelen = capture(em->name, em->namelen, sizeof(em->name), p, len);
+        /* FALLTHROUGH */
+      default:
+        if (em->head) {                                 /* Blanks do not end the <head>. */
+          for (q = p; q < p + len && (*q == ' ' || *q == '\t'); q++)
+            ;
+          if (q == p + len)
+            break;
+          body(em);
+        }
+        escaped(em, p, len);
+        break;
+    }
+    if (nl == NULL)
+      break;
+    if (em->head && em->line == LINE_TEXT)
+      em->bol = 1;
+    else
+      endline(em);
+    p = nl + 1;
+  }
+}
+
+/**
+ * element --
+ *      Write the token's text wrapped in an element.
+ */
+static void element(struct emitter *em, const char *open, const char *close, const struct token *t) {
+  body(em);
+  put(em, open, strlen(open));
+  escaped(em, t->str, t->len);
+  put(em, close, strlen(close));
+  PUTLIT(em, "\n");
+}
+
+/**
+ * xref --
+ *      Write a `page(n)` reference as <b>page</b>(n).
+ */
+static void xref(struct emitter *em, const struct token *t) {
+  const char *open = memchr(t->str, '(', t->len), *sec;
+  size_t seclen;
+
+  body(em);
+  PUTLIT(em, "<b>");
+  putsanitized(em, t->str, open ? (size_t)(open - t->str) : t->len);
+  PUTLIT(em, "</b>");
+  if (open == NULL)
+    return;
+  sec = open + 1;
+  seclen = (size_t)(t->str + t->len - sec);
+  if (seclen > 0 && sec[seclen - 1] == ')')
+    seclen--;
+  PUTLIT(em, "(");
+  putsanitized(em, sec, seclen);
+  PUTLIT(em, ")");
+}
+
+/**
+ * beginlist --
+ *      Open the element of the list in `em->list`.
+ */
+static void beginlist(struct emitter *em) {
+  body(em);
+  if (em->list == LIST_ENUM)
+    PUTLIT(em, "<ol>\n");
+  else if (em->list == LIST_DASH)
+    PUTLIT(em, "<ul>\n");
+  else
+    PUTLIT(em, "<dl>\n");
+  em->para = 0;
+}
+
+/**
+ * endlist --
+ *      Close the open list.
+ */
+static void endlist(struct emitter *em) {
+  if (em->para)                                         /* Already closed by a heading. */
+    ;
+  else if (em->list == LIST_ENUM)
+    PUTLIT(em, "</ol>\n");
+  else if (em->list == LIST_DASH)
+    PUTLIT(em, "</ul>\n");
+  else
+    PUTLIT(em, "</dl>\n");
+  em->list = LIST_NONE;
+  em->para = 0;
+}
+
+/**
+ * begin_html --
+ *      Open the document.
+ */
+static void begin_html(struct emitter *em) {
+  PUTLIT(em, "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n");
+  em->head = 1;
+}
+
+/**
+ * emit_html --
+ *      Write `n` tokens as HTML.
+ * Parameters:
+ *  em  -   Emitter
+ *  tok -   Tokens to write
+ *  n   -   Number of tokens
+ */
+static void emit_html(struct emitter *em, const struct token *tok, size_t n) {
+  const struct token *t, *end = tok + n;
+  int list;
+
+  for (t = tok; t < end; t++) {
+    switch (t->kind) {
+      case TK_TEXT:
+        text(em, t->str, t->len);
+        break;
+      case TK_SECTION:
+      case TK_SUBSECTION:
+        body(em);
+        if (em->list != LIST_NONE && !em->para) {
+          list = em->list;
+          endlist(em);
+          em->list = (unsigned char)list;
+          em->para = 1;
+        }
+        if (t->kind == TK_SECTION)
+          PUTLIT(em, "<h2>");
+        else
+          PUTLIT(em, "<h3>");
+        putsanitized(em, t->str, trimlen(t->str, t->len));
+        if (t->kind == TK_SECTION)
+          PUTLIT(em, "</h2>\n");
+        else
+          PUTLIT(em, "</h3>\n");
+        break;
+      case TK_PARA:
+        if (em->head)
+          break;
+        if (em->lit)
+          PUTLIT(em, "\n");
+        else
+          PUTLIT(em, "<p>\n");
+        break;
+      case TK_LISTBEGIN:
+        body(em);
+        em->list = (unsigned char)(t->flags & ~TOK_NL);
+        beginlist(em);
+        break;
+      case TK_ITEM:
+        body(em);
+        if (em->para)
+          beginlist(em);
+        if (em->list == LIST_TAG) {
+          PUTLIT(em, "<dt>");
+          em->line = LINE_TAG;
+        } else {
+          PUTLIT(em, "<li>");
+        }
+        break;
+      case TK_LISTEND:
+        endlist(em);
+        break;
+      case TK_FLAG:
+        body(em);
+        space(em);
+        setfont(em, FONT_B);
+        PUTLIT(em, "-");
+        break;
+      case TK_ARG:
+        body(em);
+        if (t->flags & ARG_SPACED)
+          space(em);
+        setfont(em, FONT_I);
+        break;
+      case TK_OPTIONAL:
+        body(em);
+        PUTLIT(em, "[");
+        em->line = LINE_SYNOPSIS;
+        break;
+      case TK_LITBEGIN:
+        body(em);
+        PUTLIT(em, "<pre>\n");
+        em->lit = 1;
+        break;
+      case TK_LITEND:
+        PUTLIT(em, "</pre>\n");
+        em->lit = 0;
+        break;
+      case TK_NAME:
+        body(em);
+        em->line = LINE_NAME;
+        em->namelen = 0;
+        break;
+      case TK_DESC:
+        em->line = LINE_TEXT;
+        PUTLIT(em, "&#8212;");
+        break;
+      case TK_NAMEREF:
+        body(em);
+        PUTLIT(em, "<b>");
+        escaped(em, em->name, trimlen(em->name, em->namelen));
+        PUTLIT(em, "</b>\n");
+        break;
+      case TK_BOLD:
+      case TK_MODIFIER:
+        element(em, "<b>", "</b>", t);
+        break;
+      case TK_ITALIC:
+      case TK_SECREF:
+        element(em, "<i>", "</i>", t);
+        break;
+      case TK_LITERAL:
+        element(em, "<code>", "</code>", t);
+        break;
+      case TK_XREF:
+        xref(em, t);
+        break;
+      case TK_MACRO:
+        switch (em->markup->macro[t->flags & ~TOK_NL].font) {
+          case FONT_B:
+            element(em, "<b>", "</b>", t);
+            break;
+          case FONT_I:
+            element(em, "<i>", "</i>", t);
+            break;
+          default:
+            element(em, "", "", t);
+            break;
+        }
+        break;
+      case TK_AUTHOR:
+        em->line = LINE_AUTHOR;
+        break;
+      case TK_DATE:
+        em->line = LINE_DATE;
+        break;
+      case TK_TITLE:
+        em->line = LINE_TITLE;
+        break;
+      case TK_TITLEEND:
+        if (em->line == LINE_TITLE)                     /* A `title:` line with no newline. */
+          endline(em);
+        break;
+    }
+    if (t->flags & TOK_NL)
+      text(em, "\n", 1);
+  }
+}
+
+/**
+ * end_html --
+ *      Close whatever is still open, and the document.
+ */
+static void end_html(struct emitter *em) {
+  if (em->line != LINE_TEXT)
+    endline(em);
+  body(em);
+  if (em->lit)
+    PUTLIT(em, "</pre>\n");
+  if (em->list != LIST_NONE)
+    endlist(em);
+  PUTLIT(em, "</body>\n</html>\n");
+} ///:~
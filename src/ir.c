@@ -0,0 +1,296 @@
+//===---------------------------------------------------*- C -*---===
+//: ir.c
+//
+// DESCRIPTION
+// The token arena shared by the parser and the emitters, and the
+// output buffer the emitters write through. Tokens are appended to
+// fixed size blocks chained in a list; resetting the arena only
+// rewinds the blocks, so converting a run of documents allocates no
+// more than the largest of them needed.
+//===-------------------------------------------------------------===
+
+#include "ir.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/uio.h>
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static int okchar(int c);
+static int flushgather(struct outbuf *ob);              /* `bufflush` of a gathering buffer. */
+
+/**
+ * ir_grow --
+ *      Move on to the next block of the arena, allocating it if this
+ *      is the furthest the arena has been filled, and take its first
+ *      token.
+ * Parameters:
+ *  ir      -   the arena
+ *
+ * Returns:
+ *  The token, or `ir->scratch` if no block could be allocated.
+ */
+struct token *ir_grow(struct ir *ir) {
+  struct irblock *blk;
+
+  if (ir->error)
+    return &ir->scratch;
+  if (ir->cur != NULL && ir->cur->next != NULL)
+    blk = ir->cur->next;
+  else {
+    if ((blk = malloc(sizeof(*blk))) == NULL) {
+      ir->error = 1;
+      return &ir->scratch;
+    }
+    blk->next = NULL;
+    if (ir->cur != NULL)
+      ir->cur->next = blk;
+    else
+      ir->first = blk;
+  }
+  blk->n = 1;
+  ir->cur = blk;
+  return &blk->tok[0];
+}
+
+/**
+ * ir_reset --
+ *      Drop every token, keeping the blocks for reuse. An allocation
+ *      failure stays recorded in `error` until the owner clears it.
+ */
+void ir_reset(struct ir *ir) {
+  struct irblock *blk;
+
+  for (blk = ir->first; blk != NULL; blk = blk->next)
+    blk->n = 0;
+  ir->cur = ir->first;
+  ir->ntok = 0;
+}
+
+/**
+ * ir_free --
+ *      Release every block of the arena.
+ */
+void ir_free(struct ir *ir) {
+  struct irblock *blk, *next;
+
+  for (blk = ir->first; blk != NULL; blk = next) {
+    next = blk->next;
+    free(blk);
+  }
+  memset(ir, 0, sizeof(*ir));
+}
+
+/**
+ * ir_emit --
+ *      Hand the tokens of the arena, in order, to an emitter.
+ * Parameters:
+ *  ir      -   the arena
+ *  em      -   the emitter
+ */
+void ir_emit(const struct ir *ir, struct emitter *em) {
+  const struct irblock *blk;
+
+  for (blk = ir->first; blk != NULL && blk->n > 0; blk = blk->next) /* Blocks past the last */
+    em->fmt->emit(em, blk->tok, blk->n);                /*   one filled are empty. */
+}
+
+/**
+ * emitter_init --
+ *      Set up an emitter for a new document.
+ * Parameters:
+ *  em      -   the emitter
+ *  fmt     -   its output format
+ *  sink    -   where the output goes
+ *  arg     -   argument passed to `sink`
+ */
+void emitter_init(struct emitter *em, const struct format *fmt, md2mdoc_sink sink, void *arg) {
+  memset(em, 0, offsetof(struct emitter, out));         /* Not the (large) buffer itself. */
+  em->fmt = fmt;
+  em->list = LIST_NONE;
+  em->bol = 1;
+  em->out.sink = sink;
+  em->out.arg = arg;
+  em->out.len = 0;
+  em->out.total = 0;
+  em->out.error = 0;
+  em->out.fd = sink == md2mdoc_fd_sink ? *(int *)arg : -1;
+  em->out.niov = 0;
+  em->out.mark = 0;
+}
+
+/**
+ * capture --
+ *      Append `n` bytes to a fixed size buffer, dropping what does not
+ *      fit (one byte is kept for a NUL).
+ * Parameters:
+ *  dst     -   the buffer
+ *  len     -   bytes already in it
+ *  cap     -   its size
+ *  p       -   bytes to append
+ *  n       -   number of bytes
+ *
+ * Returns:
+ *  The new length.
+ */
+size_t capture(char *dst, size_t len, size_t cap, const char *p, size_t n) {
+  if (n > cap - 1 - len)
+    n = cap - 1 - len;
+  memcpy(dst + len, p, n);
+  dst[len + n] = '\0';
+  return len + n;
+}
+
+/**
+ * trimlen --
+ *      The length of `p` without trailing white space.
+ */
+size_t trimlen(const char *p, size_t n) {
+  while (n > 0 && (p[n - 1] == ' ' || (p[n - 1] >= '\t' && p[n - 1] <= '\r')))
+    n--;
+  return n;
+}
+
+/**
+ * bufflush --
+ *      Hand everything collected in the output buffer to its sink.
+ * Parameters:
+ *  ob      -   output buffer
+ *
+ * Returns:
+ *  0 on success, -1 if the sink could not be written.
+ */
+int bufflush(struct outbuf *ob) {
+  if (ob->niov > 0)
+    return flushgather(ob);
+  if (ob->len > 0 && ob->sink(ob->arg, ob->data, ob->len) == -1)
+    ob->error = 1;
+  ob->total += ob->len;
+  ob->len = 0;
+  return ob->error ? -1 : 0;
+}
+
+/**
+ * bufgather --
+ *      Add a run of input to the pieces of the output buffer, after
+ *      what has been copied into `data` since the last piece. A run
+ *      that carries straight on from the last one extends it.
+ * Parameters:
+ *  ob      -   output buffer (gathering)
+ *  p       -   bytes to append
+ *  n       -   number of bytes
+ */
+void bufgather(struct outbuf *ob, const char *p, size_t n) {
+  struct iovec *last;
+
+  if (ob->len > ob->mark) {
+    ob->iov[ob->niov].iov_base = ob->data + ob->mark;
+    ob->iov[ob->niov++].iov_len = ob->len - ob->mark;
+    ob->mark = ob->len;
+  }
+  last = ob->niov > 0 ? &ob->iov[ob->niov - 1] : NULL;
+  if (last != NULL && (const char *)last->iov_base + last->iov_len == p) {
+    last->iov_len += n;
+  } else {
+    ob->iov[ob->niov].iov_base = (void *)p;
+    ob->iov[ob->niov++].iov_len = n;
+  }
+  if (ob->niov >= OUTIOVMAX - 1)                        /* Room is kept for the tail of `data`. */
+    flushgather(ob);
+}
+
+/**
+ * flushgather --
+ *      Write the pieces of the output buffer, and what follows them
+ *      in `data`, with writev(2).
+ *
+ * Returns:
+ *  0 on success, -1 if the descriptor could not be written.
+ */
+static int flushgather(struct outbuf *ob) {
+  struct iovec *iov = ob->iov;
+  int n = ob->niov;
+  ssize_t w;
+
+  if (ob->len > ob->mark) {
+    iov[n].iov_base = ob->data + ob->mark;
+    iov[n++].iov_len = ob->len - ob->mark;
+  }
+  while (n > 0 && !ob->error) {
+    if ((w = writev(ob->fd, iov, n)) == -1) {
+      if (errno != EINTR)
+        ob->error = 1;
+      continue;
+    }
+    ob->total += (unsigned long long)w;
+    while (n > 0 && (size_t)w >= iov->iov_len) {        /* Skip what was written, */
+      w -= (ssize_t)iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {                                        /*   part of a piece included. */
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= (size_t)w;
+    }
+  }
+  ob->niov = 0;
+  ob->len = 0;
+  ob->mark = 0;
+  return ob->error ? -1 : 0;
+}
+
+/**
+ * bufspill --
+ *      Append `n` bytes that do not fit in what is left of the output
+ *      buffer: flush it, then copy them in, or write them straight
+ *      through if they are larger than the whole buffer.
+ * Parameters:
+ *  ob      -   output buffer
+ *  p       -   bytes to append
+ *  n       -   number of bytes
+ */
+void bufspill(struct outbuf *ob, const char *p, size_t n) {
+  bufflush(ob);
+  if (n >= sizeof(ob->data)) {
+    if (ob->sink(ob->arg, p, n) == -1)
+      ob->error = 1;
+    ob->total += n;
+    return;
+  }
+  memcpy(ob->data, p, n);
+  ob->len = n;
+}
+
+/**
+ * okchar --
+ *      The characters `bufsanitized` lets through.
+ */
+static int okchar(int c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == ' ' || c == '\f' || c == '\t' || c == '_';
+}
+
+/**
+ * bufsanitized --
+ *      Write `n` bytes to the output buffer allowing only
+ *      "white-listed" chars; any other char is written as a space.
+ *      The (read-only) input is not touched.
+ */
+void bufsanitized(struct outbuf *ob, const char *p, size_t n) {
+  const char *end = p + n, *run;
+
+  while (p < end) {
+    for (run = p; p < end && okchar((unsigned char)*p); p++)
+      ;
+    bufwrite(ob, run, (size_t)(p - run));
+    if (p < end) {
+      bufputc(ob, ' ');
+      p++;
+    }
+  }
+} ///:~
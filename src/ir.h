@@ -0,0 +1,276 @@
+//===---------------------------------------------------*- C -*---===
+//: ir.h
+//
+// DESCRIPTION
+// Internal interface of libmd2mdoc between the markdown parser and
+// the emitters. The parser turns each line into tokens (sections,
+// lists, displays, inline markup and plain text) held in a per
+// document arena; an emitter walks the tokens and writes one output
+// format through an output buffer. Token text points into the input
+// (or at static strings), so building the IR copies no text, and one
+// parse can feed several emitters.
+//===-------------------------------------------------------------===
+#ifndef MD2MDOC_IR_H
+#define MD2MDOC_IR_H
+
+#include "md2mdoc.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <sys/uio.h>
+
+//-------------------------------------------------------------------
+// Constants Declarations
+//-------------------------------------------------------------------
+#define OUTBUFSIZE (64 * 1024)                          /* Bytes collected before a write. */
+#define IRBLOCKSIZE 4096                                /* Tokens per arena block. */
+#define OUTIOVMAX 1024                                  /* Pieces gathered for one writev(2). */
+#define GATHERMIN 256                                   /* Shorter runs of text are copied. */
+
+#define LIST_TAG  0                                     /* `flags` of TK_LISTBEGIN: option list, */
+#define LIST_ENUM 1                                     /*   numbered list */
+#define LIST_DASH 2                                     /*   or dash list. */
+#define ARG_SPACED 1                                    /* `flags` of TK_ARG inside `[...]`. */
+#define LIST_NONE 3                                     /* No list open (`emitter.list`). */
+#define TOK_NL 0x80                                     /* `flags`: a newline follows the token. */
+
+#define LINE_TEXT     0                                 /* `emitter.line`: what the rest of the */
+#define LINE_TAG      1                                 /*   output line is: text, a list tag, */
+#define LINE_SYNOPSIS 2                                 /*   a `[...]` synopsis line, */
+#define LINE_NAME     3                                 /*   the name on the NAME line, */
+#define LINE_DATE     4                                 /*   or a `date:`, `title:` or `author:` */
+#define LINE_TITLE    5                                 /*   line that is collected in `cap` */
+#define LINE_AUTHOR   6                                 /*   and written when it ends. */
+#define LINE_ROFF     7                                 /* html: the start of a `.\"` line, held */
+#define LINE_COMMENT  8                                 /*   in `cap`, and the rest of it. */
+
+#define FONT_R 0                                        /* `emitter.font`: roman, */
+#define FONT_B 1                                        /*   bold */
+#define FONT_I 2                                        /*   or italic. */
+
+#define BUFLIT(ob, lit) bufwrite((ob), (lit), sizeof(lit) - 1) /* Write a string literal/macro. */
+
+/*
+ * tokkind --
+ *      What a token stands for. Tokens marked (text) carry their
+ *      own text; the others are markers whose content, if any, is the
+ *      TK_TEXT tokens that follow them up to the end of the line.
+ */
+enum tokkind {
+  TK_TEXT,                                              /* Plain text, copied as it is (text). */
+  TK_SECTION,                                           /* `# heading` (text, to be sanitized). */
+  TK_SUBSECTION,                                        /* `## heading` (text, to be sanitized). */
+  TK_PARA,                                              /* Blank line. */
+  TK_LISTBEGIN,                                         /* Start of a list (flags: LIST_*). */
+  TK_ITEM,                                              /* List item. */
+  TK_LISTEND,                                           /* End of a list. */
+  TK_FLAG,                                              /* An option flag. */
+  TK_ARG,                                               /* An option argument (flags: ARG_SPACED). */
+  TK_OPTIONAL,                                          /* `[...]` synopsis line. */
+  TK_LITBEGIN,                                          /* Start of a literal display. */
+  TK_LITEND,                                            /* End of a literal display. */
+  TK_NAME,                                              /* The name on the line after `# NAME`. */
+  TK_DESC,                                              /* Its description, after `--`. */
+  TK_NAMEREF,                                           /* `$name`. */
+  TK_SECREF,                                            /* `$section` (text). */
+  TK_MODIFIER,                                          /* `@modifier` (text). */
+  TK_BOLD,                                              /* `*bold*` (text). */
+  TK_ITALIC,                                            /* `_italic_` (text). */
+  TK_LITERAL,                                           /* `` `literal` `` (text). */
+  TK_XREF,                                              /* `^page(n)^` (text, to be sanitized). */
+  TK_MACRO,                                             /* A marker from the markup table (text; */
+                                                        /*   flags: index into its `macro`). */
+  TK_AUTHOR,                                            /* `author:` line. */
+  TK_DATE,                                              /* `date:` line. */
+  TK_TITLE,                                             /* `title:` line. */
+  TK_TITLEEND                                           /* End of the `title:` line. */
+};
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+/*
+ * token --
+ *      One element of the IR.
+ */
+struct token {
+  const char *str;                                      /* Text, for the kinds that have any. */
+  size_t len;
+  unsigned char kind;                                   /* An `enum tokkind`. */
+  unsigned char flags;
+};
+
+/*
+ * irblock --
+ *      A block of the token arena.
+ */
+struct irblock {
+  struct irblock *next;
+  size_t n;                                             /* Tokens used in `tok`. */
+  struct token tok[IRBLOCKSIZE];
+};
+
+/*
+ * ir --
+ *      The tokens of (part of) a document. Blocks are kept when the
+ *      arena is reset, so a context that converts many documents
+ *      stops allocating once it has seen its largest one.
+ */
+struct ir {
+  struct irblock *first;
+  struct irblock *cur;                                  /* Block being filled. */
+  size_t ntok;                                          /* Tokens in the whole arena. */
+  int error;                                            /* Set if a block could not be allocated. */
+  struct token scratch;                                 /* Handed out once `error` is set. */
+};
+
+/*
+ * outbuf --
+ *      Output buffer; macros and runs of text are collected here and
+ *      handed to the sink in large blocks. When the sink is a file
+ *      descriptor (`md2mdoc_fd_sink`), long runs of input passed
+ *      through by `bufref` are not copied: `iov` lists them in order
+ *      with the pieces of `data` between them, and a flush writes the
+ *      lot with one writev(2). The input must then stay put until the
+ *      buffer is flushed.
+ */
+struct outbuf {
+  md2mdoc_sink sink;                                    /* Where full blocks are sent. */
+  void *arg;                                            /* Argument for `sink`. */
+  size_t len;                                           /* Bytes currently held in `data`. */
+  unsigned long long total;                             /* Bytes handed to `sink` so far. */
+  int error;                                            /* Set if a flush failed. */
+  int fd;                                               /* Descriptor to gather for, or -1. */
+  int niov;                                             /* Pieces in `iov`. */
+  size_t mark;                                          /* Start of `data` not yet in `iov`. */
+  struct iovec iov[OUTIOVMAX];
+  char data[OUTBUFSIZE];
+};
+
+struct emitter;
+
+/*
+ * format --
+ *      An output format. `emit` is handed the tokens of a document in
+ *      order, in one or more calls; `begin` and `end` (either may be
+ *      NULL) are called before the first and after the last.
+ */
+struct format {
+  const char *name;
+  void (*begin)(struct emitter *em);
+  void (*emit)(struct emitter *em, const struct token *tok, size_t n);
+  void (*end)(struct emitter *em);
+};
+
+/*
+ * emitter --
+ *      One output of a conversion: its format, the state the format
+ *      carries from token to token, and its own output buffer. mdoc
+ *      maps every token straight onto a macro and needs no state; man
+ *      and html use the fields below.
+ */
+struct emitter {
+  const struct format *fmt;
+  unsigned char line;                                   /* LINE_* of the current output line. */
+  unsigned char list;                                   /* LIST_* of the open list. */
+  unsigned char font;                                   /* FONT_* left open on the line. */
+  unsigned char bol;                                    /* At the start of an output line. */
+  unsigned char lit;                                    /* In a literal display. */
+  unsigned char para;                                   /* man: a break is pending (1) or not wanted (2); */
+                                                        /*   html: the list was closed by a heading. */
+  unsigned char head;                                   /* html: the <head> is still open. */
+  char last;                                            /* Last character written. */
+  unsigned int itemno;                                  /* Items so far in an enumerated list. */
+  size_t caplen, namelen, datelen;
+  char cap[128];                                        /* The line collected for LINE_DATE..AUTHOR. */
+  char name[64];                                        /* The name from the NAME line (for `$name`). */
+  char date[64];                                        /* The `date:` line. */
+  const struct md2mdoc_markup *markup;                  /* Says what the TK_MACRO tokens stand for. */
+  struct outbuf out;
+};
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+struct token *ir_grow(struct ir *ir);                   /* Slow path of `ir_add`. */
+void ir_reset(struct ir *ir);                           /* Forget every token; keep the blocks. */
+void ir_free(struct ir *ir);                            /* Release the whole arena. */
+void ir_emit(const struct ir *ir, struct emitter *em);  /* Walk the tokens in order. */
+
+void emitter_init(struct emitter *em, const struct format *fmt, md2mdoc_sink sink, void *arg);
+size_t capture(char *dst, size_t len, size_t cap, const char *p, size_t n); /* Collect text, truncating. */
+size_t trimlen(const char *p, size_t n);                /* Length without trailing white space. */
+
+int bufflush(struct outbuf *ob);                        /* Write out the buffered bytes. */
+void bufspill(struct outbuf *ob, const char *p, size_t n); /* Slow path of `bufwrite`. */
+void bufgather(struct outbuf *ob, const char *p, size_t n); /* Slow path of `bufref`. */
+void bufsanitized(struct outbuf *ob, const char *p, size_t n); /* Append, blanking unsafe bytes. */
+
+extern const struct format fmt_mdoc;                    /* mdoc.c */
+extern const struct format fmt_man;                     /* man.c */
+extern const struct format fmt_html;                    /* html.c */
+
+/**
+ * ir_add --
+ *      Append a token to the arena.
+ *
+ * Returns:
+ *  The new token, or a scratch token if memory ran out (the error is
+ *  remembered in `ir->error`).
+ */
+static inline struct token *ir_add(struct ir *ir, int kind, const char *str, size_t len) {
+  struct token *t;
+
+  if (ir->cur != NULL && ir->cur->n < IRBLOCKSIZE)
+    t = &ir->cur->tok[ir->cur->n++];
+  else
+    t = ir_grow(ir);
+  ir->ntok++;
+  t->kind = (unsigned char)kind;
+  t->flags = 0;
+  t->str = str;
+  t->len = len;
+  return t;
+}
+
+/**
+ * bufwrite --
+ *      Append `n` bytes to the output buffer. Kept inline since the
+ *      emitters call it for every macro and run of text; flushing is
+ *      left to `bufspill`.
+ */
+static inline void bufwrite(struct outbuf *ob, const char *p, size_t n) {
+  if (n > sizeof(ob->data) - ob->len) {
+    bufspill(ob, p, n);
+    return;
+  }
+  memcpy(ob->data + ob->len, p, n);
+  ob->len += n;
+}
+
+/**
+ * bufref --
+ *      Append `n` bytes of input that the output carries unchanged.
+ *      Long runs are gathered rather than copied when the buffer can
+ *      (see `struct outbuf`).
+ */
+static inline void bufref(struct outbuf *ob, const char *p, size_t n) {
+  if (ob->fd == -1 || n < GATHERMIN) {
+    bufwrite(ob, p, n);
+    return;
+  }
+  bufgather(ob, p, n);
+}
+
+/**
+ * bufputc --
+ *      Append a single character to the output buffer.
+ */
+static inline void bufputc(struct outbuf *ob, char c) {
+  if (ob->len == sizeof(ob->data))
+    bufflush(ob);
+  ob->data[ob->len++] = c;
+}
+
+#endif /* MD2MDOC_IR_H */
@@ -0,0 +1,269 @@
+//===---------------------------------------------------*- C -*---===
+//: jobserver.c
+//
+// DESCRIPTION
+// GNU make jobserver client (see jobserver.h). The token the process
+// was started with is shared by its threads through a flag; every
+// other token is a byte read from make's pipe. A thread waiting for
+// one polls the pipe a little at a time and looks at the flag in
+// between, so it is never left waiting on the pipe after another
+// thread of this process has given the implicit token back. The pipe
+// is read without blocking, so a byte make or another job takes
+// between the poll and the read leaves the read empty instead of
+// stuck. GNU make 4.0 and later make the inherited pipe non-blocking
+// itself, and it is then read as it is; otherwise, where /proc gives
+// a way to, it is opened again as a description of our own, since
+// O_NONBLOCK set on make's would break the reads of an older make.
+//===-------------------------------------------------------------===
+
+#include "jobserver.h"
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+//-------------------------------------------------------------------
+// Constants Declarations
+//-------------------------------------------------------------------
+#define AUTH "--jobserver-auth="                        /* make 4.2 and later. */
+#define FDS "--jobserver-fds="                          /* Before 4.2. */
+#define FIFO "fifo:"                                    /* make 4.4's named pipe. */
+#define POLLMS 100                                      /* Between looks at the implicit token. */
+#define FDPATH "/proc/self/fd/%d"                       /* Reopens an inherited pipe (Linux). */
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+/*
+ * jobserver --
+ *      make's pipe and the implicit token.
+ */
+struct jobserver {
+  int rfd;                                              /* Non-blocking. */
+  int wfd;                                              /* `rfd` for a fifo, else make's descriptor. */
+  int own;                                              /* Set if `rfd` was opened here. */
+  int implicit;                                         /* Set while a thread runs on the implicit token. */
+  int broken;                                           /* Set once the pipe fails: only the implicit is left. */
+  pthread_mutex_t lock;
+  pthread_cond_t freed;                                 /* `implicit` was cleared. */
+};
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static int take(struct jobserver *js, int timeout);     /* A byte from the pipe. */
+
+/**
+ * js_open --
+ *      Find the jobserver of the make running this process.
+ *
+ * Returns:
+ *  The jobserver, or NULL if there is none or it cannot be used (the
+ *  latter is reported; the caller then runs on its own -j).
+ */
+struct jobserver *js_open(void) {
+  struct jobserver *js;
+  struct stat rst, wst;
+  const char *flags, *p, *auth = NULL;
+  char path[PATH_MAX];
+  size_t len;
+  int rfd, wfd, fd, fl, own = 1;
+
+  if ((flags = getenv("MAKEFLAGS")) == NULL)
+    return NULL;
+  for (p = flags; (p = strstr(p, "--jobserver-")) != NULL; p++) { /* The last one counts. */
+    if (strncmp(p, AUTH, sizeof(AUTH) - 1) == 0)
+      auth = p + sizeof(AUTH) - 1;
+    else if (strncmp(p, FDS, sizeof(FDS) - 1) == 0)
+      auth = p + sizeof(FDS) - 1;
+  }
+  if (auth == NULL)
+    return NULL;
+
+  if (strncmp(auth, FIFO, sizeof(FIFO) - 1) == 0) {
+    auth += sizeof(FIFO) - 1;
+    if ((len = strcspn(auth, " ")) >= sizeof(path)) {
+      warnx("jobserver: fifo name too long");
+      return NULL;
+    }
+    memcpy(path, auth, len);
+    path[len] = '\0';
+    if ((rfd = open(path, O_RDWR | O_NONBLOCK)) == -1) { /* Our own description: no other reader blocks. */
+      warn("jobserver: %s", path);
+      return NULL;
+    }
+    wfd = rfd;
+  } else {
+    if (sscanf(auth, "%d,%d", &rfd, &wfd) != 2 || rfd < 0 || wfd < 0)
+      return NULL;                                      /* make's "-1,-1": no jobserver. */
+    if (fstat(rfd, &rst) == -1 || fstat(wfd, &wst) == -1 || !S_ISFIFO(rst.st_mode) ||
+        !S_ISFIFO(wst.st_mode)) {
+      warnx("jobserver: descriptors %d,%d are not open (recipe not marked with `+'?)", rfd, wfd);
+      return NULL;
+    }
+    own = 0;
+    if ((fl = fcntl(rfd, F_GETFL)) == -1 || (fl & O_NONBLOCK) == 0) { /* Older than make 4.0. */
+      snprintf(path, sizeof(path), FDPATH, rfd);
+      if ((fd = open(path, O_RDONLY | O_NONBLOCK)) == -1 || fstat(fd, &wst) == -1 ||
+          wst.st_dev != rst.st_dev || wst.st_ino != rst.st_ino) {
+        warnx("jobserver: descriptor %d blocks and cannot be opened again", rfd);
+        if (fd != -1)
+          close(fd);
+        return NULL;
+      }
+      rfd = fd;
+      own = 1;
+    }
+  }
+
+  if ((js = calloc(1, sizeof(*js))) == NULL) {
+    if (own)
+      close(rfd);
+    return NULL;
+  }
+  js->rfd = rfd;
+  js->wfd = wfd;
+  js->own = own;
+  pthread_mutex_init(&js->lock, NULL);
+  pthread_cond_init(&js->freed, NULL);
+  return js;
+}
+
+/**
+ * js_get --
+ *      Wait for a token to run one more thing on.
+ * Parameters:
+ *  js      -   the jobserver, or NULL to run without one
+ *
+ * Returns:
+ *  The token (JS_IMPLICIT for the process's own), for `js_put`.
+ */
+int js_get(struct jobserver *js) {
+  int token;
+
+  if (js == NULL)
+    return JS_IMPLICIT;
+  for (;;) {
+    pthread_mutex_lock(&js->lock);
+    while (js->implicit && js->broken)
+      pthread_cond_wait(&js->freed, &js->lock);
+    if (!js->implicit) {
+      js->implicit = 1;
+      pthread_mutex_unlock(&js->lock);
+      return JS_IMPLICIT;
+    }
+    pthread_mutex_unlock(&js->lock);
+    if ((token = take(js, POLLMS)) != -1)
+      return token;
+  }
+}
+
+/**
+ * js_tryget --
+ *      `js_get` without waiting.
+ *
+ * Returns:
+ *  The token, or -1 if none is free now (or `js` is NULL).
+ */
+int js_tryget(struct jobserver *js) {
+  if (js == NULL)
+    return -1;
+  pthread_mutex_lock(&js->lock);
+  if (!js->implicit) {
+    js->implicit = 1;
+    pthread_mutex_unlock(&js->lock);
+    return JS_IMPLICIT;
+  }
+  pthread_mutex_unlock(&js->lock);
+  return take(js, 0);
+}
+
+/**
+ * take --
+ *      Read a token from make's pipe.
+ * Parameters:
+ *  js      -   the jobserver
+ *  timeout -   how long to wait, in milliseconds
+ *
+ * Returns:
+ *  The token, or -1 if none came.
+ */
+static int take(struct jobserver *js, int timeout) {
+  struct pollfd pfd;
+  unsigned char c;
+  ssize_t n;
+  int broken;
+
+  pthread_mutex_lock(&js->lock);
+  broken = js->broken;
+  pthread_mutex_unlock(&js->lock);
+  if (broken)
+    return -1;
+  pfd.fd = js->rfd;
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, timeout) < 1)
+    return -1;
+  if ((n = read(js->rfd, &c, 1)) == 1)
+    return c;
+  if (n == 0 || (errno != EAGAIN && errno != EINTR)) {  /* EAGAIN: another job took it first. */
+    if (n == 0)
+      warnx("jobserver: pipe closed; going on with one job");
+    else
+      warn("jobserver: going on with one job");
+    pthread_mutex_lock(&js->lock);
+    js->broken = 1;
+    pthread_mutex_unlock(&js->lock);
+  }
+  return -1;
+}
+
+/**
+ * js_put --
+ *      Give back a token of `js_get` or `js_tryget`.
+ * Parameters:
+ *  js      -   the jobserver, or NULL
+ *  token   -   the token
+ */
+void js_put(struct jobserver *js, int token) {
+  unsigned char c = (unsigned char)token;
+
+  if (js == NULL)
+    return;
+  if (token == JS_IMPLICIT) {
+    pthread_mutex_lock(&js->lock);
+    js->implicit = 0;
+    pthread_cond_signal(&js->freed);
+    pthread_mutex_unlock(&js->lock);
+    return;
+  }
+  while (write(js->wfd, &c, 1) == -1) {
+    if (errno != EINTR) {
+      warn("jobserver: token lost");                    /* make runs one job less. */
+      return;
+    }
+  }
+}
+
+/**
+ * js_close --
+ *      Forget the jobserver. Every token must have been given back.
+ */
+void js_close(struct jobserver *js) {
+  if (js == NULL)
+    return;
+  if (js->own)
+    close(js->rfd);
+  pthread_mutex_destroy(&js->lock);
+  pthread_cond_destroy(&js->freed);
+  free(js);
+} ///:~
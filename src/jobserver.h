@@ -0,0 +1,27 @@
+//===---------------------------------------------------*- C -*---===
+//: jobserver.h
+//
+// DESCRIPTION
+// Client side of the GNU make jobserver, so md2mdoc run from a
+// `make -jN` recipe (marked with `+`) converts no more pages at once
+// than the build has tokens for. make hands its jobs a pipe holding
+// one byte per free job slot; a job may run one thing on the token it
+// was started with, and must read a byte before each further thing
+// it runs at once and write it back when done. MAKEFLAGS names the
+// pipe as --jobserver-auth=R,W (inherited descriptors) or, from make
+// 4.4, --jobserver-auth=fifo:PATH.
+//===-------------------------------------------------------------===
+#ifndef MD2MDOC_JOBSERVER_H
+#define MD2MDOC_JOBSERVER_H
+
+#define JS_IMPLICIT 256                                 /* The token the process was started with. */
+
+struct jobserver;
+
+struct jobserver *js_open(void);                        /* From MAKEFLAGS, or NULL. */
+int js_get(struct jobserver *js);                       /* Wait for a token. */
+int js_tryget(struct jobserver *js);                    /* A token, or -1 if none is free now. */
+void js_put(struct jobserver *js, int token);           /* Give a token back. */
+void js_close(struct jobserver *js);
+
+#endif /* MD2MDOC_JOBSERVER_H */
@@ -13,124 +13,265 @@
 // OPTIONS
 //  -o outfile
 //      A file to write.
+//  -d outdir
+//      Convert every input (directories are searched recursively
+//      for `*.md` files) into `outdir`.
+//  -j jobs
+//      Number of documents to convert at the same time when -d is
+//      used (defaults to the number of online processors). With a
+//      single input, a large file is split at its `# ` headings and
+//      parsed on up to `jobs` threads; the output does not change.
+//      Run from a `make -jN` recipe marked with `+`, md2mdoc takes a
+//      token from make's jobserver for each page it converts beyond
+//      the first (and for each extra thread of a split parse), so the
+//      build as a whole runs no more than N jobs; -j, or the number of
+//      online processors, is then only an upper bound.
+//  --cache-dir dir
+//      Keep converted pages in `dir`, keyed on a hash of the input and
+//      the md2mdoc version; an input seen before is copied from there
+//      instead of being converted again.
+//  --watch
+//      After converting, keep running and convert each input again
+//      whenever it, or a file it includes, is written. Needs -o or
+//      -d; pages are replaced atomically (temporary file plus rename).
+//      Only the sections of a page that changed since its last
+//      conversion are parsed again.
+//  -T format[,format...]
+//      Output formats: mdoc (the default), man and html. Every format
+//      asked for is written from a single parse of the input; with
+//      more than one, -o outfile writes outfile.<format> and -d outdir
+//      writes outdir/<format>/... for each.
+//  --stats, --stats=json
+//      When done, report to stderr what the conversions did: bytes,
+//      lines, time spent reading, parsing and writing, and the number
+//      of each markdown construct. Nothing is counted without it.
+//  --markup file
+//      More inline markers (see markup.c for the file); the file is
+//      part of every --cache-dir key.
+//  -z, --gzip-level level
+//      Write every page gzip compressed (at `level`, 1 to 9; -z alone
+//      is 6), adding `.gz` to the names batch mode makes. A page is
+//      compressed on a thread of its own while it is being converted.
+//  --whatis file, --whatis-db file
+//      With -d, also write a whatis index of the pages converted: a
+//      sorted text file and/or the binary index of whatis.h, from the
+//      NAME and `title:` lines seen while converting.
+//  --lookup name
+//      Print the lines of `name` in the --whatis-db index and exit.
+//  --lint, --lint=close
+//      Report to stderr, as `input:line: problem`, what is wrong with
+//      the structure of each page while converting it: lists and
+//      literal blocks never closed (or closed twice), comments never
+//      closed and empty names. The exit status is then 1; pages are
+//      still written, and with --lint=close the lists and literal
+//      block left open are ended. Nothing is taken from --cache-dir.
+//  --include
+//      Replace each `include: file` line with the lines of `file`.
+//      Pages that include files are never taken from --cache-dir.
+//  --serve socket
+//      Run as a conversion server on the Unix domain socket `socket`
+//      instead of converting files (see serve.h for the protocol).
+//      Pages are written in the (single) -T format.
+//  --stream-docs
+//      The same requests and replies as --serve, over standard input
+//      and output, until standard input ends: md2mdoc as a coprocess
+//      converting any number of documents, each from a fresh state.
 //
-// KEY:
-// ------------------------------------------------------------------
-// #           ->  .Sh     : section headers
-// ##          ->  .Ss     : sub section
-// blank line  ->  .Pp     : Blank Line
-// $name       ->  .Nm     : Project Name
-// @string     ->  .Cm     : Command Modifier
-// -<char>     ->  .It Fl  : List element
-// -\n         ->  .El     : A single dash is assumed to be a `list end`.
-// ~ <char>    ->  .It\n   : List element
-// ~\n         ->  .El     : An alternate `list end` character.
-// 1. ... 10.  ->  .It     : An enumerated list element.
-// <           ->  .nf     : Start of a `no format` block.
-// >           ->  .fi     : End of a `no format` block.
-// ```         ->  .nf     : Start/End of a `no format` block.
-// *           ->  .Bf     : Bold
-// _           ->  .Em     : Italic
-// ^           ->  .Sx     : Reference
-// author:     ->  .Au     : Author
-// date:       ->  .Dd     : Date
-// title:      ->  .Dt .Os : Document title.
-// # NAME      ->          : md2mdoc will assume the next line will
-//                           be a name and a description. This should
-//                           be formatted as the example below.
-//  <!---
-//  your comment goes here
-//  and here
-//  -->
-//
-// Example:
-//      # NAME
-//      projectname -- This is a test
-//
-//      # SYNOPSYS
-//      projectname
-//      [-abc argument]
-//      variable
-//
-//      # OPTIONS
-//      -a
-//          a line for the `a` flag.
-//      -b
-//          a line for the `b` flag.
-//      ...
+// The markup understood is described in md2mdoc.c. With --include,
+// files named by `include:` lines are read relative to the including
+// input (or the current directory for stdin and --serve), and parsed
+// once per run however many pages include them; without it the lines
+// are plain text.
 //===-------------------------------------------------------------===
 
-#include "version.h"
+#include "md2mdoc.h"
+#include "cache.h"
+#include "watch.h"
+#include "serve.h"
+#include "batchio.h"
+#include "whatis.h"
+#include "gzout.h"
+#include "jobserver.h"
 
-#include <ctype.h>
+#include <dirent.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
-#include <stdarg.h>
 
-#if __FreeBSD__                                         /* FreeBSD needs the following includes for
+#include <sys/types.h>                                  /* FreeBSD needs the following includes for
                                                            the S_IRUSR / S_IWUSR macros to work */
-#include <sys/types.h>
 #include <sys/stat.h>
-#include <unistd.h>
-
-#endif
+#include <sys/mman.h>
 
 //-------------------------------------------------------------------
 // Constants Declarations
 //-------------------------------------------------------------------
-#define TRUE 1
-#define FALSE 0
-#define stripspaces()  while (isspace(*str) > 0 && *str != '\0') str++;
-#define stripnewline()  while (*str == '\n' || *str != '\0') str++;
-
-#define SECTION ".Sh"
-#define SUBSECTION ".Ss"
-#define BOLD ".Sy"
-#define ITALIC ".Em"
-#define INLINE ".Li"
-#define REFERENCE ".Xr"
-#define OPTIONAL ".Op"
-#define FLAG " Fl "
-#define ARGUMENT " Ar "
-#define ITEM ".It"
-#define AUTHOR ".Au"
-#define DATE ".Dd"
-#define TITLE ".Dt"
-#define NAME ".Nm"
-#define SECTIONREFERENCE ".Sx"
-#define COMMANDMODIFIER ".Cm"
+#define STATS_OFF 0                                     /* `statsmode`: no --stats, */
+#define STATS_TEXT 1                                    /*   --stats */
+#define STATS_JSON 2                                    /*   or --stats=json. */
+#define LINT_OFF 0                                      /* `lintmode`: no --lint, */
+#define LINT_REPORT 1                                   /*   --lint */
+#define LINT_CLOSE 2                                    /*   or --lint=close. */
+#define MAXTOKENS 64                                    /* Most threads a single input is parsed on with make. */
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+/*
+ * job --
+ *      One input file of a batch conversion.
+ */
+struct job {
+  char *input;                                          /* Path of the markdown file. */
+  char *relpath;                                        /* Path relative to the tree it was found in. */
+};
+
+/*
+ * input --
+ *      The whole of one input, for hashing and converting from memory.
+ */
+struct input {
+  char *data;
+  size_t len;
+  int mapped;                                           /* Set if `data` came from mmap(2). */
+};
+
+/*
+ * batch --
+ *      The work queue shared by the worker threads.
+ */
+struct batch {
+  struct job *jobs;
+  size_t njobs;
+  size_t capjobs;
+  size_t next;                                          /* Index of the next job to hand out. */
+  const char *outdir;                                   /* Directory to write converted pages to. */
+  const char *cachedir;                                 /* --cache-dir, or NULL. */
+  const char *whatis;                                   /* --whatis, or NULL. */
+  const char *whatisdb;                                 /* --whatis-db, or NULL. */
+  struct whatis_page *pages;                            /* For either: each job's page, once converted. */
+  int failed;                                           /* Set if any job could not be converted. */
+  struct batchio *bio;                                  /* I/O engine, or NULL for plain POSIX I/O. */
+  struct jobserver *js;                                 /* make's jobserver, or NULL. */
+  struct md2mdoc_stats stats;                           /* Totals of the workers, for --stats. */
+  pthread_mutex_t lock;
+};
+
+/*
+ * page --
+ *      One output file while it is being written: it goes to a
+ *      temporary next to its final name and is renamed into place
+ *      once complete, so a reader never sees a half written page.
+ */
+struct page {
+  int format;                                           /* MD2MDOC_* format of the page. */
+  FILE *out;
+  struct gzout *gz;                                     /* With -z, what compresses into `out`. */
+  char base[PATH_MAX];                                  /* Name without the suffix (batch) or the name. */
+  char tmp[PATH_MAX];
+  char final[PATH_MAX];
+};
+
+/*
+ * rebuild --
+ *      What --watch converts when an input changes: a job of the batch
+ *      or, without -d, the single input into `outpath`.
+ */
+struct rebuild {
+  struct batch *b;                                      /* The batch, or NULL. */
+  md2mdoc_ctx *ctx;
+  const char *input;
+  const char *outpath;
+  const char *cachedir;
+  size_t ninputs;                                       /* Files watched past these are included. */
+};
+
+/*
+ * watchlist --
+ *      The files --watch starts with: the inputs, then the files they
+ *      include.
+ */
+struct watchlist {
+  const char **paths;
+  size_t n;
+  size_t cap;
+};
 
 //-------------------------------------------------------------------
 // Function Prototypes
 //-------------------------------------------------------------------
-static void *processfd(void *arg);                      /* Open the FD and send to processline(); */
-static void processline(FILE *out, char *str);          /* Process one line of text at a time
-                                                           from the  input file. */
-static void processnested(FILE *out, const char *str);
-static int readline(FILE *fd, char *buf, int nbytes);   /* Read a line of text from file. */
-static int cimemcmp(const void *s1, const void *s2, size_t n); /* case independent memory regon compare */
-//:~  static int read_until(const char **src, char delim, char *dst, size_t dstcap);
-static int read_upto(const char **src, const char *delims, char *dst, size_t dstcap, int eatfinalchar);
-static void skip_one_space_or_newline(const char **src);
+static void addinput(struct batch *b, const char *path, const char *relpath);
+static void *batchworker(void *arg);                    /* Convert jobs from the batch queue. */
+static int runbatch(struct batch *b, unsigned int njobs);
+static void freebatch(struct batch *b);
+static int convertfile(md2mdoc_ctx *ctx, const char *input, const char *outpath, const char *cachedir);
+static int jobpages(const struct batch *b, const struct job *job, struct page *pg);
+static int convertloaded(const struct batch *b, md2mdoc_ctx *ctx, const struct bio_in *in);
+static void rebuildpage(void *arg, size_t index);       /* --watch callback. */
+static void listpath(void *arg, const char *path);
+static void watchpath(void *arg, const char *path);
+static int loadinput(int fd, struct input *in);         /* Map or read a whole input. */
+static void freeinput(struct input *in);
+static int writeall(int fd, const char *data, size_t len);
+static int cachedjob(const struct batch *b, md2mdoc_ctx *ctx, const struct job *job, struct page *pg);
+static int convertcached(md2mdoc_ctx *ctx, int fd, FILE **out, const char *cachedir);
+static void setformats(const char *list);               /* Parse the -T argument. */
+static void formatkey(const char *key, int format, char *fkey, size_t cap);
+static int maketemp(struct page *pg);
+static int openpages(struct page *pg, struct md2mdoc_output *outs);
+static void discardpages(struct page *pg, size_t n);
+static int commitpages(struct page *pg, const char *section);
+static void loadmarkup(const char *path);               /* Read the --markup file. */
+static const char *inputdir(const char *input, char *dir, size_t cap);
+static void convfailed(const md2mdoc_ctx *ctx, const char *input);
+static void addstats(struct md2mdoc_stats *dst, const struct md2mdoc_stats *src);
+static void printstats(const struct md2mdoc_stats *st);
+static void ctxmeta(const md2mdoc_ctx *ctx, struct cache_meta *meta);
+static void keeppage(const struct batch *b, const struct job *job, const struct cache_meta *meta);
+static void setlint(md2mdoc_ctx *ctx, const char *input);
+static void lintreport(void *arg, const char *file, unsigned long line, const char *msg);
+static int splitinput(const char *input, long njobs);
+static unsigned int taketokens(struct jobserver *js, long njobs, int *tokens);
+static void givetokens(struct jobserver *js, const int *tokens, unsigned int n);
+static int writeindex(const struct batch *b);           /* --whatis and --whatis-db. */
 
 //-------------------------------------------------------------------
 // Global Variables
-// TODO:
-//  1. Move vars to struct.
 //-------------------------------------------------------------------
-FILE *filedescriptors[2];                               /* An array to hold open file descriptors. */
-unsigned int stripwhitespace = 1;                       /* Used to pause/stop stripping whitespace */
-unsigned int codeblock       = 0;                       /* Used for codeblocks. */
-unsigned int optionslist     = 0;                       /* Used for option list blocks. */
-unsigned int dashorenumlist  = 0;                       /* Used for enumeration or dash lists. */
-unsigned int nameflag        = 0;                       /* Set when this program find the string: "# NAME". */
-unsigned int commentflag     = 0;                       /* Used for comment blocks (HTML style <!-- comment --> */
+static int formats[MD2MDOC_NFORMATS] = { MD2MDOC_MDOC }; /* -T, in the order given. */
+static size_t nformats = 1;
+static int statsmode = STATS_OFF;                       /* --stats. */
+static md2mdoc_frags *frags;                            /* --include: files read by `include:` lines. */
+static md2mdoc_markup *markup;                          /* --markup, or NULL for the built-in markers. */
+static char cachesalt[CACHE_KEYMAX];                    /* Goes into every --cache-dir key. */
+static int gzlevel;                                     /* -z: gzip level of every page, or 0. */
+static int lintmode = LINT_OFF;                         /* --lint. */
+static unsigned long nlint;                             /* Problems it reported. */
+static pthread_mutex_t lintlock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct {                                   /* Fields of struct md2mdoc_stats, in order. */
+  const char *name;
+  size_t off;
+} statfields[] = {
+#define STATFIELD(f) { #f, offsetof(struct md2mdoc_stats, f) }
+  STATFIELD(bytes_in), STATFIELD(bytes_out), STATFIELD(lines),
+  STATFIELD(read_ns), STATFIELD(parse_ns), STATFIELD(nested_ns), STATFIELD(emit_ns),
+  STATFIELD(sections), STATFIELD(subsections), STATFIELD(paragraphs),
+  STATFIELD(lists_opened), STATFIELD(lists_closed), STATFIELD(items), STATFIELD(codeblocks),
+  STATFIELD(flags), STATFIELD(optional), STATFIELD(bold), STATFIELD(italic),
+  STATFIELD(literal), STATFIELD(xref), STATFIELD(modifier), STATFIELD(secref),
+  STATFIELD(nameref), STATFIELD(macros), STATFIELD(long_tokens),
+#undef STATFIELD
+};
 
 /**
  * printussage --
@@ -138,562 +279,1278 @@ unsigned int commentflag     = 0;                       /* Used for comment bloc
  *      arguments.
  */
 static void printusage(char *str) {
-  fprintf(stderr, "%s version: %s\n", str, program_version);
+  fprintf(stderr, "%s version: %s\n", str, md2mdoc_version());
   fprintf(stderr, "Usage: %s <markdownfile>\n", str);
-  fprintf(stderr, "Usage: %s <markdownfile> -o <outfile>\n", str);
+  fprintf(stderr, "Usage: %s [-j jobs] <markdownfile> -o <outfile>\n", str);
+  fprintf(stderr, "Usage: %s [-j jobs] -d <outdir> <markdownfile|dir> ...\n", str);
+  fprintf(stderr, "       --cache-dir <dir> and --watch may be given with -o or -d\n");
+  fprintf(stderr, "       -T mdoc,man,html selects the output formats\n");
+  fprintf(stderr, "       --stats or --stats=json reports counters to stderr\n");
+  fprintf(stderr, "       --markup <file> adds inline markers (see md2mdoc(7))\n");
+  fprintf(stderr, "       -z or --gzip-level <1-9> writes gzip compressed pages\n");
+  fprintf(stderr, "       --whatis <file> and --whatis-db <file> index the pages of -d\n");
+  fprintf(stderr, "       --lint or --lint=close reports (and closes) unbalanced blocks\n");
+  fprintf(stderr, "       --include reads the files named on `include:` lines\n");
+  fprintf(stderr, "Usage: %s --whatis-db <file> --lookup <name>\n", str);
+  fprintf(stderr, "Usage: %s [-T format] --serve <socket>\n", str);
+  fprintf(stderr, "Usage: %s [-T format] --stream-docs < frames\n", str);
+}
+
+/**
+ * setformats --
+ *      Set the output formats from a comma separated list of names.
+ *      A format named twice is written once.
+ */
+static void setformats(const char *list) {
+  char name[16];
+  const char *p, *comma;
+  size_t len, i;
+  int format;
+
+  nformats = 0;
+  for (p = list; ; p = comma + 1) {
+    comma = strchr(p, ',');
+    len = comma ? (size_t)(comma - p) : strlen(p);
+    if (len >= sizeof(name))
+      len = sizeof(name) - 1;                           /* Too long to be a format anyway. */
+    memcpy(name, p, len);
+    name[len] = '\0';
+    if ((format = md2mdoc_format(name)) == -1)
+      errx(1, "-T: unknown format: %s", name);
+    for (i = 0; i < nformats && formats[i] != format; i++)
+      ;
+    if (i == nformats)
+      formats[nformats++] = format;
+    if (comma == NULL)
+      break;
+  }
+}
+
+/**
+ * loadmarkup --
+ *      Read and compile the --markup file, exiting if it cannot be.
+ *      The file also goes into the --cache-dir keys, since the same
+ *      markdown makes a different page with other markers.
+ */
+static void loadmarkup(const char *path) {
+  struct input src;
+  unsigned int line;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1 || loadinput(fd, &src) == -1)
+    err(1, "%s", path);
+  close(fd);
+  if ((markup = md2mdoc_markup_new(src.data, src.len, &line)) == NULL) {
+    if (line == 0)
+      err(1, "%s", path);
+    errx(1, "%s:%u: %s", path, line, errno == E2BIG ? "too many markers" : "not a marker mapping");
+  }
+  cache_key(src.data, src.len, md2mdoc_version(), cachesalt, sizeof(cachesalt));
+  freeinput(&src);
 }
 
 /**
- * processfd --
- *      Read lines from a given filedescritor and pass them to the
- *      `processline` function.
+ * inputdir --
+ *      The directory `include:` lines of an input are read relative to.
  * Parameters:
- *  arg     -   a file stream (FILE *)
+ *  input   -   path of the markdown file
+ *  dir     -   buffer for the directory
+ *  cap     -   its size
  *
  * Returns:
- * NULL
+ *  `dir`, or NULL for the current directory.
  */
-static void *processfd(void *arg) {
-  char buff[LINE_MAX];
-  ssize_t nbytes;
+static const char *inputdir(const char *input, char *dir, size_t cap) {
+  const char *slash = strrchr(input, '/');
+
+  if (slash == NULL || (size_t)(slash - input) >= cap)
+    return NULL;
+  if (slash == input)
+    slash++;                                            /* A file in `/`. */
+  memcpy(dir, input, (size_t)(slash - input));
+  dir[slash - input] = '\0';
+  return dir;
+}
 
-  for (;;) {
-    if ((nbytes = readline(arg, buff, LINE_MAX)) < 0)
-      break;
-    processline(filedescriptors[1], buff);
-  }
-  return NULL;
+/**
+ * convfailed --
+ *      Report a conversion that failed, naming the included file that
+ *      was to blame if there was one.
+ */
+static void convfailed(const md2mdoc_ctx *ctx, const char *input) {
+  const char *inc;
+
+  if ((inc = md2mdoc_include_failed(ctx)) != NULL)
+    warn("%s: include: %s", input, inc);
+  else
+    warn("%s", input);
+}
+
+/**
+ * setlint --
+ *      Check the next conversion of `ctx` if --lint was given.
+ * Parameters:
+ *  ctx     -   conversion context
+ *  input   -   name of the input, for the messages (kept until the
+ *              conversion is done)
+ */
+static void setlint(md2mdoc_ctx *ctx, const char *input) {
+  if (lintmode != LINT_OFF)
+    md2mdoc_ctx_lint(ctx, lintreport, (void *)(uintptr_t)input,
+                     lintmode == LINT_CLOSE ? MD2MDOC_LINT_CLOSE : 0);
+}
+
+/**
+ * lintreport --
+ *      md2mdoc_lint function of --lint: print the problem and count it.
+ * Parameters:
+ *  arg     -   name of the input (const char *)
+ *  file    -   included file the problem is in, or NULL for the input
+ *  line    -   line of that file
+ *  msg     -   the problem
+ */
+static void lintreport(void *arg, const char *file, unsigned long line, const char *msg) {
+  pthread_mutex_lock(&lintlock);                        /* Batch workers report at once. */
+  warnx("%s:%lu: %s", file != NULL ? file : (const char *)arg, line, msg);
+  nlint++;
+  pthread_mutex_unlock(&lintlock);
 }
 
 /**
- * cimemcmp --
- *      Preform a case independent memory region compare.
+ * splitinput --
+ *      Whether a single input will be parsed on several threads: a
+ *      regular file large enough to split, with -j other than 1 and
+ *      no --lint. Only then are jobserver tokens worth taking for it.
+ */
+static int splitinput(const char *input, long njobs) {
+  struct stat st;
+
+  return njobs != 1 && lintmode == LINT_OFF && stat(input, &st) == 0 &&
+         S_ISREG(st.st_mode) && st.st_size >= MD2MDOC_SPLITMIN;
+}
+
+/**
+ * taketokens --
+ *      Take the jobserver tokens a single input may be parsed with:
+ *      the process's own and as many more as are free now.
+ * Parameters:
+ *  js      -   make's jobserver
+ *  njobs   -   -j, or 0 for the number of online processors
+ *  tokens  -   set to the tokens (MAXTOKENS of room)
  *
- * Compare up to n bytes from s1 and s2 ignoring ASCII case differences
- * for alphabetic characters (works by folding space bit).
+ * Returns:
+ *  The number of tokens, that is of threads to parse on.
+ */
+static unsigned int taketokens(struct jobserver *js, long njobs, int *tokens) {
+  unsigned int n = 0;
+  int t;
+
+  if (njobs == 0)
+    njobs = sysconf(_SC_NPROCESSORS_ONLN);
+  if (njobs > MAXTOKENS)
+    njobs = MAXTOKENS;
+  tokens[n++] = js_get(js);
+  while ((long)n < njobs && (t = js_tryget(js)) != -1)
+    tokens[n++] = t;
+  return n;
+}
+
+/**
+ * givetokens --
+ *      Give back the tokens of `taketokens`.
+ */
+static void givetokens(struct jobserver *js, const int *tokens, unsigned int n) {
+  while (n > 0)
+    js_put(js, tokens[--n]);
+}
+
+/**
+ * ctxmeta --
+ *      What the last conversion of `ctx` learned about its page.
+ */
+static void ctxmeta(const md2mdoc_ctx *ctx, struct cache_meta *meta) {
+  snprintf(meta->section, sizeof(meta->section), "%s", md2mdoc_section(ctx));
+  snprintf(meta->names, sizeof(meta->names), "%s", md2mdoc_names(ctx));
+  snprintf(meta->desc, sizeof(meta->desc), "%s", md2mdoc_description(ctx));
+  snprintf(meta->title, sizeof(meta->title), "%s", md2mdoc_title(ctx));
+}
+
+/**
+ * keeppage --
+ *      Remember a converted page of the batch for the whatis index.
+ *      A page without a NAME line goes under its title, or else the
+ *      name of its input. Each job has its own entry, so the workers
+ *      need no lock.
+ * Parameters:
+ *  b       -   batch the job belongs to
+ *  job     -   the job
+ *  meta    -   what the page says about itself
+ */
+static void keeppage(const struct batch *b, const struct job *job, const struct cache_meta *meta) {
+  struct whatis_page *wp;
+  const char *name = meta->names;
+  size_t len;
+
+  if (b->pages == NULL)
+    return;
+  wp = &b->pages[job - b->jobs];
+  free(wp->names);
+  free(wp->desc);
+  if (*name == '\0')
+    name = meta->title;
+  if (*name == '\0') {
+    name = strrchr(job->input, '/');
+    name = name ? name + 1 : job->input;
+  }
+  len = strlen(name);
+  if (name != meta->names && name != meta->title && len > 3 && strcmp(name + len - 3, ".md") == 0)
+    len -= 3;
+  if ((wp->names = strndup(name, len)) == NULL || (wp->desc = strdup(meta->desc)) == NULL)
+    err(1, NULL);
+  snprintf(wp->section, sizeof(wp->section), "%s", meta->section);
+}
+
+/**
+ * writeindex --
+ *      Write the whatis indexes asked for from the pages converted.
  *
+ * Returns:
+ *  0 on success, -1 on failure (reported).
+ */
+static int writeindex(const struct batch *b) {
+  int rv = 0;
+
+  if (b->whatis != NULL && whatis_write(b->whatis, b->pages, b->njobs) == -1) {
+    warn("%s", b->whatis);
+    rv = -1;
+  }
+  if (b->whatisdb != NULL && whatis_writedb(b->whatisdb, b->pages, b->njobs) == -1) {
+    warn("%s", b->whatisdb);
+    rv = -1;
+  }
+  return rv;
+}
+
+/**
+ * addstats --
+ *      Add one set of counters to another.
+ */
+static void addstats(struct md2mdoc_stats *dst, const struct md2mdoc_stats *src) {
+  size_t i;
+
+  for (i = 0; i < sizeof(statfields) / sizeof(statfields[0]); i++)
+    *(unsigned long long *)((char *)dst + statfields[i].off) +=
+      *(const unsigned long long *)((const char *)src + statfields[i].off);
+}
+
+/**
+ * printstats --
+ *      Report the counters on stderr, as `name value` lines or as a
+ *      JSON object.
+ */
+static void printstats(const struct md2mdoc_stats *st) {
+  unsigned long long v;
+  size_t i, n = sizeof(statfields) / sizeof(statfields[0]);
+
+  if (statsmode == STATS_JSON)
+    fputc('{', stderr);
+  for (i = 0; i < n; i++) {
+    v = *(const unsigned long long *)((const char *)st + statfields[i].off);
+    if (statsmode == STATS_JSON)
+      fprintf(stderr, "%s\"%s\":%llu", i ? "," : "", statfields[i].name, v);
+    else
+      fprintf(stderr, "%-14s %llu\n", statfields[i].name, v);
+  }
+  if (statsmode == STATS_JSON)
+    fputs("}\n", stderr);
+}
+
+/**
+ * formatkey --
+ *      Cache key of one format of an input. mdoc pages keep the plain
+ *      key, so a cache filled before -T existed is still used; the
+ *      other formats add their name.
+ */
+static void formatkey(const char *key, int format, char *fkey, size_t cap) {
+  const char *name = md2mdoc_format_name(format);
+  size_t klen = strlen(key), nlen = strlen(name);
+
+  memcpy(fkey, key, klen + 1);                          /* Keys are far shorter than CACHE_KEYMAX. */
+  if (format != MD2MDOC_MDOC && klen + 1 + nlen < cap) {
+    fkey[klen] = '-';
+    memcpy(fkey + klen + 1, name, nlen + 1);
+    klen += 1 + nlen;
+  }
+  if (gzlevel != 0)                                     /* -z pages are cached compressed. */
+    snprintf(fkey + klen, cap - klen, "-gz%d", gzlevel);
+}
+
+/**
+ * pathjoin --
+ *      Join a directory and a file name into a newly allocated path.
+ *      An empty directory yields a copy of `name`.
+ */
+static char *pathjoin(const char *dir, const char *name) {
+  size_t dlen = strlen(dir), nlen = strlen(name);
+  char *p;
+
+  if ((p = malloc(dlen + nlen + 2)) == NULL)
+    err(1, NULL);
+  if (dlen == 0) {
+    memcpy(p, name, nlen + 1);
+  } else {
+    memcpy(p, dir, dlen);
+    p[dlen] = '/';
+    memcpy(p + dlen + 1, name, nlen + 1);
+  }
+  return p;
+}
+
+/**
+ * addinput --
+ *      Queue one input for batch conversion. Directories are searched
+ *      recursively and every `*.md` file found is queued.
  * Parameters:
- *  s1   -  pointer to first memory region
- *  s2   -  pointer to second memory region
- *  n    -  number of bytes to compare
+ *  b        -   batch to add to
+ *  path     -   file or directory name
+ *  relpath  -   name of `path` relative to the directory given on the
+ *               command line (used to build the output name)
+ */
+static void addinput(struct batch *b, const char *path, const char *relpath) {
+  struct stat st;
+  struct dirent *de;
+  DIR *dir;
+  char *child, *childrel;
+  size_t len;
+
+  if (stat(path, &st) == -1) {
+    warn("%s", path);
+    b->failed = 1;
+    return;
+  }
+
+  if (S_ISDIR(st.st_mode)) {
+    if ((dir = opendir(path)) == NULL) {
+      warn("%s", path);
+      b->failed = 1;
+      return;
+    }
+    while ((de = readdir(dir)) != NULL) {
+      if (de->d_name[0] == '.')                         /* Skip `.`, `..` and hidden files. */
+        continue;
+      child = pathjoin(path, de->d_name);
+      childrel = pathjoin(relpath, de->d_name);
+      if (stat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+        addinput(b, child, childrel);
+      } else {
+        len = strlen(de->d_name);
+        if (len > 3 && strcmp(de->d_name + len - 3, ".md") == 0)
+          addinput(b, child, childrel);
+      }
+      free(child);
+      free(childrel);
+    }
+    closedir(dir);
+    return;
+  }
+
+  if (b->njobs == b->capjobs) {
+    b->capjobs = b->capjobs ? b->capjobs * 2 : 64;
+    if ((b->jobs = realloc(b->jobs, b->capjobs * sizeof(*b->jobs))) == NULL)
+      err(1, NULL);
+  }
+  if ((b->jobs[b->njobs].input = strdup(path)) == NULL ||
+      (b->jobs[b->njobs].relpath = strdup(relpath)) == NULL)
+    err(1, NULL);
+  b->njobs++;
+}
+
+/**
+ * makeparents --
+ *      Create every missing directory leading up to `path`.
+ * Parameters:
+ *  path    -   file name whose parent directories are needed
  *
- * Returns: <0 if s1 < s2, 0 if equal, >0 if s1 > s2 (same semantics as memcmp).
- * Notes: Operates on raw bytes; caller should ensure buffers are at least n bytes.
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
  */
-static int cimemcmp(const void *s1, const void *s2, size_t n) {
-  if (n != 0) {
-    const unsigned char *p1 = s1, *p2 = s2;
+static int makeparents(const char *path) {
+  char tmp[PATH_MAX];
+  char *p;
 
-    do {
-      if ((*p1++ & ~' ') != (*p2++ & ~' '))
-        return (*--p1 - *--p2);
-    } while (--n != 0);
+  if (strlen(path) >= sizeof(tmp)) {
+    errno = ENAMETOOLONG;
+    return -1;
   }
-  return (0);
+  strcpy(tmp, path);
+  for (p = tmp + 1; *p; p++) {
+    if (*p != '/')
+      continue;
+    *p = '\0';
+    if (mkdir(tmp, 0755) == -1 && errno != EEXIST)
+      return -1;
+    *p = '/';
+  }
+  return 0;
 }
 
 /**
- * read_upto --
- *      Read characters from *src into dst up to delim or NUL or
- *      capacity-1.
+ * pagebase --
+ *      Name of a batch page without its suffix: `outdir/rel`, or
+ *      `outdir/<format>/rel` when several formats are written.
+ *
+ * Returns:
+ *  0 on success, -1 if the name does not fit.
+ */
+static int pagebase(struct page *pg, const char *outdir, const char *rel, size_t len) {
+  int n;
+
+  if (nformats > 1)
+    n = snprintf(pg->base, sizeof(pg->base), "%s/%s/%.*s", outdir,
+                 md2mdoc_format_name(pg->format), (int)len, rel);
+  else
+    n = snprintf(pg->base, sizeof(pg->base), "%s/%.*s", outdir, (int)len, rel);
+  return n < 0 || n >= (int)sizeof(pg->base) ? -1 : 0;
+}
+
+/**
+ * pagefinal --
+ *      Work out the final name of a page.
  * Parameters:
- *  src      -   Pointer to input pointer; advanced as characters are
- *               consumed.
- *  delim    -   Delimiter character to stop at (not copied).
- *  dst      -   Destination buffer for extracted token
- *               (NUL-terminated).
- *  dstcap   -   Capacity of dst in bytes.
+ *  pg      -   the page
+ *  section -   section from the page's `title:` line, which is the
+ *              suffix of mdoc and man pages (the format name if it is
+ *              empty), followed by `.gz` with -z; NULL to write to
+ *              `base` itself
  *
- * Returns 1 if delim was found, 0 otherwise.
+ * Returns:
+ *  0 on success, -1 if the name does not fit.
  */
-static int read_upto(const char **src, const char *delims, char *dst, size_t dstcap, int eatfinalchar) {
-    size_t i = 0;
-    const char *p = *src;
+static int pagefinal(struct page *pg, const char *section) {
+  const char *ext;
+
+  if (section == NULL)
+    ext = NULL;
+  else if (pg->format == MD2MDOC_HTML)
+    ext = "html";
+  else
+    ext = section[0] ? section : md2mdoc_format_name(pg->format);
+  if (ext == NULL)
+    return snprintf(pg->final, sizeof(pg->final), "%s", pg->base) >= (int)sizeof(pg->final) ? -1 : 0;
+  return snprintf(pg->final, sizeof(pg->final), "%s.%s%s", pg->base, ext,
+                  gzlevel != 0 ? ".gz" : "") >= (int)sizeof(pg->final) ? -1 : 0;
+}
 
-    if (delims == NULL || *delims == '\0') { /* nothing to stop on */
-        return 0;
-    }
+/**
+ * maketemp --
+ *      Create the temporary file a page is written to (and any
+ *      missing directories leading up to it).
+ *
+ * Returns:
+ *  The open descriptor, or -1 on failure (reported).
+ */
+static int maketemp(struct page *pg) {
+  int fd;
+
+  if (snprintf(pg->tmp, sizeof(pg->tmp), "%s.XXXXXX", pg->base) >= (int)sizeof(pg->tmp)) {
+    warnx("%s: output name too long", pg->base);
+    return -1;
+  }
+  if (makeparents(pg->tmp) == -1 || (fd = mkstemp(pg->tmp)) == -1) {
+    warn("%s", pg->tmp);
+    return -1;
+  }
+  fchmod(fd, 0644);
+  return fd;
+}
 
-    while (*p && strchr(delims, *p) == NULL) {
-        if (i + 1 < dstcap) {          /* leave room for NUL */
-            dst[i++] = *p;
-        }
-        p++;
+/**
+ * openpages --
+ *      Open the temporary file of every page, and describe them as
+ *      the outputs of a conversion.
+ *
+ * Returns:
+ *  0 on success, -1 on failure (reported; nothing is left behind).
+ */
+static int openpages(struct page *pg, struct md2mdoc_output *outs) {
+  size_t f;
+  int fd;
+
+  for (f = 0; f < nformats; f++) {
+    if ((fd = maketemp(&pg[f])) == -1)
+      break;
+    if ((pg[f].out = fdopen(fd, "w")) == NULL) {
+      warn("%s", pg[f].tmp);
+      close(fd);
+      unlink(pg[f].tmp);
+      break;
+    }
+    pg[f].gz = NULL;
+    if (gzlevel != 0 && (pg[f].gz = gz_open(pg[f].out, gzlevel)) == NULL) {
+      warn("%s", pg[f].tmp);
+      fclose(pg[f].out);
+      unlink(pg[f].tmp);
+      break;
     }
-    dst[i] = '\0';
+    outs[f].format = pg[f].format;
+    outs[f].sink = pg[f].gz != NULL ? gz_sink : md2mdoc_file_sink;
+    outs[f].arg = pg[f].gz != NULL ? (void *)pg[f].gz : (void *)pg[f].out;
+  }
+  if (f == nformats)
+    return 0;
+  discardpages(pg, f);
+  return -1;
+}
+
+/**
+ * discardpages --
+ *      Close and remove the temporary files of the first `n` pages.
+ */
+static void discardpages(struct page *pg, size_t n) {
+  size_t f;
+
+  for (f = 0; f < n; f++) {
+    if (pg[f].gz != NULL)
+      gz_close(pg[f].gz);
+    fclose(pg[f].out);
+    unlink(pg[f].tmp);
+  }
+}
 
-    if (*p && strchr(delims, *p) != NULL) {
-      if (eatfinalchar) p++;                           /* consume closing delim */
-      *src = p;
-      return 1;
+/**
+ * commitpages --
+ *      Close every page and rename it into place (see `pagefinal`
+ *      for `section`).
+ *
+ * Returns:
+ *  0 on success, -1 if any page failed (reported).
+ */
+static int commitpages(struct page *pg, const char *section) {
+  size_t f;
+  int zrv, rv = 0;
+
+  for (f = 0; f < nformats; f++) {
+    zrv = pg[f].gz != NULL ? gz_close(pg[f].gz) : 0;
+    if (fclose(pg[f].out) == EOF || zrv == -1 || pagefinal(&pg[f], section) == -1 ||
+        rename(pg[f].tmp, pg[f].final) == -1) {
+      warn("%s", pg[f].final);
+      unlink(pg[f].tmp);
+      rv = -1;
     }
-   return 0;
+  }
+  return rv;
 }
 
 /**
- * Sanitize --
- *      Allow only "white-listed" chars in string.
+ * convertjob --
+ *      Convert a single batch job into a page for each format. The
+ *      pages are written to temporary files next to their destination
+ *      and renamed once complete, so a reader never sees a half
+ *      written page.
+ * Parameters:
+ *  b       -   batch the job belongs to
+ *  ctx     -   conversion context of the calling thread
+ *  job     -   job to convert
+ *
+ * Returns:
+ *  0 on success, -1 on failure.
  */
-static void sanitize(char *user_data, size_t n) {
-  if(!user_data) return;
-  static char ok_chars[] = "abcdefghijklmnopqrstuvwxyz"
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-    "1234567890"
-    " \f\t"
-    "_"
-    ;
-  const char *end = user_data + n;
-  for (user_data += strspn(user_data, ok_chars); user_data != end;
-       user_data += strspn(user_data, ok_chars)) {
-    *user_data = ' ';
+static int convertjob(const struct batch *b, md2mdoc_ctx *ctx, const struct job *job) {
+  struct page pg[MD2MDOC_NFORMATS];
+  struct md2mdoc_output outs[MD2MDOC_NFORMATS];
+  struct cache_meta meta;
+  char dir[PATH_MAX];
+  int in, rv;
+
+  if (jobpages(b, job, pg) == -1)
+    return -1;
+  md2mdoc_ctx_include(ctx, frags, inputdir(job->input, dir, sizeof(dir)));
+  setlint(ctx, job->input);
+  if (b->cachedir != NULL)
+    return cachedjob(b, ctx, job, pg);
+
+  if ((in = open(job->input, O_RDONLY)) == -1) {
+    warn("%s", job->input);
+    return -1;
+  }
+  if (openpages(pg, outs) == -1) {
+    close(in);
+    return -1;
+  }
+
+  rv = md2mdoc_convert_fd_to(ctx, in, outs, nformats);
+  close(in);
+  if (rv == -1) {
+    convfailed(ctx, job->input);
+    discardpages(pg, nformats);
+    return -1;
   }
+  if (commitpages(pg, md2mdoc_section(ctx)) == -1)
+    return -1;
+  ctxmeta(ctx, &meta);
+  keeppage(b, job, &meta);
+  return 0;
 }
 
 /**
- * skip_one_space_or_newline --
- *      If *src points to a single space or newline, advance past it.
+ * jobpages --
+ *      Set up the pages of a batch job: one per format, each with its
+ *      name without the suffix.
+ *
+ * Returns:
+ *  0 on success, -1 if a name does not fit (reported).
+ */
+static int jobpages(const struct batch *b, const struct job *job, struct page *pg) {
+  const char *rel = job->relpath;
+  size_t len, f;
+
+  if (*rel == '\0') {                                   /* A file named on the command line. */
+    rel = strrchr(job->input, '/');
+    rel = rel ? rel + 1 : job->input;
+  }
+  len = strlen(rel);
+  if (len > 3 && strcmp(rel + len - 3, ".md") == 0)
+    len -= 3;
+  for (f = 0; f < nformats; f++) {
+    pg[f].format = formats[f];
+    if (pagebase(&pg[f], b->outdir, rel, len) == -1) {
+      warnx("%s: output name too long", job->input);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * convertloaded --
+ *      Convert a batch job whose input the I/O engine has loaded, and
+ *      hand its pages back to the engine to write. The temporary name
+ *      of a page is made from the process and the job, so no two
+ *      pages share one and no file has to be created to reserve it;
+ *      the engine also makes any directory the page needs.
  * Parameters:
- *  src  -   Pointer to input pointer; may be advanced by one.
+ *  b       -   batch the job belongs to
+ *  ctx     -   conversion context of the calling thread
+ *  in      -   the loaded input
+ *
+ * Returns:
+ *  0 on success, -1 on failure (reported).
  */
-static void skip_one_space_or_newline(const char **src) {
-    if (**src == ' ' || **src == '\n')
-      (*src)++;
+static int convertloaded(const struct batch *b, md2mdoc_ctx *ctx, const struct bio_in *in) {
+  const struct job *job = &b->jobs[in->index];
+  struct page pg[MD2MDOC_NFORMATS];
+  struct md2mdoc_buf bufs[MD2MDOC_NFORMATS];
+  struct md2mdoc_output outs[MD2MDOC_NFORMATS];
+  struct cache_meta meta;
+  const char *sec;
+  char dir[PATH_MAX];
+  size_t f;
+  int rv = -1;
+
+  if (in->error != 0) {
+    errno = in->error;
+    warn("%s", job->input);
+    return -1;
+  }
+  if (jobpages(b, job, pg) == -1)
+    return -1;
+  md2mdoc_ctx_include(ctx, frags, inputdir(job->input, dir, sizeof(dir)));
+  setlint(ctx, job->input);
+  memset(bufs, 0, sizeof(bufs));
+  for (f = 0; f < nformats; f++) {
+    outs[f].format = pg[f].format;
+    outs[f].sink = md2mdoc_buf_sink;
+    outs[f].arg = &bufs[f];
+  }
+  if (md2mdoc_convert_to(ctx, in->data, in->len, outs, nformats) == -1) {
+    convfailed(ctx, job->input);
+    goto done;
+  }
+  sec = md2mdoc_section(ctx);
+  for (f = 0; f < nformats; f++) {
+    if (pagefinal(&pg[f], sec) == -1 ||
+        snprintf(pg[f].tmp, sizeof(pg[f].tmp), "%s.%ld.%zu", pg[f].base, (long)getpid(),
+                 in->index) >= (int)sizeof(pg[f].tmp)) {
+      warnx("%s: output name too long", job->input);
+      goto done;
+    }
+    if (gzlevel != 0 && gz_buf(&bufs[f], gzlevel) == -1) {
+      warn("%s", job->input);
+      goto done;
+    }
+    bio_write(b->bio, pg[f].tmp, pg[f].final, bufs[f].data, bufs[f].len);
+    bufs[f].data = NULL;                                /* The engine frees it. */
+  }
+  ctxmeta(ctx, &meta);
+  keeppage(b, job, &meta);                              /* A page the engine fails to write fails the batch. */
+  rv = 0;
+
+done:
+  for (f = 0; f < nformats; f++)
+    free(bufs[f].data);
+  return rv;
 }
 
 /**
- * processnested --
- *      Process inline (nested) tokens from string `s` and write
- *      formatted output to `fd`.
+ * loadinput --
+ *      Map a regular file, or read anything else (a pipe) into an
+ *      allocated buffer.
  *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+static int loadinput(int fd, struct input *in) {
+  struct stat st;
+  size_t cap = 64 * 1024;
+  ssize_t n;
+  char *p;
+
+  in->data = NULL;
+  in->len = 0;
+  in->mapped = 0;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    in->data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (in->data != MAP_FAILED) {
+      in->len = (size_t)st.st_size;
+      in->mapped = 1;
+      return 0;
+    }
+    in->data = NULL;
+  }
+
+  if ((in->data = malloc(cap)) == NULL)
+    return -1;
+  for (;;) {
+    if (in->len == cap) {
+      if ((p = realloc(in->data, cap * 2)) == NULL)
+        goto fail;
+      in->data = p;
+      cap *= 2;
+    }
+    if ((n = read(fd, in->data + in->len, cap - in->len)) == 0)
+      return 0;
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      goto fail;
+    }
+    in->len += (size_t)n;
+  }
+
+fail:
+  free(in->data);
+  in->data = NULL;
+  return -1;
+}
+
+static void freeinput(struct input *in) {
+  if (in->mapped)
+    munmap(in->data, in->len);
+  else
+    free(in->data);
+}
+
+/**
+ * writeall --
+ *      Write all of `len` bytes to `fd`.
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+static int writeall(int fd, const char *data, size_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = write(fd, data, len)) == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/**
+ * cachedjob --
+ *      Convert a batch job through the cache. When every format is a
+ *      hit the stored pages are copied into place; otherwise the page
+ *      is converted in memory, written out and added to the cache.
  * Parameters:
- *  fd  -   File descriptor
- *  s   -   String to parse
- */
-static void processnested(FILE *out, const char *str) {
-    const char *p = str;
-    char tok[512];                                      /* Temporary token buffer capacity. */
-    unsigned cntr = 0;
-
-    while (*p) {
-        switch (*p) {
-          case '@':                                     /* UNDOCUMENTED - "modifiers"
-                                                           Shortcut for '.Cm' (Command Modifier) */
-            p++;
-            if (cntr >= 1) fprintf(out, "\n");
-            read_upto(&p, " ,\n:;()", tok, sizeof(tok), FALSE);
-            fprintf(out, COMMANDMODIFIER " %s\n", tok);
-            skip_one_space_or_newline(&p);
-            break;
-          case '$':                                     /* UNDOCUMENTED - "reference"
-                                                           Shortcut for '.Nm' (project name) */
-            p++;
-            if (cntr >= 1) fprintf(out, "\n");
-            read_upto(&p, "'\") ,\n:;", tok, sizeof(tok), FALSE);
-            skip_one_space_or_newline(&p);
-            if (strncmp(tok, "name", 4) == 0) {
-              fprintf(out, NAME "\n");
-            } else {                                    /* UNDOCUMENTED - "section reference" */
-              fprintf(out, SECTIONREFERENCE " %s\n", tok);
-              skip_one_space_or_newline(&p);
-           }
-            break;
-        case '*':                                       /* bold -> .Sy %s\n */
-            p++;                                        /* eat '*' */
-//:~              read_upto(&p, "*,) \n;:", tok, sizeof(tok), TRUE);
-            read_upto(&p, "*,) \n;:", tok, sizeof(tok), TRUE);
-            if (cntr >= 1) fprintf(out, "\n");
-            fprintf(out, BOLD " %s\n", tok);
-            skip_one_space_or_newline(&p);
-            break;
-
-        case '_':                                       /* italic -> .Em %s\n */
-            p++;
-//:~              read_upto(&p, "_ \n,.;:)", tok, sizeof(tok), TRUE);
-            read_upto(&p, "_", tok, sizeof(tok), TRUE);
-            if (cntr >= 1) fprintf(out, "\n");
-            fprintf(out, ITALIC " %s\n", tok);
-            skip_one_space_or_newline(&p);
-            break;
-
-        case '`':                                       /* inline literal -> .Li %s\n */
-            p++;
-            read_upto(&p, "`\n", tok, sizeof(tok), TRUE);
-            if (cntr >= 1) fprintf(out, "\n");
-            fprintf(out, INLINE " %s\n", tok);
-            skip_one_space_or_newline(&p);
-            break;
-
-        case '^':                                       /* reference -> .Xr %s\n */
-            p++;
-            read_upto(&p, "^ \n,.;:", tok, sizeof(tok), TRUE);
-            sanitize(tok, strlen(tok));
-            if (cntr >= 1) fprintf(out, "\n");
-            fprintf(out, REFERENCE " %s", tok);
-            while (*p == ' ' || \
-                *p == ',' || \
-                *p == '.')
-              fprintf(out, "%c", *p++);
-            if(*p != '\n') fprintf(out, "\n");
-            continue;
-
-        case '\\':                                      /* escape: \x\ -> x (or consume next char if present) */
-            p++;                                        /* eat backslash */
-            if (*p && *p != '\\') {
-                /* copy single character up to buffer limit */
-                tok[0] = *p;
-                tok[1] = '\0';
-                p++;                                    /* consume escaped char */
-                if (*p == '\\') p++;                    /* eat backslash if found */
-                fprintf(out, "%s", tok);
-            } else if (*p == '\\') {
-                /* literal backslash sequence "\\": output single backslash and consume */
-                fprintf(out, "\\");
-                p++;
-            } else {
-                /* dangling backslash at end: output it */
-                fprintf(out, "\\");
-            }
-            break;
-
-        default:
-            /* regular character: write single char */
-            fprintf(out, "%c", *p);
-            p++;
-            break;
-        } /* switch */
-        cntr++;
-    } /* while */
-}
-
-/**
- * processline --
- *      This process the current line from the file and handles
- *      line-level constructs (leading tokens, block state--codeblock,
- *      optionslist, etc.).
+ *  b       -   batch the job belongs to
+ *  ctx     -   conversion context of the calling thread
+ *  job     -   job to convert
+ *  pg      -   the pages to write, with their `base` names
  *
+ * Returns:
+ *  0 on success, -1 on failure.
+ */
+static int cachedjob(const struct batch *b, md2mdoc_ctx *ctx, const struct job *job, struct page *pg) {
+  char key[CACHE_KEYMAX], fkey[CACHE_KEYMAX];
+  struct md2mdoc_buf bufs[MD2MDOC_NFORMATS];
+  struct md2mdoc_output outs[MD2MDOC_NFORMATS];
+  struct cache_meta meta;
+  struct input src;
+  size_t f;
+  int fd, cacheable, rv = -1;
+
+  if ((fd = open(job->input, O_RDONLY)) == -1 || loadinput(fd, &src) == -1) {
+    warn("%s", job->input);
+    if (fd != -1)
+      close(fd);
+    return -1;
+  }
+  close(fd);
+  cache_key(src.data, src.len, cachesalt, key, sizeof(key));
+  cacheable = (frags == NULL ||                         /* The key does not cover included files, */
+               !md2mdoc_has_include(src.data, src.len)) &&
+              lintmode == LINT_OFF;                     /*   and a hit would not be checked. */
+
+  for (f = 0; f < nformats && cacheable; f++) {
+    formatkey(key, pg[f].format, fkey, sizeof(fkey));
+    if (cache_lookup(b->cachedir, fkey, &meta) == -1 ||
+        pagefinal(&pg[f], meta.section) == -1 || (fd = maketemp(&pg[f])) == -1)
+      break;
+    close(fd);                                          /* Only the unique name is wanted. */
+    unlink(pg[f].tmp);
+    if (cache_fetch(b->cachedir, fkey, pg[f].tmp) == -1)
+      break;
+    if (rename(pg[f].tmp, pg[f].final) == -1) {
+      unlink(pg[f].tmp);
+      break;
+    }
+  }
+  if (f == nformats) {
+    keeppage(b, job, &meta);
+    freeinput(&src);
+    return 0;
+  }                                                     /* Anything wrong with an entry: convert. */
+
+  memset(bufs, 0, sizeof(bufs));
+  for (f = 0; f < nformats; f++) {
+    outs[f].format = pg[f].format;
+    outs[f].sink = md2mdoc_buf_sink;
+    outs[f].arg = &bufs[f];
+  }
+  if (md2mdoc_convert_to(ctx, src.data, src.len, outs, nformats) == -1) {
+    convfailed(ctx, job->input);
+    goto done;
+  }
+  ctxmeta(ctx, &meta);
+  for (f = 0; f < nformats; f++) {
+    if (pagefinal(&pg[f], meta.section) == -1) {
+      warnx("%s: output name too long", job->input);
+      goto done;
+    }
+    if (gzlevel != 0 && gz_buf(&bufs[f], gzlevel) == -1) {
+      warn("%s", job->input);
+      goto done;
+    }
+    if ((fd = maketemp(&pg[f])) == -1)
+      goto done;
+    if (writeall(fd, bufs[f].data, bufs[f].len) == -1) {
+      warn("%s", pg[f].tmp);
+      close(fd);
+      unlink(pg[f].tmp);
+      goto done;
+    }
+    if (close(fd) == -1 || rename(pg[f].tmp, pg[f].final) == -1) {
+      warn("%s", pg[f].final);
+      unlink(pg[f].tmp);
+      goto done;
+    }
+    formatkey(key, pg[f].format, fkey, sizeof(fkey));
+    if (cacheable && cache_store(b->cachedir, fkey, &meta, bufs[f].data, bufs[f].len) == -1)
+      warn("%s: cannot cache %s", b->cachedir, job->input); /* The page itself is fine. */
+  }
+  keeppage(b, job, &meta);
+  rv = 0;
+
+done:
+  for (f = 0; f < nformats; f++)
+    free(bufs[f].data);
+  freeinput(&src);
+  return rv;
+}
+
+/**
+ * convertcached --
+ *      Convert one input to streams through the cache.
  * Parameters:
- *  str -   string to search
- */
-static void processline(FILE *out, char *str) {
-    int c;
-    c = *str;
-
-    if(nameflag == 1) {                                 /* If we are supposed to process a name... */
-      fprintf(out, ".Nm ");
-      do {                                              /* Print this chars until NOT a dash */
-        if (*str != '-')
-          fprintf(out, "%c", *str);
-        ++str;                                          /* Eat the char */
-        if (*str == '-') {                              /* If we've encounted a dash, check for a doubledash. */
-          if(memcmp(str, "--", 2) == 0) {               /* double dashes signifies a `namedescription`. */
-            str += 2;                                   /* Eat the `--` string */
-            fprintf(out, "\n.Nd");
-          }
-        }
-      } while (*str != '\n');
-      nameflag = 0;                                     /* turn off the `nameflag`. */
-      fprintf(out, "\n");
+ *  ctx      -   conversion context
+ *  fd       -   the input
+ *  out      -   where the page goes, for each format in `formats`
+ *  cachedir -   the cache directory
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+static int convertcached(md2mdoc_ctx *ctx, int fd, FILE **out, const char *cachedir) {
+  char key[CACHE_KEYMAX], fkey[CACHE_KEYMAX];
+  struct md2mdoc_buf bufs[MD2MDOC_NFORMATS];
+  struct md2mdoc_output outs[MD2MDOC_NFORMATS];
+  struct cache_meta meta;
+  struct input src;
+  size_t f;
+  int cacheable, rv = 0;
+
+  if (loadinput(fd, &src) == -1)
+    return -1;
+  cache_key(src.data, src.len, cachesalt, key, sizeof(key));
+  cacheable = (frags == NULL ||                         /* The key does not cover included files, */
+               !md2mdoc_has_include(src.data, src.len)) &&
+              lintmode == LINT_OFF;                     /*   and a hit would not be checked. */
+  for (f = 0; f < nformats && cacheable; f++) {         /* Only write once every format is a hit. */
+    formatkey(key, formats[f], fkey, sizeof(fkey));
+    if (cache_lookup(cachedir, fkey, &meta) == -1)
+      break;
+  }
+  if (cacheable && f == nformats) {
+    for (f = 0; f < nformats; f++) {
+      formatkey(key, formats[f], fkey, sizeof(fkey));
+      if (cache_write(cachedir, fkey, out[f]) == -1)
+        break;
     }
+    if (f == nformats) {
+      freeinput(&src);
+      return 0;
+    }
+  }
 
-    if (codeblock == 0 || stripwhitespace == 1) {
-      stripspaces();
+  memset(bufs, 0, sizeof(bufs));
+  for (f = 0; f < nformats; f++) {
+    outs[f].format = formats[f];
+    outs[f].sink = md2mdoc_buf_sink;
+    outs[f].arg = &bufs[f];
+  }
+  if (md2mdoc_convert_to(ctx, src.data, src.len, outs, nformats) == -1)
+    rv = -1;
+  ctxmeta(ctx, &meta);
+  for (f = 0; f < nformats && rv == 0; f++) {
+    if (gzlevel != 0 && gz_buf(&bufs[f], gzlevel) == -1) {
+      rv = -1;
+      break;
     }
-    switch (c) {
-      /* stripwhitespace = 0; */
-      case '\n':                                        // Newlines are replaced with a break.
-        if (dashorenumlist == 1) {
-          fprintf(out, ".El\n");
-          optionslist = 0;
-          dashorenumlist = 0;
-        }
-        fprintf(out, ".Pp\n");
-        return;
-
-      case '0':
-      case '1':
-      case '2':
-      case '3':
-      case '4':
-      case '5':
-      case '6':
-      case '7':
-      case '8':
-      case '9':
-        str += 1;
-        if(dashorenumlist == 0) {                             /* Check to see if the `dashorenumlist` flag has been set.
-                                                           if it hasn't, create the list block and set the flag. */
-          dashorenumlist = 1;
-          fprintf(out, ".Bl -enum -offset indent -compact\n");
-         }
-
-        if (dashorenumlist == 1 && *str != '\n') {            /* If the dashorenumlist flag has been set, and the next char
-                                                           is NOT a newline, this is just a list item. */
-          while (!isalpha(*str)) str++;                 /* if the next item is not a (A-Za-z) char. */
-          fprintf(out, ITEM);                           /* Add a 'list item' macro */
-          fprintf(out, "\n%s", str);                    /* Print the string */
-        }
-        break;
+    if (fwrite(bufs[f].data, 1, bufs[f].len, out[f]) != bufs[f].len) {
+      rv = -1;
+      break;
+    }
+    formatkey(key, formats[f], fkey, sizeof(fkey));
+    if (cacheable && cache_store(cachedir, fkey, &meta, bufs[f].data, bufs[f].len) == -1)
+      warn("%s", cachedir);                             /* The page itself is fine. */
+  }
+  for (f = 0; f < nformats; f++)
+    free(bufs[f].data);
+  freeinput(&src);
+  return rv;
+}
 
-      case 'a':                                         // Look for the string 'author:'
-        if(cimemcmp(str, "author:", 7) == 0) {
-          str += 7;                                     /* Eat the `author:` string. */
-          fprintf(out, AUTHOR "%s", str);
-          return;
-        }
-
-      case 'd':                                         // Date
-        if(cimemcmp(str, "date:", 5) == 0) {
-          str += 5;                                     /* Eat the `date:` string */
-          fprintf(out, DATE "%s", str);
-          return;
-        }
-
-      case 't':                                         // Look for the string 'title:'
-        if(cimemcmp(str, "title:", 6) == 0) {
-          str += 6;                                     /* Eat the `title:` string. */
-          fprintf(out, TITLE "%s.Os\n", str);
-          return;
-        }
-
-      case '#':                                         // Section break (heading)
-        if(strncmp(str, "## ", 3) == 0)  {
-          sanitize(str, strlen(str));                   /* sanitize rest of string of all hashs */
-          while (!isalpha(*str)) str++;
-          fprintf(out, SUBSECTION " %s\n", str);
-          return;
-        } else if(strncmp(str, "# ", 2) == 0) {
-          sanitize(str, strlen(str));                   /* sanitize rest of string of all hashs */
-          while (!isalpha(*str)) str++;
-          fprintf(out, SECTION " %s\n", str);
-          if(cimemcmp(str, "NAME", 4) == 0) {           /* If we've found a "NAME" heading, we can
-                                                           assume the section looks something like:
-                                                              # NAME
-                                                              ProjectName -- Brief Decription
-                                                              so we set some flags for the default
-                                                              condition of this case statment to set
-                                                              the .Nm and .Nd mdoc macros.  */
-            nameflag = 1;
-          }
-        }
-
-        return;
-      case '[':                                         // Start of an optional argument
-                                                        // EG: to process the "[-abc]"
-        str++;                                          /* Eat the bracket */
-        fprintf(out, OPTIONAL);
-        if (*str == '-') {
-          str++;
-          fprintf(out, FLAG);
-          do {                                         /* Print the chars until space char */
-            if (*str != ' ')
-              fprintf(out, "%c", *str);
-            ++str;                                     /* eat the dash */
-          } while (*str != ' ' && *str != ']' && *str != '\n' && *str != '\0');
-          if (*str == ' ') {                            /* If we've found a space, this means we've found an
-                                                           optional argument.
-                                                           eg [-abc optional]
-                                                                   ^            */
-            fprintf(out, ARGUMENT);
-
-
-            do {                                       /* Print the chars until we find the closing bracket */
-              ++str;                                   /* eat the space */
-
-                if(*str == '[') {                      // If we locate a bracket at this
-                                                       // level, we've found another layer
-                                                       // of optional arguments...
-                                                       // EG
-                                                       // [-abc [optional]]
-                                                       //       ^
-                do {                                   /* Print the chars until we find the closing bracket */
-                  fprintf(out, "%c", *str);
-                } while (*str++ != ']' && *str != '\n' && *str != '\0');
-                break;
-               }
-
-              if (*str != ']')
-                fprintf(out, "%c", *str);
-            } while (*str != ']' && *str != '\n' && *str != '\0');
-          }
-          ++str;                                        /* Eat the last bracket */
-        } else {                                        /* Assume this is just a plain optional arguemnt */
-          fprintf(out, ARGUMENT);
-           do {                                         /* Print the chars until we find the closing bracket */
-             if (*str != ']')
-               fprintf(out, "%c", *str);
-             ++str;                                     /* Eat the closing bracket */
-           } while (*str != ']' && *str != '\n' && *str != '\0');
-        }
-
-        fprintf(out, "\n");
+/**
+ * batchworker --
+ *      Worker thread body; takes jobs off the shared queue until it
+ *      is empty.
+ * Parameters:
+ *  arg     -   the batch (struct batch *)
+ *
+ * Returns:
+ * NULL
+ */
+static void *batchworker(void *arg) {
+  struct batch *b = arg;
+  struct md2mdoc_stats stats;
+  struct bio_in in;
+  md2mdoc_ctx *ctx;
+  size_t i;
+  int rv, token;
+
+  if ((ctx = md2mdoc_ctx_new()) == NULL)
+    err(1, NULL);
+  md2mdoc_ctx_markup(ctx, markup);
+  memset(&stats, 0, sizeof(stats));
+  if (statsmode != STATS_OFF)
+    md2mdoc_ctx_stats(ctx, &stats);
+  for (;;) {
+    if (b->bio != NULL) {                               /* Jobs come loaded from the engine. */
+      if (!bio_next(b->bio, &in))
         break;
-
-      case '-':                                         // A list item or a single dash is a list terminator
-                                                        // EG: "-f" or "-f file" or just "-"
-        if(strncmp(str, "-->", 3) == 0) {               /* First check if this is the end of a comment block */
-          commentflag = 0;
-          return;
-        }
-        ++str;                                          /* eat the dash */
-
-        if(optionslist == 0) {                            /* Check to see if the `optionslist` flag has been set.
-                                                           if it hasn't, create the list block and set the flag. */
-          optionslist = 1;
-          fprintf(out, ".Bl -tag -width Ds\n");
-         }
-
-        if (optionslist == 1 && *str != '\n') {           /* If the optionslist flag has been set, and the next char
-                                                           is NOT a newline, this is just a list item. */
-          fprintf(out, ITEM);                           /* Add a 'list item' macro */
-
-          if (isalpha(*str) > 0)                        /* if the next item is (A-Za-z) char. */
-//:~            if (isspace(*str) == 0)                       /* if the next item is a space char. */
-            fprintf(out, FLAG);                         /* Add a 'flag' macro. */
-
-          fprintf(out, "%c", *str);                     /* Print the flag. */
-          ++str;
-
-          if (*str == ' ') {                            /* if we find a space after the flag, this is an argument
-                                                           EG: "-f argument"
-                                                                  ^           */
-
-            if (*(str + 1) == '-') {                    /* if we find a double dash, we assume there is a "long option" next"
-                                                            EG: "-f --file"
-                                                                    ^       */
-              if (strncmp(str, "--", 2)) {
-                str += 2;
-                fprintf(out, " Fl ");
-                while (*str != ' ' && *str != '\n') {
-                  fprintf(out, "%c", *str);
-                  str++;
-                }
-              }
-              if (*str == '\n') {
-                fprintf(out, "\n");
-                break;
-              }
-            }
-
-            fprintf(out, " Ar%s", str);                 /* Print the 'argument' macro and the string. */
-          } else {
-            fprintf(out, "%s", str);                    /* else just print the line. */
-          }
-          ++str;
-        }
-
-        if (*str == '\n' && optionslist == 1) {           /* However, if the line was only a dash and the optionslist
-                                                           is set then we need to close the item list. */
-          fprintf(out, ".El\n");
-          optionslist = 0;
-          dashorenumlist = 0;
-        }
+      token = js_get(b->js);                            /* A job in hand first: waiting ends. */
+      rv = convertloaded(b, ctx, &in);
+      js_put(b->js, token);
+      bio_release(b->bio, &in);
+    } else {
+      pthread_mutex_lock(&b->lock);
+      i = b->next++;
+      pthread_mutex_unlock(&b->lock);
+      if (i >= b->njobs)
         break;
+      token = js_get(b->js);
+      rv = convertjob(b, ctx, &b->jobs[i]);
+      js_put(b->js, token);
+    }
+    if (rv == -1) {
+      pthread_mutex_lock(&b->lock);
+      b->failed = 1;
+      pthread_mutex_unlock(&b->lock);
+    }
+  }
+  if (statsmode != STATS_OFF) {
+    pthread_mutex_lock(&b->lock);
+    addstats(&b->stats, &stats);
+    pthread_mutex_unlock(&b->lock);
+  }
+  md2mdoc_ctx_free(ctx);
+  return NULL;
+}
 
-      case '~':                                         // An alternate list terminator or list item
-        str++;
-        if (*str == '\n' && optionslist == 1) {
-          fprintf(out, ".El\n");
-          optionslist = 0;
-          dashorenumlist = 0;
-          return;
-        }
-        if (optionslist == 0) {
-          optionslist = 1;
-          dashorenumlist = 1;
-          fprintf(out, ".Bl -dash -compact\n");
-        }
-        if (optionslist == 1 && *str != '\n') {
-          fprintf(out, ITEM);
-          if (*str == ' ') {
-            fprintf(out, "\n%s", ++str);
-            break;
-          }
-        }
-        return;
-
-      case '<':                                         // The start of a `no format` section (this is also the
-                                                        // symbol used in vim's docformat).
-        if (cimemcmp(str, "<!--", 4) == 0) {            /* Start of a comment block */
-          commentflag = 1;
-          break;
-        }
-        fprintf(out, ".Bd -literal -offset indent\n");
-        stripwhitespace = 0;                            /* Disable stripwhitespace. */
-        codeblock = 1;                                  /* Set the `codeblock` flag */
-        break;
+/**
+ * runbatch --
+ *      Convert every queued job using a pool of `njobs` threads. The
+ *      files are read and written by the I/O engine when there is one
+ *      (not for --cache-dir, which does its own I/O).
+ * Parameters:
+ *  b       -   batch to run
+ *  njobs   -   number of worker threads
+ *
+ * Returns:
+ *  0 if every page was converted, 1 otherwise.
+ */
+static int runbatch(struct batch *b, unsigned int njobs) {
+  const char **paths = NULL;
+  pthread_t *workers;
+  unsigned int i, started = 0;
+  size_t j;
+
+  if (njobs > b->njobs)
+    njobs = b->njobs;
+  if (njobs == 0)
+    njobs = 1;
+  if ((workers = calloc(njobs, sizeof(*workers))) == NULL)
+    err(1, NULL);
+  if (b->cachedir == NULL && b->njobs > 0) {
+    if ((paths = calloc(b->njobs, sizeof(*paths))) == NULL)
+      err(1, NULL);
+    for (j = 0; j < b->njobs; j++)
+      paths[j] = b->jobs[j].input;
+    b->bio = bio_open(paths, b->njobs);
+  }
 
-      case '>':                                         // The end of a `no format` section
-        fprintf(out, ".Ed\n");
-        /* stripwhitespace = 1; */
-        codeblock = 0;
-        break;
+  for (i = 1; i < njobs; i++) {                         /* This thread is worker zero. */
+    if (pthread_create(&workers[i], NULL, batchworker, b) != 0)
+      break;
+    started++;
+  }
+  batchworker(b);
+  for (i = 1; i <= started; i++)
+    pthread_join(workers[i], NULL);
+  if (b->bio != NULL && bio_close(b->bio) == -1)      /* Waits for the last pages. */
+    b->failed = 1;
+  b->bio = NULL;                                        /* --watch rebuilds do their own I/O. */
+
+  free(paths);
+  free(workers);
+  return b->failed ? 1 : 0;
+}
 
-      case '`':                                         // Code block
-                                                        //   In markdown, READMEs, forum posts, etc.
-                                                        //   codeblocks are defined with three (3) backticks.
-        if (cimemcmp(str, "```", 3) == 0) {
-          if (codeblock == 0) {                          /* Check to see if the `codeblock` flag has been set. */
-            fprintf(out, ".Bd -literal -offset indent\n");
-            stripwhitespace = 0;                        /* Disable stripwhitespace. */
-            codeblock = 1;
-          } else if (codeblock == 1) {
-            fprintf(out, ".Ed\n");
-            /* stripwhitespace = 1; */
-            codeblock = 0;
-          }
-          return;
-        }
-
-      default:
-        if (commentflag == 1) {
-          return;
-        }
-
-        if (codeblock == 0) {                           /* If we're not in a clode block... */
-          processnested(out, str);                      /* Check the rest of the string for nested elements. */
-        } else {                                        /* otherwise just print the line. */
-          fprintf(out, "%s", str);
-          break;
-        }
+/**
+ * freebatch --
+ *      Release the job list of a batch.
+ */
+static void freebatch(struct batch *b) {
+  size_t i;
+
+  for (i = 0; i < b->njobs; i++) {
+    free(b->jobs[i].input);
+    free(b->jobs[i].relpath);
+    if (b->pages != NULL) {
+      free(b->pages[i].names);
+      free(b->pages[i].desc);
     }
+  }
+  free(b->jobs);
+  free(b->pages);
 }
 
 /**
- * readline --
- *      Reads a line from file descriptor and stores the string in buf.
- *
- * ARGS
- *  fd       -   file descriptor
- *  buf      -   where to store the string
- *  nbytes   -   How may bytes to read.
+ * convertfile --
+ *      Convert `input` into `outpath` (or, with several formats, into
+ *      `outpath.<format>` for each) by way of temporary files next to
+ *      them, so a viewer never sees a half written page.
+ * Parameters:
+ *  ctx      -   conversion context
+ *  input    -   markdown file, or NULL for standard input
+ *  outpath  -   page to write
+ *  cachedir -   --cache-dir, or NULL
  *
- * RETURNS
- *  int
+ * Returns:
+ *  0 on success, -1 on failure.
  */
-static int readline(FILE *in, char *buf, int nbytes) {
-     int linelen;
-     while ((linelen = getline(&buf, (size_t *)&nbytes, in)) > 0)
-             processline(filedescriptors[1], buf);
-    return linelen;
+static int convertfile(md2mdoc_ctx *ctx, const char *input, const char *outpath, const char *cachedir) {
+  struct page pg[MD2MDOC_NFORMATS];
+  struct md2mdoc_output outs[MD2MDOC_NFORMATS];
+  FILE *out[MD2MDOC_NFORMATS];
+  char dir[PATH_MAX];
+  size_t f;
+  int in = STDIN_FILENO, rv, n;
+
+  for (f = 0; f < nformats; f++) {
+    pg[f].format = formats[f];
+    if (nformats > 1)
+      n = snprintf(pg[f].base, sizeof(pg[f].base), "%s.%s%s", outpath, md2mdoc_format_name(formats[f]),
+                   gzlevel != 0 ? ".gz" : "");
+    else
+      n = snprintf(pg[f].base, sizeof(pg[f].base), "%s", outpath);
+    if (n < 0 || n >= (int)sizeof(pg[f].base)) {
+      warnx("%s: output name too long", outpath);
+      return -1;
+    }
+  }
+  if (input != NULL && (in = open(input, O_RDONLY)) == -1) {
+    warn("%s", input);
+    return -1;
+  }
+  if (openpages(pg, outs) == -1) {
+    if (input != NULL)
+      close(in);
+    return -1;
+  }
+
+  for (f = 0; f < nformats; f++)
+    out[f] = pg[f].out;
+  md2mdoc_ctx_include(ctx, frags, input != NULL ? inputdir(input, dir, sizeof(dir)) : NULL);
+  setlint(ctx, input != NULL ? input : "stdin");
+  rv = cachedir != NULL ? convertcached(ctx, in, out, cachedir)
+                        : md2mdoc_convert_fd_to(ctx, in, outs, nformats);
+  if (input != NULL)
+    close(in);
+  if (rv == -1) {
+    convfailed(ctx, input != NULL ? input : "stdin");
+    discardpages(pg, nformats);
+    return -1;
+  }
+  return commitpages(pg, NULL);
+}
+
+/**
+ * rebuildpage --
+ *      Called by the watcher for an input that was written, or for a
+ *      file included by the inputs: any page may use that, so all are
+ *      converted again (the fragment cache reads only the files that
+ *      changed). Files newly included are watched from then on.
+ * Parameters:
+ *  arg     -   the pages being watched (struct rebuild *)
+ *  index   -   which file changed (a job index with -d)
+ */
+static void rebuildpage(void *arg, size_t index) {
+  struct rebuild *r = arg;
+  size_t j;
+  int done = 0;
+
+  if (r->b != NULL) {
+    for (j = index < r->ninputs ? index : 0; j < r->b->njobs; j++) {
+      done |= convertjob(r->b, r->ctx, &r->b->jobs[j]) == 0;
+      if (index < r->ninputs)
+        break;
+    }
+    if (done && r->b->pages != NULL)
+      writeindex(r->b);                                 /* Failures are reported; keep watching. */
+  } else
+    convertfile(r->ctx, r->input, r->outpath, r->cachedir);
+  if (frags != NULL)
+    md2mdoc_frags_each(frags, watchpath, NULL);
+}
+
+/**
+ * listpath --
+ *      Add a path to a `struct watchlist`.
+ */
+static void listpath(void *arg, const char *path) {
+  struct watchlist *l = arg;
+
+  if (l->n == l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 16;
+    if ((l->paths = realloc(l->paths, l->cap * sizeof(*l->paths))) == NULL)
+      err(1, NULL);
+  }
+  l->paths[l->n++] = path;
+}
+
+/**
+ * watchpath --
+ *      Watch an included file too (from `rebuildpage`).
+ */
+static void watchpath(void *arg, const char *path) {
+  (void)arg;
+  watch_add(path);
 }
 
 //------------------------------------------------------*- C -*------
 // Main
 //-------------------------------------------------------------------
 int main(int argc, char *argv[]) {
+  md2mdoc_ctx *ctx;
+  struct batch b;
+  struct rebuild r;
+  struct md2mdoc_output output;
+  struct md2mdoc_stats stats;
+  struct gzout *gz = NULL;
+  int in = STDIN_FILENO;
+  FILE *out = stdout;                                   /* Default output is `stdout` unless specified otherwise. */
+  const char **inputs;
+  struct watchlist wl;
+  const char *outpath = NULL;
+  const char *cachedir = NULL;
+  const char *sockpath = NULL;
+  const char *markuppath = NULL;
+  const char *lookup = NULL;
+  const char *inc, *mode;
+  char dir[PATH_MAX];
+  int tokens[MAXTOKENS];
+  unsigned int ntokens;
+  int ninputs = 0, watch = 0, streamdocs = 0, includes = 0, outfd, rv;
+  long njobs = 0;
+  size_t j;
+  int i;
+
   if (argc < 2) {
     printusage(argv[0]);
     return 1;
   }
 
-  // -Default output is `stdout` unless specified otherwise.
-  filedescriptors[1] = stdout;
+  memset(&b, 0, sizeof(b));
+  memset(&stats, 0, sizeof(stats));
+  if ((inputs = calloc(argc, sizeof(*inputs))) == NULL)
+    err(1, NULL);
 
   // -Parse the command line options.
-  for (int i = 0; i < argc; i++) {
+  for (i = 1; i < argc; i++) {
     if (argv[i] && strlen(argv[i]) > 1) {
-      if (argv[i][0] != '-') { filedescriptors[0] = fopen(argv[i], "r"); }
-      if (argv[i][0] == '-' && argv[i][1] == 'o') { filedescriptors[1] = fopen(argv[++i], "w"); }
+      if (argv[i][0] != '-') { inputs[ninputs++] = argv[i]; }
+      if (argv[i][0] == '-' && argv[i][1] == 'o' && i + 1 < argc) { outpath = argv[++i]; }
+      if (argv[i][0] == '-' && argv[i][1] == 'd' && i + 1 < argc) { b.outdir = argv[++i]; }
+      if (strcmp(argv[i], "--cache-dir") == 0 && i + 1 < argc) { cachedir = argv[++i]; }
+      if (strcmp(argv[i], "--watch") == 0) { watch = 1; }
+      if (strcmp(argv[i], "--stats") == 0) { statsmode = STATS_TEXT; }
+      if (strcmp(argv[i], "--stats=json") == 0) { statsmode = STATS_JSON; }
+      if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) { sockpath = argv[++i]; }
+      if (strcmp(argv[i], "--stream-docs") == 0) { streamdocs = 1; }
+      if (strcmp(argv[i], "--markup") == 0 && i + 1 < argc) { markuppath = argv[++i]; }
+      if (strcmp(argv[i], "--whatis") == 0 && i + 1 < argc) { b.whatis = argv[++i]; }
+      if (strcmp(argv[i], "--whatis-db") == 0 && i + 1 < argc) { b.whatisdb = argv[++i]; }
+      if (strcmp(argv[i], "--lookup") == 0 && i + 1 < argc) { lookup = argv[++i]; }
+      if (strcmp(argv[i], "--lint") == 0) { lintmode = LINT_REPORT; }
+      if (strcmp(argv[i], "--lint=close") == 0) { lintmode = LINT_CLOSE; }
+      if (strcmp(argv[i], "--include") == 0) { includes = 1; }
+      if (argv[i][0] == '-' && argv[i][1] == 'z' && gzlevel == 0) { gzlevel = GZ_LEVEL; }
+      if (strcmp(argv[i], "--gzip-level") == 0 && i + 1 < argc) {
+        if ((gzlevel = (int)strtol(argv[++i], NULL, 10)) < 1 || gzlevel > 9)
+          errx(1, "--gzip-level: level must be 1 to 9: %s", argv[i]);
+      }
+      if (argv[i][0] == '-' && argv[i][1] == 'T' && i + 1 < argc) { setformats(argv[++i]); }
+      if (argv[i][0] == '-' && argv[i][1] == 'j' && i + 1 < argc) {
+        if ((njobs = strtol(argv[++i], NULL, 10)) < 1)
+          errx(1, "-j: invalid number of jobs: %s", argv[i]);
+      }
 
       /* print help/version */
       if (argv[i][0] == '-' && argv[i][1] == 'h') { printusage(argv[0]); return 1; }
@@ -705,7 +1562,185 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  processfd(filedescriptors[0]);
+  if (includes && (frags = md2mdoc_frags_new()) == NULL)
+    err(1, NULL);
+
+  // -Look a name up in the binary whatis index.
+  if (lookup != NULL) {
+    if (b.whatisdb == NULL)
+      errx(1, "--lookup requires --whatis-db <file>");
+    free(inputs);
+    md2mdoc_frags_free(frags);
+    if ((rv = whatis_lookup(b.whatisdb, lookup, stdout)) == -1)
+      err(1, "%s", b.whatisdb);
+    if (rv == 0)
+      warnx("%s: nothing appropriate", lookup);
+    return rv == 0 ? 1 : 0;
+  }
+  if ((b.whatis != NULL || b.whatisdb != NULL) && b.outdir == NULL)
+    errx(1, "--whatis and --whatis-db require -d <outdir>");
+
+  snprintf(cachesalt, sizeof(cachesalt), "%s", md2mdoc_version());
+  if (markuppath != NULL)
+    loadmarkup(markuppath);
+
+  // -Server modes: convert what clients send, on a socket until
+  //  killed or on stdin and stdout until stdin ends.
+  if (sockpath != NULL || streamdocs) {
+    mode = sockpath != NULL ? "--serve" : "--stream-docs";
+    if (ninputs > 0 || outpath != NULL || b.outdir != NULL)
+      errx(1, "%s takes no inputs, -o or -d", mode);
+    if (nformats > 1)
+      errx(1, "%s writes a single -T format", mode);
+    if (gzlevel != 0)
+      errx(1, "%s does not compress (-z)", mode);
+    if (lintmode != LINT_OFF)
+      errx(1, "%s does not lint (--lint)", mode);
+    free(inputs);
+    if (sockpath != NULL)
+      serve_run(sockpath, formats[0], frags, markup);
+    rv = serve_stream(STDIN_FILENO, STDOUT_FILENO, formats[0], frags, markup);
+    md2mdoc_frags_free(frags);
+    return rv == -1 ? 1 : 0;
+  }
 
-  return 0;
+  if (cachedir != NULL && mkdir(cachedir, 0755) == -1 && errno != EEXIST)
+    err(1, "%s", cachedir);
+  b.js = js_open();
+
+  // -Batch mode: every input goes into `outdir`.
+  if (b.outdir != NULL) {
+    b.cachedir = cachedir;
+    if (mkdir(b.outdir, 0755) == -1 && errno != EEXIST)
+      err(1, "%s", b.outdir);
+    for (i = 0; i < ninputs; i++)
+      addinput(&b, inputs[i], "");
+    free(inputs);
+    if ((b.whatis != NULL || b.whatisdb != NULL) &&
+        (b.pages = calloc(b.njobs + 1, sizeof(*b.pages))) == NULL)
+      err(1, NULL);
+    if (njobs == 0)
+      njobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (njobs < 1)
+      njobs = 1;
+    pthread_mutex_init(&b.lock, NULL);
+    rv = runbatch(&b, (unsigned int)njobs);
+    if (b.pages != NULL && writeindex(&b) == -1)
+      rv = 1;
+    if (nlint > 0)
+      rv = 1;
+    if (statsmode != STATS_OFF)
+      printstats(&b.stats);
+    if (watch && b.njobs > 0) {
+      if ((r.ctx = md2mdoc_ctx_new()) == NULL)
+        err(1, NULL);
+      md2mdoc_ctx_markup(r.ctx, markup);
+      md2mdoc_ctx_incremental(r.ctx, 1);                /* Edits mostly touch a section or two. */
+      memset(&wl, 0, sizeof(wl));
+      for (j = 0; j < b.njobs; j++)
+        listpath(&wl, b.jobs[j].input);
+      if (frags != NULL)
+        md2mdoc_frags_each(frags, listpath, &wl);
+      r.b = &b;
+      r.ninputs = b.njobs;
+      watch_run(wl.paths, wl.n, rebuildpage, &r);
+    }
+    freebatch(&b);
+    js_close(b.js);
+    md2mdoc_frags_free(frags);
+    return rv;
+  }
+
+  if (ninputs > 1)
+    errx(1, "more than one input requires -d <outdir>");
+  if (nformats > 1 && outpath == NULL)
+    errx(1, "more than one format requires -o <outfile> or -d <outdir>");
+
+  // -Watch a single page: rewrite `outpath` whenever it changes.
+  if (watch) {
+    if (ninputs != 1 || outpath == NULL)
+      errx(1, "--watch requires -o <outfile> or -d <outdir>");
+    if ((r.ctx = md2mdoc_ctx_new()) == NULL)
+      err(1, NULL);
+    md2mdoc_ctx_markup(r.ctx, markup);
+    md2mdoc_ctx_threads(r.ctx, (unsigned int)njobs);
+    md2mdoc_ctx_incremental(r.ctx, 1);
+    r.b = NULL;
+    r.input = inputs[0];
+    r.outpath = outpath;
+    r.cachedir = cachedir;
+    if (statsmode != STATS_OFF)
+      md2mdoc_ctx_stats(r.ctx, &stats);
+    js_close(b.js);                                     /* Kept running: no tokens held. */
+    convertfile(r.ctx, r.input, r.outpath, r.cachedir);
+    if (statsmode != STATS_OFF)
+      printstats(&stats);                               /* Of the first conversion. */
+    memset(&wl, 0, sizeof(wl));
+    listpath(&wl, inputs[0]);
+    if (frags != NULL)
+      md2mdoc_frags_each(frags, listpath, &wl);
+    r.ninputs = 1;
+    watch_run(wl.paths, wl.n, rebuildpage, &r);
+  }
+
+  if ((ctx = md2mdoc_ctx_new()) == NULL)
+    err(1, NULL);
+  md2mdoc_ctx_markup(ctx, markup);
+  md2mdoc_ctx_threads(ctx, (unsigned int)njobs);        /* 0 (no -j) parses on this thread. */
+  ntokens = 0;
+  if (b.js != NULL) {                                   /* make decides how many. */
+    if (ninputs == 1 && splitinput(inputs[0], njobs))
+      ntokens = taketokens(b.js, njobs, tokens);
+    md2mdoc_ctx_threads(ctx, ntokens);                  /* 0: this thread, on the implicit token. */
+  }
+  if (statsmode != STATS_OFF)
+    md2mdoc_ctx_stats(ctx, &stats);
+
+  // -Several formats: one page per format next to `outpath`.
+  if (nformats > 1) {
+    rv = convertfile(ctx, ninputs == 1 ? inputs[0] : NULL, outpath, cachedir);
+    givetokens(b.js, tokens, ntokens);
+    js_close(b.js);
+    if (statsmode != STATS_OFF)
+      printstats(&stats);
+    free(inputs);
+    md2mdoc_ctx_free(ctx);
+    md2mdoc_frags_free(frags);
+    return rv == -1 || nlint > 0 ? 1 : 0;
+  }
+
+  if (ninputs == 1 && (in = open(inputs[0], O_RDONLY)) == -1)
+    err(1, "%s", inputs[0]);
+  md2mdoc_ctx_include(ctx, frags, ninputs == 1 ? inputdir(inputs[0], dir, sizeof(dir)) : NULL);
+  setlint(ctx, ninputs == 1 ? inputs[0] : "stdin");     /* The names are argv's. */
+  free(inputs);
+  if (outpath != NULL && (out = fopen(outpath, "w")) == NULL)
+    err(1, "%s", outpath);
+
+  outfd = fileno(out);                                  /* Nothing else is written to `out`. */
+  output.format = formats[0];
+  output.sink = md2mdoc_fd_sink;
+  output.arg = &outfd;
+  if (gzlevel != 0 && cachedir == NULL) {               /* The cache compresses whole pages itself. */
+    if ((gz = gz_open(out, gzlevel)) == NULL)
+      err(1, NULL);
+    output.sink = gz_sink;
+    output.arg = gz;
+  }
+  if ((cachedir != NULL ? convertcached(ctx, in, &out, cachedir)
+                        : md2mdoc_convert_fd_to(ctx, in, &output, 1)) == -1 ||
+      (gz != NULL && gz_close(gz) == -1) || fflush(out) == EOF) {
+    givetokens(b.js, tokens, ntokens);
+    if ((inc = md2mdoc_include_failed(ctx)) != NULL)
+      err(1, "include: %s", inc);
+    err(1, NULL);
+  }
+  givetokens(b.js, tokens, ntokens);
+  js_close(b.js);
+  if (statsmode != STATS_OFF)
+    printstats(&stats);
+  md2mdoc_ctx_free(ctx);
+  md2mdoc_frags_free(frags);
+
+  return nlint > 0 ? 1 : 0;
 } ///:~
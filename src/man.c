@@ -0,0 +1,435 @@
+//===---------------------------------------------------*- C -*---===
+//: man.c
+//
+// DESCRIPTION
+// The man(7) emitter, for hosts whose man(1) predates mdoc. The IR
+// carries the same constructs as the mdoc macros, and each maps onto
+// its nearest man(7) form:
+//
+//      .Sh / .Ss               ->  .SH / .SS
+//      .Pp                     ->  .PP (.IP inside a list)
+//      .Bl -tag / .It Fl Ar    ->  .TP and a \fB\-flag\fR \fIarg\fR tag
+//      .Bl -enum / -dash, .It  ->  .IP 1. / .IP \-
+//      .Op                     ->  [...]
+//      .Bd -literal / .Ed      ->  .RS .nf / .fi .RE
+//      .Nm / .Nd               ->  name \- description
+//      .Sy .Cm .Li / .Em .Sx   ->  .B / .I
+//      mapped macros           ->  .B, .I or a line of roman text
+//      .Xr page n              ->  .BR page (n)
+//      .Dd .Dt                 ->  .TH title section "date"
+//      .Au                     ->  a comment
+//
+// Text is written as it is, as it is for mdoc, so roff escapes and
+// comments in the markdown keep working. Paragraph breaks are held
+// back until something follows them, which drops the ones that would
+// come right before a heading.
+//===-------------------------------------------------------------===
+
+#include "ir.h"
+#include "markup.h"
+
+#include <stdio.h>
+#include <string.h>
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static void put(struct emitter *em, const char *p, size_t n);
+static void breakpara(struct emitter *em);
+static void putsanitized(struct emitter *em, const char *p, size_t n);
+static void endmacro(struct emitter *em);
+static void setfont(struct emitter *em, int font);
+static void macro(struct emitter *em, const char *p, size_t n);
+static void space(struct emitter *em);
+static void plain(struct emitter *em, const char *p, size_t n);
+static void endline(struct emitter *em);
+static void text(struct emitter *em, const char *p, size_t n);
+static void macroline(struct emitter *em, const char *m, size_t mlen, const struct token *t);
+static void xref(struct emitter *em, const struct token *t);
+static void emit_man(struct emitter *em, const struct token *tok, size_t n);
+static void end_man(struct emitter *em);
+
+//-------------------------------------------------------------------
+// Global Variables
+//-------------------------------------------------------------------
+const struct format fmt_man = { "man", NULL, emit_man, end_man };
+
+#define PUTLIT(em, lit) put((em), (lit), sizeof(lit) - 1)
+#define MACRO(em, lit) macro((em), (lit), sizeof(lit) - 1)
+
+/**
+ * put --
+ *      Write bytes and remember where on the line they leave us.
+ */
+static void put(struct emitter *em, const char *p, size_t n) {
+  if (n == 0)
+    return;
+  if (em->para == 1)
+    breakpara(em);
+  em->para = 0;
+  bufwrite(&em->out, p, n);
+  em->last = p[n - 1];
+  em->bol = em->last == '\n';
+}
+
+/**
+ * breakpara --
+ *      Write the paragraph break that is being held back.
+ */
+static void breakpara(struct emitter *em) {
+  em->para = 0;
+  if (!em->bol)
+    PUTLIT(em, "\n");
+  if (em->list != LIST_NONE)
+    PUTLIT(em, ".IP\n");
+  else
+    PUTLIT(em, ".PP\n");
+}
+
+/**
+ * putsanitized --
+ *      Write bytes through `bufsanitized`.
+ */
+static void putsanitized(struct emitter *em, const char *p, size_t n) {
+  if (n == 0)
+    return;
+  if (em->para == 1)
+    breakpara(em);
+  em->para = 0;
+  bufsanitized(&em->out, p, n);
+  em->last = ' ';                                       /* Anything but a newline or bracket. */
+  em->bol = 0;
+}
+
+/**
+ * endmacro --
+ *      End a macro line whose arguments have been written.
+ */
+static void endmacro(struct emitter *em) {
+  PUTLIT(em, "\n");
+}
+
+/**
+ * setfont --
+ *      Switch the font of the current line.
+ */
+static void setfont(struct emitter *em, int font) {
+  if (em->font == font)
+    return;
+  if (font == FONT_B)
+    PUTLIT(em, "\\fB");
+  else if (font == FONT_I)
+    PUTLIT(em, "\\fI");
+  else
+    PUTLIT(em, "\\fR");
+  em->font = (unsigned char)font;
+}
+
+/**
+ * macro --
+ *      Write a whole macro line (ending in a newline), starting a new
+ *      line first if need be.
+ */
+static void macro(struct emitter *em, const char *p, size_t n) {
+  if (!em->bol)
+    endline(em);
+  put(em, p, n);
+}
+
+/**
+ * space --
+ *      Separate a flag or argument from what is before it on the line.
+ */
+static void space(struct emitter *em) {
+  setfont(em, FONT_R);
+  if (!em->bol && em->last != ' ' && em->last != '[')
+    PUTLIT(em, " ");
+}
+
+/**
+ * plain --
+ *      Write text that has no newline in it. Leading blanks are
+ *      dropped outside displays (they would break the line) and the
+ *      dashes of bold flags are made real minus signs.
+ */
+static void plain(struct emitter *em, const char *p, size_t n) {
+  const char *end = p + n, *run;
+
+  if (em->bol && !em->lit)
+    while (p < end && (*p == ' ' || *p == '\t'))
+      p++;
+  while (p < end) {
+    for (run = p; p < end && *p != '\0' && (*p != '-' || em->font != FONT_B); p++)
+      ;
+    put(em, run, (size_t)(p - run));
+    if (p == end)
+      break;
+    if (*p == '-')
+      PUTLIT(em, "\\-");
+    p++;                                                /* NULs are dropped. */
+  }
+}
+
+/**
+ * endline --
+ *      Finish the current output line.
+ */
+static void endline(struct emitter *em) {
+  size_t n, len;
+
+  switch (em->line) {
+    case LINE_DATE:
+      em->datelen = capture(em->date, 0, sizeof(em->date), em->cap, em->caplen);
+      break;
+    case LINE_TITLE:
+      for (n = 0; n < em->caplen && em->cap[n] == ' '; n++)
+        ;
+      MACRO(em, ".TH ");
+      putsanitized(em, em->cap + n, trimlen(em->cap + n, em->caplen - n));
+      for (n = 0; n < em->datelen && em->date[n] == ' '; n++)
+        ;
+      if ((len = trimlen(em->date, em->datelen)) > n) {
+        PUTLIT(em, " \"");
+        put(em, em->date + n, len - n);
+        PUTLIT(em, "\"");
+      }
+      endmacro(em);
+      break;
+    case LINE_AUTHOR:
+      MACRO(em, ".\\\" Author:");
+      plain(em, em->cap, trimlen(em->cap, em->caplen));
+      endmacro(em);
+      break;
+    case LINE_SYNOPSIS:
+      setfont(em, FONT_R);
+      PUTLIT(em, "]\n");
+      break;
+    default:
+      setfont(em, FONT_R);
+      if (!em->bol)                                     /* A blank line would be a break. */
+        PUTLIT(em, "\n");
+      break;
+  }
+  em->line = LINE_TEXT;
+  em->caplen = 0;
+}
+
+/**
+ * text --
+ *      Write text, a line at a time.
+ */
+static void text(struct emitter *em, const char *p, size_t n) {
+  const char *end = p + n, *nl;
+  size_t len;
+
+  while (p < end) {
+    nl = memchr(p, '\n', (size_t)(end - p));
+    len = (size_t)((nl ? nl : end) - p);
+    switch (em->line) {
+      case LINE_DATE:
+      case LINE_TITLE:
+      case LINE_AUTHOR:
+        em->caplen = capture(em->cap, em->caplen, sizeof(em->cap), p, len);
+        break;
+      case LINE_NAME:
+        em->namelen = capture(em->name, em->namelen, sizeof(em->name), p, len);
+        /* FALLTHROUGH */
+      default:
+        plain(em, p, len);
+        break;
+    }
+    if (nl == NULL)
+      break;
+    endline(em);
+    p = nl + 1;
+  }
+}
+
+/**
+ * macroline --
+ *      Write a macro line carrying the token's text.
+ */
+static void macroline(struct emitter *em, const char *m, size_t mlen, const struct token *t) {
+  if (!em->bol)
+    endline(em);
+  put(em, m, mlen);
+  plain(em, t->str, t->len);
+  endmacro(em);
+}
+
+/**
+ * xref --
+ *      Write a `page(n)` reference as `.BR page (n)`.
+ */
+static void xref(struct emitter *em, const struct token *t) {
+  const char *open = memchr(t->str, '(', t->len), *sec;
+  size_t seclen;
+
+  if (!em->bol)
+    endline(em);
+  if (open == NULL) {
+    PUTLIT(em, ".B ");
+    putsanitized(em, t->str, t->len);
+    return;
+  }
+  sec = open + 1;
+  seclen = (size_t)(t->str + t->len - sec);
+  if (seclen > 0 && sec[seclen - 1] == ')')
+    seclen--;
+  PUTLIT(em, ".BR ");
+  putsanitized(em, t->str, (size_t)(open - t->str));
+  PUTLIT(em, " (");
+  putsanitized(em, sec, seclen);
+  PUTLIT(em, ")");
+}
+
+/**
+ * emit_man --
+ *      Write `n` tokens as man(7).
+ * Parameters:
+ *  em  -   Emitter
+ *  tok -   Tokens to write
+ *  n   -   Number of tokens
+ */
+static void emit_man(struct emitter *em, const struct token *tok, size_t n) {
+  const struct token *t, *end = tok + n;
+  char num[32];
+
+  for (t = tok; t < end; t++) {
+    switch (t->kind) {
+      case TK_TEXT:
+        text(em, t->str, t->len);
+        break;
+      case TK_SECTION:
+      case TK_SUBSECTION:
+        em->para = 0;                                   /* A heading is a break of its own, */
+        if (!em->bol)
+          endline(em);
+        if (t->kind == TK_SECTION)
+          PUTLIT(em, ".SH ");
+        else
+          PUTLIT(em, ".SS ");
+        putsanitized(em, t->str, trimlen(t->str, t->len));
+        endmacro(em);
+        em->para = 2;                                   /*   and so is what follows it. */
+        break;
+      case TK_PARA:
+        if (em->lit)
+          MACRO(em, "\n");
+        else if (em->para == 0)
+          em->para = 1;                                 /* Written by `put` if anything follows. */
+        break;
+      case TK_LISTBEGIN:
+        em->list = (unsigned char)(t->flags & ~TOK_NL);
+        em->itemno = 0;
+        break;
+      case TK_ITEM:
+        if (em->list == LIST_ENUM) {
+          snprintf(num, sizeof(num), ".IP %u. 4\n", ++em->itemno);
+          macro(em, num, strlen(num));
+        } else if (em->list == LIST_DASH) {
+          MACRO(em, ".IP \\- 4\n");
+        } else {
+          MACRO(em, ".TP\n");
+          em->line = LINE_TAG;
+        }
+        break;
+      case TK_LISTEND:
+        em->list = LIST_NONE;
+        em->para = 1;
+        break;
+      case TK_FLAG:
+        space(em);
+        setfont(em, FONT_B);
+        PUTLIT(em, "\\-");
+        break;
+      case TK_ARG:
+        if (t->flags & ARG_SPACED)
+          space(em);
+        else
+          setfont(em, FONT_R);
+        setfont(em, FONT_I);
+        break;
+      case TK_OPTIONAL:
+        if (!em->bol)
+          endline(em);
+        PUTLIT(em, "[");
+        em->line = LINE_SYNOPSIS;
+        break;
+      case TK_LITBEGIN:
+        MACRO(em, ".RS 4\n.nf\n");
+        em->lit = 1;
+        break;
+      case TK_LITEND:
+        MACRO(em, ".fi\n.RE\n");
+        em->lit = 0;
+        break;
+      case TK_NAME:
+        if (!em->bol)
+          endline(em);
+        em->line = LINE_NAME;
+        em->namelen = 0;
+        break;
+      case TK_DESC:
+        em->line = LINE_TEXT;
+        PUTLIT(em, "\\-");
+        break;
+      case TK_NAMEREF:
+        if (!em->bol)
+          endline(em);
+        PUTLIT(em, ".B ");
+        put(em, em->name, trimlen(em->name, em->namelen));
+        endmacro(em);
+        break;
+      case TK_BOLD:
+      case TK_MODIFIER:
+      case TK_LITERAL:
+        macroline(em, ".B ", 3, t);
+        break;
+      case TK_ITALIC:
+      case TK_SECREF:
+        macroline(em, ".I ", 3, t);
+        break;
+      case TK_XREF:
+        xref(em, t);
+        break;
+      case TK_MACRO:
+        switch (em->markup->macro[t->flags & ~TOK_NL].font) {
+          case FONT_B:
+            macroline(em, ".B ", 3, t);
+            break;
+          case FONT_I:
+            macroline(em, ".I ", 3, t);
+            break;
+          default:
+            macroline(em, "\\&", 2, t);                   /* The text may start with a dot. */
+            break;
+        }
+        break;
+      case TK_AUTHOR:
+        em->line = LINE_AUTHOR;
+        break;
+      case TK_DATE:
+        em->line = LINE_DATE;
+        break;
+      case TK_TITLE:
+        em->line = LINE_TITLE;
+        break;
+      case TK_TITLEEND:
+        if (em->line == LINE_TITLE)                     /* A `title:` line with no newline. */
+          endline(em);
+        break;
+    }
+    if (t->flags & TOK_NL)
+      text(em, "\n", 1);
+  }
+}
+
+/**
+ * end_man --
+ *      Finish the page: end a last line that has no newline.
+ */
+static void end_man(struct emitter *em) {
+  if (!em->bol || em->line != LINE_TEXT)
+    endline(em);
+} ///:~
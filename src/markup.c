@@ -0,0 +1,266 @@
+//===---------------------------------------------------*- C -*---===
+//: markup.c
+//
+// DESCRIPTION
+// Builds the inline markup tables of libmd2mdoc (see markup.h): the
+// built-in one, and those read from a mapping file. A mapping file
+// has one marker per line:
+//
+//      # marker  macro  [font]
+//      %         Ev
+//      !         Pa     italic
+//      ^         none
+//
+// `%HOME%` then becomes `.Ev HOME` (and HOME in roman in man and
+// HTML), `!/etc/rc!` becomes `.Pa /etc/rc`, and `^` is plain text.
+// The font is bold, italic or roman (the default). Lines starting
+// with `#` and blank lines are skipped. A marker is one punctuation
+// character other than `\`, `.` and `'`, which roff reads itself; a
+// line for a built-in marker replaces it.
+//===-------------------------------------------------------------===
+
+#include "markup.h"
+#include "ir.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+//-------------------------------------------------------------------
+// Constants Declarations
+//-------------------------------------------------------------------
+#define MACRODELIMS ",) \n;:"                           /* Ends of a macro's text, besides its marker. */
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+/*
+ * entry --
+ *      What one byte stands for while a table is being read.
+ */
+struct entry {
+  unsigned char action;                                 /* MK_*; MK_MACRO for any macro. */
+  unsigned char font;
+  char name[MACROMAX];
+};
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static void defaults(struct entry *ent);
+static void compile(struct md2mdoc_markup *m, const struct entry *ent);
+static int parseline(struct entry *ent, const char *p, const char *end, unsigned int *nmarkers);
+static int macroname(const char *p, size_t n);
+static size_t field(const char **p, const char *end, const char **f);
+
+//-------------------------------------------------------------------
+// Global Variables
+//-------------------------------------------------------------------
+static const struct {                                   /* The markers md2mdoc has always had. */
+  char c;
+  unsigned char action;
+} builtin[] = {
+  { '@', MK_MODIFIER }, { '$', MK_REFERENCE }, { '*', MK_BOLD }, { '_', MK_ITALIC },
+  { '`', MK_LITERAL }, { '^', MK_XREF }, { '\\', MK_ESCAPE },
+};
+
+/**
+ * markup_builtin --
+ *      Fill in the built-in markup table.
+ */
+void markup_builtin(struct md2mdoc_markup *m) {
+  struct entry ent[256];
+
+  defaults(ent);
+  compile(m, ent);
+}
+
+/**
+ * md2mdoc_markup_new --
+ *      Compile a mapping file on top of the built-in markers.
+ * Parameters:
+ *  text    -   the mapping file
+ *  len     -   its length
+ *  line    -   set to the number of a line in error, or 0
+ *
+ * Returns:
+ *  The table (release with `md2mdoc_markup_free`), or NULL with errno
+ *  set: EINVAL for a line that is not a mapping, E2BIG for a line that
+ *  makes too many markers, ENOMEM.
+ */
+md2mdoc_markup *md2mdoc_markup_new(const char *text, size_t len, unsigned int *line) {
+  struct entry ent[256];
+  struct md2mdoc_markup *m;
+  const char *p = text, *end = text + len, *nl;
+  unsigned int nmarkers = sizeof(builtin) / sizeof(builtin[0]);
+
+  *line = 0;
+  defaults(ent);
+  while (p < end) {
+    (*line)++;
+    if ((nl = memchr(p, '\n', (size_t)(end - p))) == NULL)
+      nl = end;
+    if (parseline(ent, p, nl, &nmarkers) == -1)
+      return NULL;
+    p = nl + 1;
+  }
+  *line = 0;
+
+  if ((m = malloc(sizeof(*m))) == NULL)
+    return NULL;
+  compile(m, ent);
+  return m;
+}
+
+/**
+ * md2mdoc_markup_free --
+ *      Release a table made by `md2mdoc_markup_new`.
+ */
+void md2mdoc_markup_free(md2mdoc_markup *m) {
+  free(m);
+}
+
+/**
+ * defaults --
+ *      Set every byte to what it means in the built-in table.
+ */
+static void defaults(struct entry *ent) {
+  size_t i;
+
+  memset(ent, 0, 256 * sizeof(*ent));
+  for (i = 0; i < sizeof(builtin) / sizeof(builtin[0]); i++)
+    ent[(unsigned char)builtin[i].c].action = builtin[i].action;
+}
+
+/**
+ * compile --
+ *      Turn the entries of every byte into a table, numbering the
+ *      macros in byte order.
+ */
+static void compile(struct md2mdoc_markup *m, const struct entry *ent) {
+  char chars[MARKUPMAX + 1], delims[sizeof(MACRODELIMS) + 1];
+  struct macro *mac;
+  size_t n = 0;
+  int c;
+
+  memset(m->action, MK_TEXT, sizeof(m->action));
+  m->nmacros = 0;
+  for (c = 1; c < 256; c++) {
+    if (ent[c].action == MK_TEXT)
+      continue;
+    chars[n++] = (char)c;
+    if (ent[c].action != MK_MACRO) {
+      m->action[c] = ent[c].action;
+      continue;
+    }
+    mac = &m->macro[m->nmacros];
+    memcpy(mac->name, ent[c].name, sizeof(mac->name));
+    mac->font = ent[c].font;
+    delims[0] = (char)c;
+    memcpy(delims + 1, MACRODELIMS, sizeof(MACRODELIMS));
+    scanset_init(&mac->delims, delims);
+    m->action[c] = (unsigned char)(MK_MACRO + m->nmacros++);
+  }
+  chars[n] = '\0';
+  scanset_init(&m->markers, chars);
+}
+
+/**
+ * parseline --
+ *      Apply one line of a mapping file.
+ * Parameters:
+ *  ent      -   entries of every byte
+ *  p        -   start of the line
+ *  end      -   its end (the newline)
+ *  nmarkers -   markers so far, kept up to date
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+static int parseline(struct entry *ent, const char *p, const char *end, unsigned int *nmarkers) {
+  const char *mark, *name, *font;
+  size_t marklen, namelen, fontlen;
+  unsigned char c;
+  struct entry e;
+
+  if ((marklen = field(&p, end, &mark)) == 0 || *mark == '#')
+    return 0;                                           /* Blank line or comment. */
+  namelen = field(&p, end, &name);
+  fontlen = field(&p, end, &font);
+  c = (unsigned char)*mark;
+  if (marklen != 1 || namelen == 0 || field(&p, end, &mark) != 0 ||
+      c <= ' ' || c >= 0x7f || (c >= '0' && c <= '9') ||
+      (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+      c == '\\' || c == '.' || c == '\'') {             /* Significant to roff. */
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(&e, 0, sizeof(e));
+  if (namelen == 4 && memcmp(name, "none", 4) == 0 && fontlen == 0) {
+    e.action = MK_TEXT;
+  } else {
+    if (*name == '.') {                                 /* `.Ev` or `Ev`. */
+      name++;
+      namelen--;
+    }
+    if (namelen == 0 || namelen >= MACROMAX || !macroname(name, namelen)) {
+      errno = EINVAL;
+      return -1;
+    }
+    e.action = MK_MACRO;
+    memcpy(e.name, name, namelen);
+    if (fontlen == 0 || (fontlen == 5 && memcmp(font, "roman", 5) == 0))
+      e.font = FONT_R;
+    else if (fontlen == 4 && memcmp(font, "bold", 4) == 0)
+      e.font = FONT_B;
+    else if (fontlen == 6 && memcmp(font, "italic", 6) == 0)
+      e.font = FONT_I;
+    else {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  if (ent[c].action == MK_TEXT && e.action != MK_TEXT && ++*nmarkers > MARKUPMAX) {
+    errno = E2BIG;
+    return -1;
+  }
+  if (ent[c].action != MK_TEXT && e.action == MK_TEXT)
+    --*nmarkers;
+  ent[c] = e;
+  return 0;
+}
+
+/**
+ * macroname --
+ *      Whether `n` bytes are a macro name: a letter, then letters or
+ *      digits.
+ */
+static int macroname(const char *p, size_t n) {
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    if (!((p[i] >= 'A' && p[i] <= 'Z') || (p[i] >= 'a' && p[i] <= 'z') || (i > 0 && p[i] >= '0' && p[i] <= '9')))
+      return 0;
+  return 1;
+}
+
+/**
+ * field --
+ *      Find the next blank separated field of a line.
+ *
+ * Returns:
+ *  Its length (0 at the end of the line), with `*f` at its start.
+ */
+static size_t field(const char **p, const char *end, const char **f) {
+  const char *s = *p;
+
+  while (s < end && (*s == ' ' || *s == '\t' || *s == '\r'))
+    s++;
+  *f = s;
+  while (s < end && *s != ' ' && *s != '\t' && *s != '\r')
+    s++;
+  *p = s;
+  return (size_t)(s - *f);
+} ///:~
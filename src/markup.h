@@ -0,0 +1,67 @@
+//===---------------------------------------------------*- C -*---===
+//: markup.h
+//
+// DESCRIPTION
+// Inline markup table of libmd2mdoc: which bytes of a line start a
+// marker and what each one stands for. The built-in table holds the
+// markers md2mdoc has always understood; a mapping file (see
+// `md2mdoc_markup_new`) starts from it and adds or replaces markers
+// that stand for an mdoc macro, e.g. `%HOME%` for `.Ev HOME`.
+//
+// The table is compiled to a byte indexed array, so the parser finds
+// what a byte means with one lookup however many markers there are,
+// and to the set of marker bytes its search for the next one uses.
+//===-------------------------------------------------------------===
+#ifndef MD2MDOC_MARKUP_H
+#define MD2MDOC_MARKUP_H
+
+#include "md2mdoc.h"
+#include "scan.h"
+
+//-------------------------------------------------------------------
+// Constants Declarations
+//-------------------------------------------------------------------
+#define MK_TEXT      0                                  /* `action`: not a marker, */
+#define MK_MODIFIER  1                                  /*   @modifier */
+#define MK_REFERENCE 2                                  /*   $name or $section */
+#define MK_BOLD      3                                  /*   *bold* */
+#define MK_ITALIC    4                                  /*   _italic_ */
+#define MK_LITERAL   5                                  /*   `literal` */
+#define MK_XREF      6                                  /*   ^page(n)^ */
+#define MK_ESCAPE    7                                  /*   \x\ */
+#define MK_MACRO     8                                  /*   or MK_MACRO + n: `macro[n]`. */
+
+#define MARKUPMAX (SCANSET_MAX - 1)                     /* Most markers (NUL takes a place in the set). */
+#define MACROMAX 8                                      /* Room for a macro name and its NUL. */
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+/*
+ * macro --
+ *      A marker that stands for an mdoc macro. man and HTML have no
+ *      such macros, and write the text in `font` instead.
+ */
+struct macro {
+  char name[MACROMAX];                                  /* Without the dot. */
+  unsigned char font;                                   /* FONT_* (ir.h). */
+  struct scanset delims;                                /* Ends of its text. */
+};
+
+/*
+ * md2mdoc_markup --
+ *      A compiled markup table.
+ */
+struct md2mdoc_markup {
+  unsigned char action[256];                            /* MK_* of every byte. */
+  struct scanset markers;                               /* The bytes whose action is not MK_TEXT. */
+  unsigned int nmacros;                                 /* Entries used in `macro`. */
+  struct macro macro[MARKUPMAX];
+};
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+void markup_builtin(struct md2mdoc_markup *m);          /* Fill in the built-in table. */
+
+#endif /* MD2MDOC_MARKUP_H */
@@ -0,0 +1,2799 @@
+//===---------------------------------------------------*- C -*---===
+//: md2mdoc.c
+//
+// DESCRIPTION
+// The converter behind md2mdoc, built as libmd2mdoc. Markdown is read
+// one line at a time and parsed into tokens (see ir.h), which an
+// emitter (mdoc.c) writes out through a sink. All of the state for a
+// document lives in its `md2mdoc_ctx`.
+//
+// A large document may be parsed on several threads: it is cut into
+// parts at `# ` headings and each part is parsed by a context of its
+// own, on the guess that the part starts in the state of a fresh
+// document. The parts are then checked in order; a part whose
+// predecessor did not end in that state (an open list, code block or
+// comment runs past the heading) is parsed again from the state it
+// really starts in. The tokens of the parts go through the emitters
+// in order, so the output is that of a serial conversion.
+//
+// An incremental context (`md2mdoc_ctx_incremental`) cuts documents at
+// the same headings and keeps, for each section of the last one it
+// converted, its tokens and what each output made of them. A section
+// of the next document with the same text, reached in the same parser
+// state, takes over those tokens instead of being parsed again; the
+// rest are parsed as usual. man and html carry state from one token to
+// the next, so the bytes kept are reused only by an emitter in the
+// state it was in when it wrote them, and the tokens are emitted again
+// otherwise. Either way the output is that of a full conversion.
+//
+// KEY:
+// ------------------------------------------------------------------
+// #           ->  .Sh     : section headers
+// ##          ->  .Ss     : sub section
+// blank line  ->  .Pp     : Blank Line
+// $name       ->  .Nm     : Project Name
+// @string     ->  .Cm     : Command Modifier
+// -<char>     ->  .It Fl  : List element
+// -\n         ->  .El     : A single dash is assumed to be a `list end`.
+// ~ <char>    ->  .It\n   : List element
+// ~\n         ->  .El     : An alternate `list end` character.
+// 1. ... 10.  ->  .It     : An enumerated list element.
+// <           ->  .nf     : Start of a `no format` block.
+// >           ->  .fi     : End of a `no format` block.
+// ```         ->  .nf     : Start/End of a `no format` block.
+// *           ->  .Bf     : Bold
+// _           ->  .Em     : Italic
+// ^           ->  .Sx     : Reference
+// author:     ->  .Au     : Author
+// date:       ->  .Dd     : Date
+// title:      ->  .Dt .Os : Document title.
+// include:    ->          : The lines of another file (when enabled
+//                           with `md2mdoc_ctx_include`).
+// # NAME      ->          : md2mdoc will assume the next line will
+//                           be a name and a description. This should
+//                           be formatted as the example below.
+//  <!---
+//  your comment goes here
+//  and here
+//  -->
+//
+// Example:
+//      # NAME
+//      projectname -- This is a test
+//
+//      # SYNOPSYS
+//      projectname
+//      [-abc argument]
+//      variable
+//
+//      # OPTIONS
+//      -a
+//          a line for the `a` flag.
+//      -b
+//          a line for the `b` flag.
+//      ...
+//===-------------------------------------------------------------===
+
+#include "md2mdoc.h"
+#include "ir.h"
+#include "markup.h"
+#include "scan.h"
+#include "version.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+//-------------------------------------------------------------------
+// Constants Declarations
+//-------------------------------------------------------------------
+#define TRUE 1
+#define FALSE 0
+#define stripspaces()  while (str < end && ISSPACE(*str)) str++;
+#define stripnewline()  while (str < end && (*str == '\n' || *str != '\0')) str++;
+#define AT(p) ((p) < end ? *(p) : '\0')                 /* Read a line byte; reads past `end` give NUL. */
+
+#define CC_SPACE 0x01                                   /* Character classes kept in `chartab`; */
+#define CC_ALPHA 0x02                                   /*   isspace()/isalpha() of the "C" locale */
+#define ISSPACE(c) (chartab[(unsigned char)(c)] & CC_SPACE)
+#define ISALPHA(c) (chartab[(unsigned char)(c)] & CC_ALPHA)
+
+#define INBUFSIZE (64 * 1024)                           /* Initial window for streamed input. */
+#define LONGTOKEN 512                                   /* Size of the fixed token buffer of old. */
+#define INCLUDEDEPTH 8                                  /* Most `include:` files open one in another. */
+#define LINTLISTS 16                                    /* Open lists lint remembers the start of. */
+#define EMSTATE offsetof(struct emitter, out)           /* What an emitter carries from token to token. */
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+/*
+ * source --
+ *      A regular file mapped into memory.
+ */
+struct source {
+  const char *data;
+  size_t len;
+};
+
+/*
+ * part --
+ *      A piece of a document parsed on its own thread.
+ */
+struct part {
+  md2mdoc_ctx *ctx;                                     /* Holds the part's tokens once parsed. */
+  const char *start, *end;
+  struct md2mdoc_stats stats;
+  pthread_t tid;
+  int started;                                          /* Set if `tid` is running. */
+};
+
+/*
+ * linekind --
+ *      What `classify` found at the start of a line.
+ */
+enum linekind {
+  LK_TEXT,                                              /* None of the keywords below. */
+  LK_AUTHOR,                                            /* author: */
+  LK_DATE,                                              /* date: */
+  LK_TITLE,                                             /* title: */
+  LK_SUBSECTION,                                        /* "## " */
+  LK_SECTION,                                           /* "# " */
+  LK_COMMENTOPEN,                                       /* <!-- */
+  LK_COMMENTCLOSE,                                      /* --> */
+  LK_FENCE,                                             /* ``` */
+  LK_INCLUDE                                            /* include: */
+};
+
+/*
+ * keyword --
+ *      A line-leading keyword. `kwfirst` maps a first byte to the
+ *      keyword(s) starting with it; `next` chains the keywords that
+ *      share a first byte (0 ends the chain).
+ */
+struct keyword {
+  const char *lit;
+  unsigned char len;
+  unsigned char folded;                                 /* Compare with `cimemcmp` rather than memcmp. */
+  unsigned char kind;                                   /* An `enum linekind`. */
+  unsigned char next;                                   /* Index of the next candidate. */
+};
+
+/*
+ * whatis --
+ *      What a page says about itself, for whatis(1): the names and
+ *      description on its NAME line and the name on its `title:`
+ *      line (empty until those lines are seen).
+ */
+struct whatis {
+  char names[128];
+  char desc[256];
+  char title[64];
+  int named;                                            /* Set once a NAME line is seen, even an empty one. */
+};
+
+/*
+ * where --
+ *      A line of the document or of a file it includes, for lint.
+ */
+struct where {
+  const char *file;                                     /* NULL for the document. */
+  unsigned long line;
+};
+
+/*
+ * lint --
+ *      Where each block still open was opened, so a problem found at
+ *      the end of a document can be reported at the line to blame.
+ */
+struct lint {
+  md2mdoc_lint fn;                                      /* NULL when not linting. */
+  void *arg;
+  int flags;                                            /* MD2MDOC_LINT_*. */
+  struct where at;                                      /* The line being parsed. */
+  unsigned int lists;                                   /* Lists open. */
+  struct where listat[LINTLISTS];                       /* Where the outermost of them were opened. */
+  struct where codeat;                                  /* Where the open literal block, */
+  struct where commentat;                               /*   the open comment */
+  struct where nameat;                                  /*   and the last `# NAME` were. */
+};
+
+/*
+ * fragment --
+ *      A file named on an `include:` line. It is read and parsed once,
+ *      from the state a document starts in, and its tokens are copied
+ *      into every document that includes it in that state. A fragment
+ *      never changes once it is in the cache.
+ */
+struct fragment {
+  struct fragment *next;
+  char *path;                                           /* As resolved; the key. */
+  char *dir;                                            /* Where its own `include:` lines are resolved. */
+  char *text;                                           /* The file; tokens point into it. */
+  size_t len;
+  struct stat st;                                       /* The file as it was read. */
+  struct fragment **deps;                               /* Fragments it includes (in its tokens). */
+  size_t ndeps;
+  struct token *tok;
+  size_t ntok;
+  unsigned int codeblock;                               /* The parser state at its end. */
+  unsigned int optionslist;
+  unsigned int dashorenumlist;
+  unsigned int nameflag;
+  unsigned int commentflag;
+  unsigned int stripwhitespace;
+  unsigned int lists;                                   /* Lists it leaves open. */
+  unsigned int problems;                                /* What lint finds in it on its own. */
+  char section[16];                                     /* From a `title:` line in it, if any. */
+  struct whatis whatis;                                 /* From its NAME and `title:` lines, if any. */
+};
+
+/*
+ * pstate --
+ *      The state the parser carries from one line to the next. The
+ *      tokens of a piece of text depend only on the text and the state
+ *      it is parsed from.
+ */
+struct pstate {
+  unsigned int stripwhitespace;
+  unsigned int codeblock;
+  unsigned int optionslist;
+  unsigned int dashorenumlist;
+  unsigned int nameflag;
+  unsigned int commentflag;
+};
+
+/*
+ * emitted --
+ *      What one output made of a section, and the state of its emitter
+ *      before and after. Emitting the same tokens from the same state
+ *      writes the same bytes.
+ */
+struct emitted {
+  unsigned char at[EMSTATE];
+  unsigned char end[EMSTATE];
+  struct md2mdoc_buf out;
+  int ok;                                               /* Set if `out` holds all of it. */
+};
+
+/*
+ * chunk --
+ *      A section of the last document of an incremental context: the
+ *      text from a `# ` line up to the next one (or, first, the lines
+ *      before any).
+ */
+struct chunk {
+  size_t off;                                           /* Where it starts in `incr.text`. */
+  size_t len;
+  int reusable;                                         /* Its tokens are kept (no `include:`). */
+  int used;                                             /* Taken over by the next document. */
+  struct token *tok;                                    /* They point into `incr.text` or at */
+  size_t ntok;                                          /*   static strings. */
+  struct pstate at;                                     /* The state it was parsed from, */
+  struct pstate end;                                    /*   and the state it leaves. */
+  char section[16];
+  struct whatis whatis;
+  struct emitted em[MD2MDOC_NFORMATS];                  /* One per output. */
+};
+
+/*
+ * incr --
+ *      What an incremental context keeps of the last document it
+ *      converted.
+ */
+struct incr {
+  int on;                                               /* Set by `md2mdoc_ctx_incremental`. */
+  char *text;                                           /* A copy of the document. */
+  size_t textcap;
+  struct chunk *chunk;
+  size_t nchunk;
+  size_t chunkcap;
+  char *sparetext;                                      /* Those of the document before, reused */
+  size_t sparetextcap;                                  /*   rather than allocated afresh (large */
+  struct chunk *spare;                                  /*   blocks are mapped anew, and every */
+  size_t sparecap;                                      /*   page faulted in again). */
+  const md2mdoc_markup *markup;                         /* The markers its tokens were made with. */
+  md2mdoc_ctx *part;                                    /* Parses the sections that changed. */
+  struct emitter *scratch;                              /* Emits a section into its `emitted`. */
+};
+
+/*
+ * md2mdoc_frags --
+ *      Cache of fragments, shared by the contexts of a process.
+ */
+struct md2mdoc_frags {
+  struct fragment *list;
+  struct fragment *stale;                               /* Replaced, but tokens may point into them. */
+  pthread_mutex_t lock;
+};
+
+/*
+ * md2mdoc_ctx --
+ *      Per-document conversion state. Reset at the start of every
+ *      conversion so a context can be reused for many documents.
+ */
+struct md2mdoc_ctx {
+  unsigned int stripwhitespace;                         /* Used to pause/stop stripping whitespace */
+  unsigned int codeblock;                               /* Used for codeblocks. */
+  unsigned int optionslist;                             /* Used for option list blocks. */
+  unsigned int dashorenumlist;                          /* Used for enumeration or dash lists. */
+  unsigned int nameflag;                                /* Set when this program find the string: "# NAME". */
+  unsigned int commentflag;                             /* Used for comment blocks (HTML style <!-- comment --> */
+  char section[16];                                     /* Manual section taken from the `title:` line. */
+  struct whatis whatis;                                 /* Names and description of the page. */
+  struct ir ir;                                         /* Tokens of the lines not yet written. */
+  struct token *last;                                   /* Last token added (NULL after a flush). */
+  struct md2mdoc_stats *stats;                          /* Counters, or NULL when not counting. */
+  struct lint lint;
+  struct incr incr;
+  size_t flushat;                                       /* Tokens that make `parse` flush the IR. */
+  unsigned int nthreads;                                /* Threads a large input may be parsed on. */
+  const md2mdoc_markup *markup;                         /* What inline markers stand for. */
+  md2mdoc_frags *frags;                                 /* Fragment cache, or NULL: no `include:`. */
+  const char *incdir;                                   /* Directory `include:` paths are relative to. */
+  unsigned int incdepth;                                /* Fragments being parsed, one in another. */
+  struct fragment *loading;                             /* The fragment this context parses, or NULL. */
+  const char *incopen[INCLUDEDEPTH];                    /* Their paths, outermost first. */
+  int incerror;                                         /* errno of an `include:` that failed, or 0. */
+  char incfail[PATH_MAX];                               /* Its path. */
+  size_t nem;                                           /* Outputs of this conversion. */
+  struct emitter em[MD2MDOC_NFORMATS];
+};
+
+//-------------------------------------------------------------------
+// Global Variables
+//   Byte sets searched by processnested() and read_upto(); built once
+//   by initsets().
+//-------------------------------------------------------------------
+static pthread_once_t setsonce = PTHREAD_ONCE_INIT;
+static struct md2mdoc_markup builtin;                  /* The inline markers md2mdoc has always had. */
+static struct scanset modifierdelims;                   /* Ends of an `@modifier`. */
+static struct scanset referencedelims;                  /* Ends of a `$name` or `$section`. */
+static struct scanset bolddelims;                       /* Ends of a `*bold*`. */
+static struct scanset italicdelims;                     /* Ends of an `_italic_`. */
+static struct scanset literaldelims;                    /* Ends of a `` `literal` ``. */
+static struct scanset xrefdelims;                       /* Ends of a `^reference^`. */
+static unsigned char chartab[256];                      /* CC_* classes of every byte. */
+static const char newline[] = "\n";                     /* Text for newlines added to the output */
+static const char nul[1] = "";                          /*   and for NULs read past a line's end. */
+
+static const struct format *const formats[MD2MDOC_NFORMATS] = { /* Indexed by MD2MDOC_* format. */
+  [MD2MDOC_MDOC] = &fmt_mdoc,
+  [MD2MDOC_MAN] = &fmt_man,
+  [MD2MDOC_HTML] = &fmt_html,
+};
+
+static const struct keyword keywords[] = {
+  { NULL,      0, 0, LK_TEXT,         0 },              /* 0: no keyword */
+  { "author:", 7, 1, LK_AUTHOR,       0 },
+  { "date:",   5, 1, LK_DATE,         0 },
+  { "title:",  6, 1, LK_TITLE,        0 },
+  { "## ",     3, 0, LK_SUBSECTION,   5 },              /* try "## " before "# " */
+  { "# ",      2, 0, LK_SECTION,      0 },
+  { "<!--",    4, 1, LK_COMMENTOPEN,  0 },
+  { "-->",     3, 0, LK_COMMENTCLOSE, 0 },
+  { "```",     3, 1, LK_FENCE,        0 },
+  { "include:", 8, 1, LK_INCLUDE,     0 },
+};
+
+static const unsigned char kwfirst[256] = {             /* First byte -> index into `keywords`. */
+  ['a'] = 1, ['d'] = 2, ['t'] = 3, ['#'] = 4, ['<'] = 6, ['-'] = 7, ['`'] = 8, ['i'] = 9,
+};
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static void initsets(void);
+static int resetctx(md2mdoc_ctx *doc, const struct md2mdoc_output *outs, size_t nouts);
+static void processline(md2mdoc_ctx *doc, const char *str, const char *end); /* Process one line of text at a time
+                                                           from the  input file. */
+static void processnested(md2mdoc_ctx *doc, const char *str, const char *end);
+static void flushir(md2mdoc_ctx *doc);                  /* Write out the tokens collected so far. */
+static void parse(md2mdoc_ctx *doc, const char *pos, const char *end); /* Parse a run of lines. */
+static void parsecounted(md2mdoc_ctx *doc, const char *pos, const char *end);
+static void lintline(md2mdoc_ctx *doc, const char *str, const char *end); /* `processline`, checked. */
+static void lintinclude(md2mdoc_ctx *doc, const struct fragment *frag);
+static void lintend(md2mdoc_ctx *doc);                  /* Report (and close) what is left open. */
+static void report(const md2mdoc_ctx *doc, const struct where *w, const char *msg);
+static void countproblem(void *arg, const char *file, unsigned long line, const char *msg);
+static void nestedcounted(md2mdoc_ctx *doc, const char *str, const char *end);
+static void counttokens(struct md2mdoc_stats *st, const struct ir *ir);
+static int convertsplit(md2mdoc_ctx *doc, const char *in, const char *end); /* Parse on several threads. */
+static void *parsepart(void *arg);
+static int freshstate(const md2mdoc_ctx *doc);
+static void emitpart(md2mdoc_ctx *doc, md2mdoc_ctx *part);
+static int convertincr(md2mdoc_ctx *doc, const char *in, size_t len); /* Reuse unchanged sections. */
+static size_t cutchunk(const char *text, size_t off, size_t len);
+static const struct chunk *findchunk(struct incr *incr, const md2mdoc_markup *markup,
+                                     const char *p, const struct chunk *c, size_t *hint);
+static void takechunk(struct chunk *c, struct chunk *old, const char *from, const char *to);
+static void keepchunk(struct chunk *c, const md2mdoc_ctx *part);
+static void savepstate(const md2mdoc_ctx *doc, struct pstate *st);
+static void loadpstate(md2mdoc_ctx *doc, const struct pstate *st);
+static void emitchunk(md2mdoc_ctx *doc, struct chunk *c);
+static void dropincr(struct incr *incr);
+static void clearchunks(struct chunk *chunk, size_t n);
+static int hasprefix(const char *str, const char *end, const char *lit, size_t n);
+static void include(md2mdoc_ctx *doc, const char *str, const char *end); /* An `include:` line. */
+static struct fragment *getfragment(md2mdoc_ctx *doc, const char *path);
+static struct fragment *loadfragment(md2mdoc_ctx *doc, const char *path);
+static void freefragment(struct fragment *frag);
+static int fragfresh(const struct fragment *frag);     /* Do the files still match? */
+static int adddep(struct fragment *frag, struct fragment *dep);
+static inline unsigned long long nsnow(void);
+static int mapsource(int fd, struct source *src);       /* Map a regular file. */
+static int convertstream(md2mdoc_ctx *doc, int fd);     /* Convert a pipe as it is read. */
+static int finish(md2mdoc_ctx *doc);                    /* Write out what is left of a document. */
+static int nextline(const char **pos, const char *end, const char **line, size_t *len); /* Line iterator. */
+static void setsection(md2mdoc_ctx *doc, const char *str, const char *end);
+static void setnames(md2mdoc_ctx *doc, const char *str, const char *end);
+static void mergewhatis(struct whatis *dst, const struct whatis *src);
+static size_t trimmed(const char **p, const char *end);
+static void text(md2mdoc_ctx *doc, const char *p, size_t n); /* Add plain text to the IR. */
+static void rest(md2mdoc_ctx *doc, const char *str, const char *end);
+static int cimemcmp(const void *s1, const void *s2, size_t n); /* case independent memory regon compare */
+static enum linekind classify(const char *str, const char *end); /* Recognize a line-leading keyword. */
+//:~  static int read_until(const char **src, char delim, char *dst, size_t dstcap);
+static int read_upto(const char **src, const char *end, const struct scanset *delims, const char **tok, size_t *toklen, int eatfinalchar);
+static void skip_one_space_or_newline(const char **src, const char *end);
+
+/**
+ * md2mdoc_ctx_new --
+ *      Allocate a conversion context.
+ *
+ * Returns:
+ *  The new context, or NULL if memory could not be allocated.
+ */
+md2mdoc_ctx *md2mdoc_ctx_new(void) {
+  md2mdoc_ctx *ctx;
+
+  pthread_once(&setsonce, initsets);
+  if ((ctx = malloc(sizeof(*ctx))) == NULL)
+    return NULL;
+  memset(&ctx->ir, 0, sizeof(ctx->ir));
+  ctx->stats = NULL;
+  ctx->lint.fn = NULL;
+  memset(&ctx->incr, 0, sizeof(ctx->incr));
+  ctx->nthreads = 1;
+  ctx->markup = &builtin;
+  ctx->frags = NULL;
+  ctx->incdir = NULL;
+  ctx->loading = NULL;
+  resetctx(ctx, NULL, 0);
+  return ctx;
+}
+
+/**
+ * md2mdoc_ctx_free --
+ *      Release a context allocated with `md2mdoc_ctx_new`.
+ */
+void md2mdoc_ctx_free(md2mdoc_ctx *ctx) {
+  if (ctx == NULL)
+    return;
+  dropincr(&ctx->incr);
+  md2mdoc_ctx_free(ctx->incr.part);
+  free(ctx->incr.scratch);
+  ir_free(&ctx->ir);
+  free(ctx);
+}
+
+/**
+ * initsets --
+ *      Build the character class table and the marker and delimiter
+ *      sets, and pick the scanner for this processor.
+ */
+static void initsets(void) {
+  int c;
+
+  for (c = 0; c < 256; c++) {
+    if (c == ' ' || (c >= '\t' && c <= '\r'))
+      chartab[c] |= CC_SPACE;
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+      chartab[c] |= CC_ALPHA;
+  }
+
+  scan_init();
+  markup_builtin(&builtin);
+  scanset_init(&modifierdelims, " ,\n:;()");
+  scanset_init(&referencedelims, "'\") ,\n:;");
+  scanset_init(&bolddelims, "*,) \n;:");
+  scanset_init(&italicdelims, "_");
+  scanset_init(&literaldelims, "`\n");
+  scanset_init(&xrefdelims, "^ \n,.;:");
+}
+
+/**
+ * resetctx --
+ *      Reset a context to the state expected at the top of a file and
+ *      set up its outputs.
+ * Parameters:
+ *  doc     -   context to reset
+ *  outs    -   the outputs: a format and a sink for each
+ *  nouts   -   number of outputs
+ *
+ * Returns:
+ *  0 on success, -1 (errno EINVAL) if there are too many outputs or
+ *  a format is unknown.
+ */
+static int resetctx(md2mdoc_ctx *doc, const struct md2mdoc_output *outs, size_t nouts) {
+  size_t i;
+
+  doc->stripwhitespace = 1;
+  doc->codeblock = 0;
+  doc->optionslist = 0;
+  doc->dashorenumlist = 0;
+  doc->nameflag = 0;
+  doc->commentflag = 0;
+  doc->section[0] = '\0';
+  doc->whatis.names[0] = doc->whatis.desc[0] = doc->whatis.title[0] = '\0';
+  doc->whatis.named = 0;
+  doc->lint.at.file = NULL;
+  doc->lint.at.line = 0;
+  doc->lint.lists = 0;
+  ir_reset(&doc->ir);
+  doc->ir.error = 0;
+  doc->last = NULL;
+  doc->flushat = IRBLOCKSIZE;
+  doc->incdepth = 0;
+  doc->incerror = 0;
+  doc->incfail[0] = '\0';
+  doc->nem = 0;
+  if (nouts > MD2MDOC_NFORMATS) {
+    errno = EINVAL;
+    return -1;
+  }
+  for (i = 0; i < nouts; i++) {
+    if (outs[i].format < 0 || outs[i].format >= MD2MDOC_NFORMATS) {
+      errno = EINVAL;
+      return -1;
+    }
+    emitter_init(&doc->em[i], formats[outs[i].format], outs[i].sink, outs[i].arg);
+    doc->em[i].markup = doc->markup;
+    if (doc->em[i].fmt->begin != NULL)
+      doc->em[i].fmt->begin(&doc->em[i]);
+  }
+  doc->nem = nouts;
+  return 0;
+}
+
+/**
+ * md2mdoc_convert --
+ *      Convert one markdown document held in memory to mdoc. The input
+ *      does not need to be NUL terminated and is never modified.
+ * Parameters:
+ *  ctx     -   conversion context
+ *  in      -   markdown text
+ *  len     -   length of `in` in bytes
+ *  sink    -   receives the mdoc output
+ *  arg     -   argument passed to `sink`
+ *
+ * Returns:
+ *  0 on success, -1 if the sink reported an error or memory ran out.
+ */
+int md2mdoc_convert(md2mdoc_ctx *ctx, const char *in, size_t len,
+                    md2mdoc_sink sink, void *arg) {
+  struct md2mdoc_output out = { MD2MDOC_MDOC, sink, arg };
+
+  return md2mdoc_convert_to(ctx, in, len, &out, 1);
+}
+
+/**
+ * md2mdoc_convert_to --
+ *      Convert one markdown document held in memory to one or more
+ *      formats. The input is parsed once; every output is written
+ *      from the same tokens, each to its own sink.
+ * Parameters:
+ *  ctx     -   conversion context
+ *  in      -   markdown text
+ *  len     -   length of `in` in bytes
+ *  outs    -   the outputs (at most MD2MDOC_NFORMATS)
+ *  nouts   -   number of outputs
+ *
+ * Returns:
+ *  0 on success, -1 if a sink reported an error, memory ran out or
+ *  the outputs are not valid (errno EINVAL).
+ */
+int md2mdoc_convert_to(md2mdoc_ctx *ctx, const char *in, size_t len,
+                       const struct md2mdoc_output *outs, size_t nouts) {
+  if (resetctx(ctx, outs, nouts) == -1)
+    return -1;
+  if (ctx->stats != NULL)
+    ctx->stats->bytes_in += len;
+  if (ctx->incr.on && ctx->stats == NULL && ctx->lint.fn == NULL) { /* Counts and lint need every line. */
+    if (convertincr(ctx, in, len) == -1)
+      parse(ctx, in, in + len);
+  } else if (ctx->nthreads < 2 || len < MD2MDOC_SPLITMIN || ctx->lint.fn != NULL || /* Lint counts lines in order. */
+             convertsplit(ctx, in, in + len) == -1)
+    parse(ctx, in, in + len);
+  return finish(ctx);
+}
+
+/**
+ * finish --
+ *      Emit the remaining tokens of a document, end every output and
+ *      flush them all.
+ *
+ * Returns:
+ *  0 on success, -1 if a sink reported an error or the IR could
+ *  not be allocated (errno is ENOMEM).
+ */
+static int finish(md2mdoc_ctx *doc) {
+  int error, rv = 0;
+  unsigned long long t = 0;
+  size_t i;
+
+  if (doc->lint.fn != NULL)
+    lintend(doc);
+  error = doc->ir.error;
+  flushir(doc);
+  if (doc->stats != NULL)
+    t = nsnow();
+  for (i = 0; i < doc->nem; i++) {
+    if (doc->em[i].fmt->end != NULL)
+      doc->em[i].fmt->end(&doc->em[i]);
+    if (bufflush(&doc->em[i].out) == -1)
+      rv = -1;
+  }
+  if (doc->stats != NULL) {
+    doc->stats->emit_ns += nsnow() - t;
+    for (i = 0; i < doc->nem; i++)
+      doc->stats->bytes_out += doc->em[i].out.total;
+  }
+  if (rv == 0 && error) {
+    errno = ENOMEM;
+    rv = -1;
+  }
+  if (rv == 0 && doc->incerror != 0) {
+    errno = doc->incerror;
+    rv = -1;
+  }
+  return rv;
+}
+
+/**
+ * md2mdoc_convert_fd --
+ *      Convert everything that can be read from a file descriptor to
+ *      mdoc (see `md2mdoc_convert_fd_to`).
+ * Parameters:
+ *  ctx     -   conversion context
+ *  fd      -   file descriptor to read
+ *  sink    -   receives the mdoc output
+ *  arg     -   argument passed to `sink`
+ *
+ * Returns:
+ *  0 on success, -1 on a read or sink error (errno set for read
+ *  errors).
+ */
+int md2mdoc_convert_fd(md2mdoc_ctx *ctx, int fd, md2mdoc_sink sink, void *arg) {
+  struct md2mdoc_output out = { MD2MDOC_MDOC, sink, arg };
+
+  return md2mdoc_convert_fd_to(ctx, fd, &out, 1);
+}
+
+/**
+ * md2mdoc_convert_fd_to --
+ *      Convert everything that can be read from a file descriptor to
+ *      one or more formats. Regular files are mapped; anything else is
+ *      converted as it is read, a line at a time, so a pipe of any
+ *      size is handled in memory bounded by its longest line.
+ * Parameters:
+ *  ctx     -   conversion context
+ *  fd      -   file descriptor to read
+ *  outs    -   the outputs (at most MD2MDOC_NFORMATS)
+ *  nouts   -   number of outputs
+ *
+ * Returns:
+ *  0 on success, -1 on a read or sink error or invalid outputs
+ *  (errno set for read errors and EINVAL).
+ */
+int md2mdoc_convert_fd_to(md2mdoc_ctx *ctx, int fd,
+                          const struct md2mdoc_output *outs, size_t nouts) {
+  struct source src;
+  unsigned long long t = 0;
+  int rv;
+
+  if (ctx->stats != NULL)
+    t = nsnow();
+  rv = mapsource(fd, &src);
+  if (ctx->stats != NULL)
+    ctx->stats->read_ns += nsnow() - t;
+  if (rv == -1) {
+    if (resetctx(ctx, outs, nouts) == -1)
+      return -1;
+    rv = convertstream(ctx, fd);
+    return finish(ctx) == -1 ? -1 : rv;
+  }
+  rv = md2mdoc_convert_to(ctx, src.data, src.len, outs, nouts);
+  munmap((void *)src.data, src.len);
+  return rv;
+}
+
+/**
+ * md2mdoc_format --
+ *      Look up an output format by name ("mdoc", "man" or "html").
+ *
+ * Returns:
+ *  The MD2MDOC_* format, or -1 if there is no such format.
+ */
+int md2mdoc_format(const char *name) {
+  int i;
+
+  for (i = 0; i < MD2MDOC_NFORMATS; i++)
+    if (strcmp(formats[i]->name, name) == 0)
+      return i;
+  return -1;
+}
+
+/**
+ * md2mdoc_format_name --
+ *      The name of an output format.
+ */
+const char *md2mdoc_format_name(int format) {
+  return format >= 0 && format < MD2MDOC_NFORMATS ? formats[format]->name : NULL;
+}
+
+/**
+ * md2mdoc_ctx_stats --
+ *      Start counting what the context does into `stats`, which must
+ *      stay valid until counting is stopped with NULL. Nothing is
+ *      counted, or timed, while no structure is given.
+ */
+void md2mdoc_ctx_stats(md2mdoc_ctx *ctx, struct md2mdoc_stats *stats) {
+  ctx->stats = stats;
+}
+
+/**
+ * md2mdoc_ctx_lint --
+ *      Check the structure of the documents converted with the context
+ *      as they are parsed: lists and literal blocks left open or closed
+ *      twice, comments left open and empty names. A large document is
+ *      then parsed on one thread.
+ * Parameters:
+ *  ctx     -   conversion context
+ *  fn      -   called with each problem, or NULL to stop checking
+ *  arg     -   passed to `fn`
+ *  flags   -   MD2MDOC_LINT_CLOSE to also end the lists and literal
+ *              block left open at the end of a document
+ */
+void md2mdoc_ctx_lint(md2mdoc_ctx *ctx, md2mdoc_lint fn, void *arg, int flags) {
+  ctx->lint.fn = fn;
+  ctx->lint.arg = arg;
+  ctx->lint.flags = flags;
+}
+
+/**
+ * md2mdoc_ctx_threads --
+ *      Let the context parse a large document on up to `n` threads
+ *      (see the description above). The output does not change.
+ */
+void md2mdoc_ctx_threads(md2mdoc_ctx *ctx, unsigned int n) {
+  ctx->nthreads = n > 0 ? n : 1;
+}
+
+/**
+ * md2mdoc_ctx_incremental --
+ *      Keep each section of the last document converted, parsed and
+ *      emitted, so a document converted next parses and emits only the
+ *      sections that changed (see the description above): for --watch
+ *      and servers, which see one document over and over with small
+ *      edits. The output does not change. An incremental context
+ *      parses on one thread, and counting or linting turns it off.
+ *      Turning it off releases what was kept.
+ */
+void md2mdoc_ctx_incremental(md2mdoc_ctx *ctx, int on) {
+  ctx->incr.on = on;
+  if (!on)
+    dropincr(&ctx->incr);
+}
+
+/**
+ * md2mdoc_ctx_markup --
+ *      Convert with the inline markers of `markup` (from
+ *      `md2mdoc_markup_new`, and not freed while in use), or with the
+ *      built-in ones if it is NULL. Contexts sharing a fragment cache
+ *      must use the same markers.
+ */
+void md2mdoc_ctx_markup(md2mdoc_ctx *ctx, const md2mdoc_markup *markup) {
+  ctx->markup = markup != NULL ? markup : &builtin;
+}
+
+/**
+ * md2mdoc_frags_new --
+ *      Allocate an empty fragment cache.
+ *
+ * Returns:
+ *  The cache, or NULL if memory could not be allocated.
+ */
+md2mdoc_frags *md2mdoc_frags_new(void) {
+  md2mdoc_frags *frags;
+
+  if ((frags = malloc(sizeof(*frags))) == NULL)
+    return NULL;
+  frags->list = NULL;
+  frags->stale = NULL;
+  pthread_mutex_init(&frags->lock, NULL);
+  return frags;
+}
+
+/**
+ * md2mdoc_frags_free --
+ *      Release a fragment cache. No conversion may be using it.
+ */
+void md2mdoc_frags_free(md2mdoc_frags *frags) {
+  struct fragment *frag;
+
+  if (frags == NULL)
+    return;
+  while ((frag = frags->list) != NULL) {
+    frags->list = frag->next;
+    freefragment(frag);
+  }
+  while ((frag = frags->stale) != NULL) {
+    frags->stale = frag->next;
+    freefragment(frag);
+  }
+  pthread_mutex_destroy(&frags->lock);
+  free(frags);
+}
+
+/**
+ * md2mdoc_frags_each --
+ *      Call `fn` with the path of every file in a fragment cache, as
+ *      resolved from the `include:` line that read it: for --watch,
+ *      which watches them too. No conversion may be using the cache.
+ * Parameters:
+ *  frags   -   the cache
+ *  fn      -   called once for each path
+ *  arg     -   passed on to `fn`
+ */
+void md2mdoc_frags_each(md2mdoc_frags *frags, void (*fn)(void *arg, const char *path), void *arg) {
+  const struct fragment *frag;
+
+  for (frag = frags->list; frag != NULL; frag = frag->next)
+    fn(arg, frag->path);
+}
+
+/**
+ * md2mdoc_ctx_include --
+ *      Let the documents converted with `ctx` include other files with
+ *      `include: path` lines. A relative path is taken from `dir` (the
+ *      current directory if NULL), or from the directory of the file
+ *      holding the line when that is itself included. The string is
+ *      not copied. Each file is read and parsed once per cache, which
+ *      any number of contexts (and threads) may share, and again only
+ *      when it (or a file it includes) has changed since: a long lived
+ *      cache stays current.
+ * Parameters:
+ *  ctx     -   the context
+ *  frags   -   fragment cache; NULL turns `include:` lines back into text
+ *  dir     -   directory of the document being converted, or NULL
+ */
+void md2mdoc_ctx_include(md2mdoc_ctx *ctx, md2mdoc_frags *frags, const char *dir) {
+  ctx->frags = frags;
+  ctx->incdir = dir;
+}
+
+/**
+ * md2mdoc_include_failed --
+ *      The file on the `include:` line that made the last conversion
+ *      fail (the error is in errno), or NULL if none did.
+ */
+const char *md2mdoc_include_failed(const md2mdoc_ctx *ctx) {
+  return ctx->incerror != 0 ? ctx->incfail : NULL;
+}
+
+/**
+ * md2mdoc_has_include --
+ *      Check a document (or a section of one) for `include:` lines. The
+ *      file named may change without the text changing, so a section
+ *      holding one is always parsed again, and a page holding one should
+ *      not be cached on its text alone. A line in a code block or a
+ *      comment counts too, so this may say yes where no file would be
+ *      included, but never the other way round.
+ * Parameters:
+ *  p       -   the text
+ *  len     -   its length
+ *
+ * Returns:
+ *  1 if a line starts with `include:`, 0 otherwise
+ */
+int md2mdoc_has_include(const char *p, size_t len) {
+  const char *end = p + len;
+
+  for (; p < end; p++) {
+    while (p < end && (*p == ' ' || *p == '\t'))
+      p++;
+    if (hasprefix(p, end, "include:", 8))               /* Looser than `classify`, to be safe. */
+      return 1;
+    if ((p = memchr(p, '\n', (size_t)(end - p))) == NULL)
+      break;
+  }
+  return 0;
+}
+
+/**
+ * md2mdoc_section --
+ *      The manual section named on the `title:` line of the document
+ *      converted last (an empty string if there was none).
+ */
+const char *md2mdoc_section(const md2mdoc_ctx *ctx) {
+  return ctx->section;
+}
+
+/**
+ * md2mdoc_names --
+ *      The names on the line after `# NAME` (everything before its
+ *      `--`) of the document converted last, or an empty string.
+ */
+const char *md2mdoc_names(const md2mdoc_ctx *ctx) {
+  return ctx->whatis.names;
+}
+
+/**
+ * md2mdoc_description --
+ *      The description on that line (after the `--`), or an empty
+ *      string.
+ */
+const char *md2mdoc_description(const md2mdoc_ctx *ctx) {
+  return ctx->whatis.desc;
+}
+
+/**
+ * md2mdoc_title --
+ *      The words of the `title:` line before the section, or an empty
+ *      string.
+ */
+const char *md2mdoc_title(const md2mdoc_ctx *ctx) {
+  return ctx->whatis.title;
+}
+
+/**
+ * md2mdoc_version --
+ *      The version string of the library.
+ */
+const char *md2mdoc_version(void) {
+  return program_version;
+}
+
+/**
+ * md2mdoc_file_sink --
+ *      Sink writing to a stdio stream.
+ * Parameters:
+ *  arg     -   the stream (FILE *)
+ *  buf     -   bytes to write
+ *  len     -   number of bytes
+ */
+int md2mdoc_file_sink(void *arg, const char *buf, size_t len) {
+  return fwrite(buf, 1, len, (FILE *)arg) == len ? 0 : -1;
+}
+
+/**
+ * md2mdoc_fd_sink --
+ *      Sink writing to a file descriptor. Output made with this sink
+ *      is written with writev(2), long runs of text straight from the
+ *      input rather than copied (see ir.h).
+ * Parameters:
+ *  arg     -   the descriptor (int *)
+ *  buf     -   bytes to write
+ *  len     -   number of bytes
+ */
+int md2mdoc_fd_sink(void *arg, const char *buf, size_t len) {
+  int fd = *(int *)arg;
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = write(fd, buf, len)) == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/**
+ * md2mdoc_buf_sink --
+ *      Sink appending to a growable memory buffer.
+ * Parameters:
+ *  arg     -   the buffer (struct md2mdoc_buf *)
+ *  buf     -   bytes to append
+ *  len     -   number of bytes
+ */
+int md2mdoc_buf_sink(void *arg, const char *buf, size_t len) {
+  struct md2mdoc_buf *mb = arg;
+  size_t cap;
+  char *p;
+
+  if (mb->cap - mb->len < len) {
+    cap = mb->cap ? mb->cap : 4096;
+    while (cap - mb->len < len)
+      cap *= 2;
+    if ((p = realloc(mb->data, cap)) == NULL)
+      return -1;
+    mb->data = p;
+    mb->cap = cap;
+  }
+  memcpy(mb->data + mb->len, buf, len);
+  mb->len += len;
+  return 0;
+}
+
+/**
+ * mapsource --
+ *      Map a regular file read-only.
+ * Parameters:
+ *  fd      -   file descriptor to map
+ *  src     -   filled in with the mapping
+ *
+ * Returns:
+ *  0 on success, -1 if `fd` is not a (non-empty) regular file or
+ *  cannot be mapped.
+ */
+static int mapsource(int fd, struct source *src) {
+  struct stat st;
+  void *map;
+
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    return -1;
+  map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+#ifdef POSIX_MADV_SEQUENTIAL
+  posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+#endif
+  src->data = map;
+  src->len = (size_t)st.st_size;
+  return 0;
+}
+
+/**
+ * convertstream --
+ *      Convert input from a pipe or terminal as it arrives. Bytes are
+ *      read into a window; every complete line in it is processed and
+ *      the unfinished tail moved to the front before the next read.
+ *      The window only grows when a single line does not fit.
+ * Parameters:
+ *  doc     -   document being converted (already reset)
+ *  fd      -   file descriptor to read
+ *
+ * Returns:
+ *  0 on success, -1 on a read or allocation error (errno set).
+ */
+static int convertstream(md2mdoc_ctx *doc, int fd) {
+  const char *end;
+  char *buf, *tmp;
+  size_t cap = INBUFSIZE, len = 0;
+  unsigned long long t = 0;
+  ssize_t n;
+  size_t i;
+
+  if ((buf = malloc(cap)) == NULL)
+    return -1;
+  for (;;) {
+    if (len == cap) {                                   /* One line fills the window. */
+      if ((tmp = realloc(buf, cap * 2)) == NULL) {
+        free(buf);
+        return -1;
+      }
+      buf = tmp;
+      cap *= 2;
+    }
+    if (doc->stats != NULL)
+      t = nsnow();
+    n = read(fd, buf + len, cap - len);
+    if (doc->stats != NULL) {
+      doc->stats->read_ns += nsnow() - t;
+      doc->stats->bytes_in += n > 0 ? (size_t)n : 0;
+    }
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      free(buf);
+      return -1;
+    }
+    if (n == 0)
+      break;
+    len += (size_t)n;
+
+    end = buf + len;                                    /* Process up to the last newline. */
+    while (end > buf && end[-1] != '\n')
+      end--;
+    parse(doc, buf, end);
+    flushir(doc);                                       /* The tokens point into `buf`, */
+    for (i = 0; i < doc->nem; i++)                      /*   and so may gathered output. */
+      if (doc->em[i].out.niov > 0)
+        bufflush(&doc->em[i].out);
+    len -= (size_t)(end - buf);
+    memmove(buf, end, len);
+  }
+
+  parse(doc, buf, buf + len);                           /* A last line without a newline. */
+  flushir(doc);
+  free(buf);
+  return 0;
+}
+
+/**
+ * nextline --
+ *      Line iterator over an in-memory input. Hands out each line as a
+ *      pointer and length (including the trailing newline, when there
+ *      is one) without copying it.
+ * Parameters:
+ *  pos     -   iterator position; advanced past the line returned
+ *  end     -   end of the input
+ *  line    -   set to the start of the line
+ *  len     -   set to the length of the line
+ *
+ * Returns:
+ *  1 if a line was returned, 0 at the end of the input.
+ */
+static int nextline(const char **pos, const char *end, const char **line, size_t *len) {
+  const char *p = *pos, *nl;
+
+  if (p >= end)
+    return 0;
+  nl = memchr(p, '\n', (size_t)(end - p));
+  *line = p;
+  *len = nl ? (size_t)(nl - p) + 1 : (size_t)(end - p);
+  *pos = p + *len;
+  return 1;
+}
+
+/**
+ * setsection --
+ *      Remember the manual section (the last word of the `title:`
+ *      line) so batch mode can name the output file after it, and
+ *      the words before it as the page's title.
+ * Parameters:
+ *  doc     -   document being converted
+ *  str     -   rest of the `title:` line
+ *  end     -   end of the line
+ */
+static void setsection(md2mdoc_ctx *doc, const char *str, const char *end) {
+  const char *start;
+  size_t len;
+
+  while (end > str && ISSPACE(end[-1])) end--;
+  start = end;
+  while (start > str && !ISSPACE(start[-1])) start--;
+  len = (size_t)(end - start);
+  if (len == 0 || len >= sizeof(doc->section))
+    return;
+  memcpy(doc->section, start, len);
+  doc->section[len] = '\0';
+  if ((len = trimmed(&str, start)) > 0)
+    capture(doc->whatis.title, 0, sizeof(doc->whatis.title), str, len);
+}
+
+/**
+ * setnames --
+ *      Remember the names (before the `--`) and the description
+ *      (after it) of the line following `# NAME`, as they are written.
+ * Parameters:
+ *  doc     -   document being converted
+ *  str     -   start of the line
+ *  end     -   its end (past the newline)
+ */
+static void setnames(md2mdoc_ctx *doc, const char *str, const char *end) {
+  const char *dd = str, *desc;
+  size_t len;
+
+  while ((dd = memchr(dd, '-', (size_t)(end - dd))) != NULL && (end - dd < 2 || dd[1] != '-'))
+    dd++;
+  desc = dd != NULL ? dd + 2 : end;
+  len = trimmed(&str, dd != NULL ? dd : end);
+  capture(doc->whatis.names, 0, sizeof(doc->whatis.names), str, len);
+  len = trimmed(&desc, end);
+  capture(doc->whatis.desc, 0, sizeof(doc->whatis.desc), desc, len);
+  doc->whatis.named = 1;
+}
+
+/**
+ * mergewhatis --
+ *      Take what `src` knows of a page over `dst`.
+ */
+static void mergewhatis(struct whatis *dst, const struct whatis *src) {
+  if (src->named) {                                     /* The last NAME line wins, as in one parse. */
+    memcpy(dst->names, src->names, sizeof(dst->names));
+    memcpy(dst->desc, src->desc, sizeof(dst->desc));
+    dst->named = 1;
+  }
+  if (src->title[0] != '\0')
+    memcpy(dst->title, src->title, sizeof(dst->title));
+}
+
+/**
+ * trimmed --
+ *      Drop the white space around [*p, end).
+ *
+ * Returns:
+ *  The length left, with `*p` at its start.
+ */
+static size_t trimmed(const char **p, const char *end) {
+  while (*p < end && ISSPACE(**p))
+    (*p)++;
+  return trimlen(*p, (size_t)(end - *p));
+}
+
+/**
+ * addtok --
+ *      Add a token to the document's IR.
+ *
+ * Returns:
+ *  The token, so the caller can set its flags.
+ */
+static inline struct token *addtok(md2mdoc_ctx *doc, int kind, const char *str, size_t len) {
+  return doc->last = ir_add(&doc->ir, kind, str, len);
+}
+
+/**
+ * text --
+ *      Add `n` bytes of plain text. Text that carries straight on from
+ *      the previous text token is merged into it, so a line copied a
+ *      character at a time still becomes one token.
+ */
+static void text(md2mdoc_ctx *doc, const char *p, size_t n) {
+  struct token *t = doc->last;
+
+  if (t != NULL && t->kind == TK_TEXT && t->flags == 0 && t->str + t->len == p &&
+      t->str != newline && t->str != nul)
+    t->len += n;
+  else
+    addtok(doc, TK_TEXT, p, n);
+}
+
+/**
+ * textat --
+ *      Add the byte at `p`, or a NUL if `p` is at the end of the line
+ *      (what `AT(p)` reads).
+ */
+static inline void textat(md2mdoc_ctx *doc, const char *p, const char *end) {
+  if (p < end)
+    text(doc, p, 1);
+  else
+    addtok(doc, TK_TEXT, nul, 1);
+}
+
+/**
+ * putnl --
+ *      Add a newline that is not in the input. It is carried as a
+ *      flag on the token before it, which saves a token for the
+ *      newline that precedes every inline macro.
+ */
+static inline void putnl(md2mdoc_ctx *doc) {
+  if (doc->last != NULL && !(doc->last->flags & TOK_NL))
+    doc->last->flags |= TOK_NL;
+  else
+    addtok(doc, TK_TEXT, newline, 1);
+}
+
+/**
+ * rest --
+ *      Add the rest of a line, from `str` up to `end`.
+ */
+static void rest(md2mdoc_ctx *doc, const char *str, const char *end) {
+  if (str < end)
+    text(doc, str, (size_t)(end - str));
+}
+
+/**
+ * listbegin --
+ *      Start a list of the given LIST_* type.
+ */
+static inline void listbegin(md2mdoc_ctx *doc, int type) {
+  addtok(doc, TK_LISTBEGIN, NULL, 0)->flags = (unsigned char)type;
+  if (doc->lint.lists < LINTLISTS)
+    doc->lint.listat[doc->lint.lists] = doc->lint.at;
+  doc->lint.lists++;
+}
+
+/**
+ * listend --
+ *      End the innermost list.
+ */
+static inline void listend(md2mdoc_ctx *doc) {
+  addtok(doc, TK_LISTEND, NULL, 0);
+  if (doc->lint.lists > 0)
+    doc->lint.lists--;
+}
+
+/**
+ * flushir --
+ *      Run every emitter over the tokens collected so far and start a
+ *      new batch. Called every IRBLOCKSIZE or so tokens, so the arena
+ *      stays small however long the document is, and before streamed
+ *      input that the tokens point into is moved.
+ */
+static void flushir(md2mdoc_ctx *doc) {
+  unsigned long long t = 0;
+  size_t i;
+
+  if (doc->stats != NULL) {
+    counttokens(doc->stats, &doc->ir);
+    t = nsnow();
+  }
+  for (i = 0; i < doc->nem; i++)
+    ir_emit(&doc->ir, &doc->em[i]);
+  if (doc->stats != NULL)
+    doc->stats->emit_ns += nsnow() - t;
+  ir_reset(&doc->ir);
+  doc->last = NULL;
+}
+
+/**
+ * parse --
+ *      Parse the lines of [pos, end), writing out the IR each time it
+ *      fills.
+ */
+static void parse(md2mdoc_ctx *doc, const char *pos, const char *end) {
+  const char *line;
+  size_t linelen;
+
+  if (doc->stats != NULL || doc->lint.fn != NULL) {
+    parsecounted(doc, pos, end);
+    return;
+  }
+  while (nextline(&pos, end, &line, &linelen)) {
+    processline(doc, line, line + linelen);
+    if (doc->ir.ntok >= doc->flushat)
+      flushir(doc);
+  }
+}
+
+/**
+ * parsecounted --
+ *      `parse`, counting lines and timing it, or checking them for
+ *      lint. Kept apart so a context doing neither runs the plain loop.
+ */
+static void parsecounted(md2mdoc_ctx *doc, const char *pos, const char *end) {
+  struct md2mdoc_stats *st = doc->stats;
+  unsigned long long t = 0, emit = 0;
+  const char *line;
+  size_t linelen;
+
+  if (st != NULL) {
+    t = nsnow();
+    emit = st->emit_ns;
+  }
+  while (nextline(&pos, end, &line, &linelen)) {
+    doc->lint.at.line++;
+    if (st != NULL)
+      st->lines++;
+    if (doc->lint.fn != NULL)
+      lintline(doc, line, line + linelen);
+    else
+      processline(doc, line, line + linelen);
+    if (doc->ir.ntok >= doc->flushat)
+      flushir(doc);
+  }
+  if (st != NULL)
+    st->parse_ns += nsnow() - t - (st->emit_ns - emit); /* Less the flushes made on the way. */
+}
+
+/**
+ * lintline --
+ *      Process a line, reporting what it does wrong and remembering
+ *      where the blocks it opens start.
+ * Parameters:
+ *  doc     -   document being converted
+ *  str     -   start of the line
+ *  end     -   its end (past the newline)
+ */
+static void lintline(md2mdoc_ctx *doc, const char *str, const char *end) {
+  unsigned int code = doc->codeblock, comment = doc->commentflag, name = doc->nameflag;
+  enum linekind kind = classify(str, end);
+
+  if (*str == '>' && code == 0)
+    report(doc, &doc->lint.at, "`>' ends no literal block");
+  else if (*str == '<' && kind != LK_COMMENTOPEN && code != 0)
+    report(doc, &doc->lint.at, "literal block opened inside another");
+
+  processline(doc, str, end);
+
+  if (kind == LK_INCLUDE)                               /* `lintinclude` or the file's own lines. */
+    return;
+  if (code == 0 && doc->codeblock != 0)
+    doc->lint.codeat = doc->lint.at;
+  if (comment == 0 && doc->commentflag != 0)
+    doc->lint.commentat = doc->lint.at;
+  if (doc->nameflag != 0)
+    doc->lint.nameat = doc->lint.at;
+  if (name != 0 && doc->whatis.names[0] == '\0')
+    report(doc, &doc->lint.at, "empty name after `# NAME'");
+}
+
+/**
+ * lintinclude --
+ *      Take over the blocks a fragment whose tokens were copied leaves
+ *      open, as opened on the `include:` line.
+ */
+static void lintinclude(md2mdoc_ctx *doc, const struct fragment *frag) {
+  unsigned int i;
+
+  for (i = 0; i < frag->lists; i++) {
+    if (doc->lint.lists < LINTLISTS)
+      doc->lint.listat[doc->lint.lists] = doc->lint.at;
+    doc->lint.lists++;
+  }
+  if (frag->codeblock != 0)
+    doc->lint.codeat = doc->lint.at;
+  if (frag->commentflag != 0)
+    doc->lint.commentat = doc->lint.at;
+  if (frag->nameflag != 0)
+    doc->lint.nameat = doc->lint.at;
+}
+
+/**
+ * lintend --
+ *      Report the blocks left open at the end of a document and, with
+ *      MD2MDOC_LINT_CLOSE, end the literal block and the lists.
+ */
+static void lintend(md2mdoc_ctx *doc) {
+  unsigned int i;
+
+  for (i = 0; i < doc->lint.lists; i++)
+    report(doc, &doc->lint.listat[i < LINTLISTS ? i : LINTLISTS - 1], "list is never closed");
+  if (doc->codeblock != 0)
+    report(doc, &doc->lint.codeat, "literal block is never closed (no `>' or ```)");
+  if (doc->commentflag != 0)
+    report(doc, &doc->lint.commentat, "comment is never closed (no `-->'); the rest is dropped");
+  if (doc->nameflag != 0)
+    report(doc, &doc->lint.nameat, "no name line after `# NAME'");
+
+  if (doc->lint.flags & MD2MDOC_LINT_CLOSE) {
+    if (doc->codeblock != 0)
+      addtok(doc, TK_LITEND, NULL, 0);
+    while (doc->lint.lists > 0)
+      listend(doc);
+    doc->codeblock = doc->optionslist = doc->dashorenumlist = 0;
+  }
+}
+
+/**
+ * report --
+ *      Hand one problem to the lint function.
+ */
+static void report(const md2mdoc_ctx *doc, const struct where *w, const char *msg) {
+  doc->lint.fn(doc->lint.arg, w->file, w->line, msg);
+}
+
+/**
+ * countproblem --
+ *      Lint function of a fragment being loaded: a fragment with
+ *      problems is parsed again into a document checking them, so they
+ *      are reported where it is included.
+ * Parameters:
+ *  arg     -   the count (unsigned int *)
+ */
+static void countproblem(void *arg, const char *file, unsigned long line, const char *msg) {
+  (void)file;
+  (void)line;
+  (void)msg;
+  (*(unsigned int *)arg)++;
+}
+
+/**
+ * nestedcounted --
+ *      `processnested`, timed.
+ */
+static void nestedcounted(md2mdoc_ctx *doc, const char *str, const char *end) {
+  unsigned long long t = nsnow();
+
+  processnested(doc, str, end);
+  doc->stats->nested_ns += nsnow() - t;
+}
+
+/**
+ * counttokens --
+ *      Count the constructs among the tokens of an arena.
+ */
+static void counttokens(struct md2mdoc_stats *st, const struct ir *ir) {
+  const struct irblock *blk;
+  const struct token *t;
+
+  for (blk = ir->first; blk != NULL && blk->n > 0; blk = blk->next) {
+    for (t = blk->tok; t < blk->tok + blk->n; t++) {
+      switch (t->kind) {
+        case TK_SECTION: st->sections++; break;
+        case TK_SUBSECTION: st->subsections++; break;
+        case TK_PARA: st->paragraphs++; break;
+        case TK_LISTBEGIN: st->lists_opened++; break;
+        case TK_LISTEND: st->lists_closed++; break;
+        case TK_ITEM: st->items++; break;
+        case TK_LITBEGIN: st->codeblocks++; break;
+        case TK_FLAG: st->flags++; break;
+        case TK_OPTIONAL: st->optional++; break;
+        case TK_BOLD: st->bold++; break;
+        case TK_ITALIC: st->italic++; break;
+        case TK_LITERAL: st->literal++; break;
+        case TK_XREF: st->xref++; break;
+        case TK_MODIFIER: st->modifier++; break;
+        case TK_SECREF: st->secref++; break;
+        case TK_NAMEREF: st->nameref++; break;
+        case TK_MACRO: st->macros++; break;
+        default: continue;
+      }
+      if (t->len >= LONGTOKEN)
+        st->long_tokens++;
+    }
+  }
+}
+
+/**
+ * convertsplit --
+ *      Parse a document on up to `doc->nthreads` threads and emit the
+ *      tokens of its parts in order.
+ * Parameters:
+ *  doc     -   context, reset and holding the outputs
+ *  in      -   the document
+ *  end     -   its end
+ *
+ * Returns:
+ *  0 once the document has been converted, -1 if it could not be cut
+ *  into parts (or they could not be allocated) and nothing has been
+ *  done with it.
+ */
+static int convertsplit(md2mdoc_ctx *doc, const char *in, const char *end) {
+  struct part *parts;
+  const char *p, *cut;
+  size_t n = doc->nthreads, np = 0, i, step = (size_t)(end - in) / n;
+  unsigned long long t = 0;
+
+  if ((parts = calloc(n, sizeof(*parts))) == NULL)
+    return -1;
+  for (p = in; p < end && np < n; p = cut) {            /* Cut at the first heading past each step. */
+    cut = np + 1 < n && (size_t)(end - p) > step ? p + step : end;
+    while (cut < end) {
+      if ((cut = memchr(cut, '\n', (size_t)(end - cut))) == NULL) {
+        cut = end;
+        break;
+      }
+      cut++;
+      if (end - cut >= 2 && cut[0] == '#' && cut[1] == ' ')
+        break;
+    }
+    parts[np].start = p;
+    parts[np].end = cut;
+    np++;
+  }
+  if (np < 2) {
+    free(parts);
+    return -1;
+  }
+  for (i = 0; i < np; i++) {
+    if ((parts[i].ctx = md2mdoc_ctx_new()) == NULL) {
+      while (i > 0)
+        md2mdoc_ctx_free(parts[--i].ctx);
+      free(parts);
+      return -1;
+    }
+    parts[i].ctx->flushat = (size_t)-1;                 /* Keep every token of the part. */
+    parts[i].ctx->markup = doc->markup;
+    parts[i].ctx->frags = doc->frags;
+    parts[i].ctx->incdir = doc->incdir;
+    if (doc->stats != NULL)
+      parts[i].ctx->stats = &parts[i].stats;
+  }
+
+  if (doc->stats != NULL)
+    t = nsnow();
+  for (i = 1; i < np; i++)                              /* This thread parses the first part. */
+    parts[i].started = pthread_create(&parts[i].tid, NULL, parsepart, &parts[i]) == 0;
+  parsepart(&parts[0]);
+  for (i = 1; i < np; i++) {
+    if (parts[i].started)
+      pthread_join(parts[i].tid, NULL);
+    else
+      parsepart(&parts[i]);
+  }
+  if (doc->stats != NULL)
+    doc->stats->parse_ns += nsnow() - t;
+
+  for (i = 0; i < np; i++) {
+    if (i > 0 && !freshstate(parts[i - 1].ctx)) {
+      resetctx(parts[i].ctx, NULL, 0);                  /* The guess was wrong: parse it again. */
+      parts[i].ctx->stripwhitespace = parts[i - 1].ctx->stripwhitespace;
+      parts[i].ctx->codeblock = parts[i - 1].ctx->codeblock;
+      parts[i].ctx->optionslist = parts[i - 1].ctx->optionslist;
+      parts[i].ctx->dashorenumlist = parts[i - 1].ctx->dashorenumlist;
+      parts[i].ctx->nameflag = parts[i - 1].ctx->nameflag;
+      parts[i].ctx->commentflag = parts[i - 1].ctx->commentflag;
+      parts[i].ctx->flushat = (size_t)-1;
+      memset(&parts[i].stats, 0, sizeof(parts[i].stats));
+      parse(parts[i].ctx, parts[i].start, parts[i].end);
+      if (doc->stats != NULL)
+        doc->stats->parse_ns += parts[i].stats.parse_ns;
+    }
+    emitpart(doc, parts[i].ctx);
+  }
+
+  for (i = 0; i < np; i++) {
+    if (doc->stats != NULL) {
+      doc->stats->lines += parts[i].stats.lines;
+      doc->stats->nested_ns += parts[i].stats.nested_ns;
+    }
+    md2mdoc_ctx_free(parts[i].ctx);
+  }
+  free(parts);
+  return 0;
+}
+
+/**
+ * parsepart --
+ *      Parse one part from the state of a fresh document.
+ */
+static void *parsepart(void *arg) {
+  struct part *part = arg;
+
+  parse(part->ctx, part->start, part->end);
+  return NULL;
+}
+
+/**
+ * freshstate --
+ *      Check that a part ended in the state a fresh document starts
+ *      in, so the part after it was parsed from the right state.
+ *      `stripwhitespace` only matters inside a code block and is cleared
+ *      whenever one opens, so it is not compared.
+ */
+static int freshstate(const md2mdoc_ctx *doc) {
+  return doc->codeblock == 0 && doc->optionslist == 0 && doc->dashorenumlist == 0 &&
+         doc->nameflag == 0 && doc->commentflag == 0;
+}
+
+/**
+ * emitpart --
+ *      Hand the tokens of a part to the emitters of the document, and
+ *      take over what the part found out about the document.
+ */
+static void emitpart(md2mdoc_ctx *doc, md2mdoc_ctx *part) {
+  unsigned long long t = 0;
+  size_t i;
+
+  if (doc->stats != NULL) {
+    counttokens(doc->stats, &part->ir);
+    t = nsnow();
+  }
+  for (i = 0; i < doc->nem; i++)
+    ir_emit(&part->ir, &doc->em[i]);
+  if (doc->stats != NULL)
+    doc->stats->emit_ns += nsnow() - t;
+  if (part->section[0] != '\0')
+    memcpy(doc->section, part->section, sizeof(doc->section));
+  mergewhatis(&doc->whatis, &part->whatis);
+  if (part->ir.error)
+    doc->ir.error = 1;
+  if (part->incerror != 0 && doc->incerror == 0) {
+    doc->incerror = part->incerror;
+    memcpy(doc->incfail, part->incfail, sizeof(doc->incfail));
+  }
+}
+
+/**
+ * convertincr --
+ *      Convert a document with an incremental context: cut it into
+ *      sections, splice in the tokens kept for each section that did
+ *      not change and parse the others, then keep the new sections for
+ *      the next document.
+ * Parameters:
+ *  doc     -   context, reset and holding the outputs
+ *  in      -   the document
+ *  len     -   its length
+ *
+ * Returns:
+ *  0 once the document has been converted, -1 if memory ran out and
+ *  nothing has been done with it.
+ */
+static int convertincr(md2mdoc_ctx *doc, const char *in, size_t len) {
+  struct incr *incr = &doc->incr;
+  struct chunk *cur = incr->spare, *c;
+  const struct chunk *old;
+  md2mdoc_ctx *part;
+  size_t n = 0, cap = incr->sparecap, off, i, hint = 0;
+  char *text = incr->sparetext;
+  void *grown;
+
+  if (incr->part == NULL && (incr->part = md2mdoc_ctx_new()) == NULL)
+    return -1;
+  if (incr->scratch == NULL && (incr->scratch = malloc(sizeof(*incr->scratch))) == NULL)
+    return -1;
+  if (incr->sparetextcap < len + 1) {
+    if ((text = realloc(text, len + 1)) == NULL)
+      return -1;
+    incr->sparetext = text;
+    incr->sparetextcap = len + 1;
+  }
+  memcpy(text, in, len);                                /* The tokens kept must outlive `in`. */
+  for (off = 0; off < len; off += cur[n++].len) {
+    if (n == cap) {
+      cap = cap ? cap * 2 : 16;
+      if ((grown = realloc(cur, cap * sizeof(*cur))) == NULL)
+        return -1;
+      incr->spare = cur = grown;
+      incr->sparecap = cap;
+    }
+    memset(&cur[n], 0, sizeof(cur[n]));
+    cur[n].off = off;
+    cur[n].len = cutchunk(text, off, len) - off;
+  }
+
+  part = incr->part;
+  part->markup = doc->markup;
+  part->frags = doc->frags;
+  part->incdir = doc->incdir;
+  for (i = 0; i < n; i++) {
+    c = &cur[i];
+    savepstate(doc, &c->at);
+    if ((old = findchunk(incr, doc->markup, text + c->off, c, &hint)) != NULL) {
+      takechunk(c, &incr->chunk[old - incr->chunk], incr->text, text);
+      emitchunk(doc, c);
+    } else {
+      resetctx(part, NULL, 0);
+      part->flushat = (size_t)-1;                       /* Keep every token of the section. */
+      loadpstate(part, &c->at);
+      part->incerror = doc->incerror;                   /* After a failed include, skip the others. */
+      parse(part, text + c->off, text + c->off + c->len);
+      c->reusable = !md2mdoc_has_include(text + c->off, c->len);
+      keepchunk(c, part);
+      if (c->reusable)
+        emitchunk(doc, c);
+      else
+        emitpart(doc, part);
+    }
+    loadpstate(doc, &c->end);
+  }
+
+  clearchunks(incr->chunk, incr->nchunk);               /* This document is kept; the last is spare. */
+  incr->spare = incr->chunk;
+  incr->sparecap = incr->chunkcap;
+  incr->chunk = cur;
+  incr->chunkcap = cap;
+  incr->nchunk = n;
+  cap = incr->sparetextcap;
+  incr->sparetext = incr->text;
+  incr->sparetextcap = incr->textcap;
+  incr->text = text;
+  incr->textcap = cap;
+  incr->markup = doc->markup;
+  return 0;
+}
+
+/**
+ * cutchunk --
+ *      Find where the section starting at `off` ends: at the next line
+ *      starting with `# `, or at the end of the document.
+ */
+static size_t cutchunk(const char *text, size_t off, size_t len) {
+  const char *p = text + off, *end = text + len;
+
+  while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+    p++;
+    if (end - p >= 2 && p[0] == '#' && p[1] == ' ')
+      return (size_t)(p - text);
+  }
+  return len;
+}
+
+/**
+ * findchunk --
+ *      Look for a kept section with the same text as a section of the
+ *      new document. The search starts after the last one found, since
+ *      sections mostly stay in order.
+ * Parameters:
+ *  incr    -   what the context kept
+ *  markup  -   markers the new document is converted with
+ *  p       -   text of the new section
+ *  c       -   the new section, with the state it starts in
+ *  hint    -   where to start, updated
+ *
+ * Returns:
+ *  The kept section, or NULL if there is none that can be reused.
+ */
+static const struct chunk *findchunk(struct incr *incr, const md2mdoc_markup *markup,
+                                     const char *p, const struct chunk *c, size_t *hint) {
+  const struct chunk *old;
+  size_t i, k;
+
+  if (incr->markup != markup)                           /* TK_MACRO flags index the markers. */
+    return NULL;
+  for (i = 0; i < incr->nchunk; i++) {
+    k = (*hint + i) % incr->nchunk;
+    old = &incr->chunk[k];
+    if (old->reusable && !old->used && old->len == c->len &&
+        memcmp(&old->at, &c->at, sizeof(c->at)) == 0 &&  /* All unsigned ints: no padding. */
+        memcmp(incr->text + old->off, p, c->len) == 0) {
+      *hint = k + 1;
+      return old;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * takechunk --
+ *      Move the tokens and state of a kept section to the same section
+ *      of the new document, pointing its tokens into the new text.
+ * Parameters:
+ *  c       -   the new section
+ *  old     -   the kept one
+ *  from    -   the old text
+ *  to      -   the new text
+ */
+static void takechunk(struct chunk *c, struct chunk *old, const char *from, const char *to) {
+  uintptr_t lo = (uintptr_t)(from + old->off), hi = lo + old->len;
+  size_t i;
+
+  c->reusable = 1;
+  c->tok = old->tok;
+  c->ntok = old->ntok;
+  old->tok = NULL;
+  old->used = 1;
+  for (i = 0; i < c->ntok; i++)                         /* Static strings stay where they are. */
+    if ((uintptr_t)c->tok[i].str >= lo && (uintptr_t)c->tok[i].str <= hi)
+      c->tok[i].str = to + c->off + ((uintptr_t)c->tok[i].str - lo);
+  c->end = old->end;
+  memcpy(c->section, old->section, sizeof(c->section));
+  c->whatis = old->whatis;
+  memcpy(c->em, old->em, sizeof(c->em));
+  memset(old->em, 0, sizeof(old->em));
+}
+
+/**
+ * keepchunk --
+ *      Record the state a parsed section ends in and, if it may be
+ *      reused, a copy of its tokens.
+ */
+static void keepchunk(struct chunk *c, const md2mdoc_ctx *part) {
+  const struct irblock *blk;
+
+  savepstate(part, &c->end);
+  memcpy(c->section, part->section, sizeof(c->section));
+  c->whatis = part->whatis;
+  if (!c->reusable)
+    return;
+  if (part->ir.error || part->incerror != 0 ||
+      (part->ir.ntok > 0 && (c->tok = malloc(part->ir.ntok * sizeof(*c->tok))) == NULL)) {
+    c->reusable = 0;                                    /* Parsed again next time. */
+    return;
+  }
+  for (blk = part->ir.first; blk != NULL && blk->n > 0; blk = blk->next) {
+    memcpy(c->tok + c->ntok, blk->tok, blk->n * sizeof(*c->tok));
+    c->ntok += blk->n;
+  }
+}
+
+/**
+ * savepstate --
+ *      Save the state the parser of a context is in.
+ */
+static void savepstate(const md2mdoc_ctx *doc, struct pstate *st) {
+  st->stripwhitespace = doc->stripwhitespace;
+  st->codeblock = doc->codeblock;
+  st->optionslist = doc->optionslist;
+  st->dashorenumlist = doc->dashorenumlist;
+  st->nameflag = doc->nameflag;
+  st->commentflag = doc->commentflag;
+}
+
+/**
+ * loadpstate --
+ *      Put the parser of a context back in a saved state.
+ */
+static void loadpstate(md2mdoc_ctx *doc, const struct pstate *st) {
+  doc->stripwhitespace = st->stripwhitespace;
+  doc->codeblock = st->codeblock;
+  doc->optionslist = st->optionslist;
+  doc->dashorenumlist = st->dashorenumlist;
+  doc->nameflag = st->nameflag;
+  doc->commentflag = st->commentflag;
+}
+
+/**
+ * emitchunk --
+ *      `emitpart` for a section whose tokens are kept. An output whose
+ *      emitter is in the state it was in when it last emitted the
+ *      section is given the bytes it wrote then; the others emit the
+ *      tokens into the section's `emitted`, to be copied to the output
+ *      now and perhaps reused next time.
+ */
+static void emitchunk(md2mdoc_ctx *doc, struct chunk *c) {
+  struct emitter *em, *scratch = doc->incr.scratch;
+  struct emitted *e;
+  size_t i;
+
+  for (i = 0; i < doc->nem; i++) {
+    em = &doc->em[i];
+    e = &c->em[i];
+    if (!e->ok || memcmp(e->at, em, EMSTATE) != 0) {
+      e->out.len = 0;
+      emitter_init(scratch, em->fmt, md2mdoc_buf_sink, &e->out);
+      memcpy(scratch, em, EMSTATE);
+      memcpy(e->at, em, EMSTATE);
+      if (c->ntok > 0)
+        scratch->fmt->emit(scratch, c->tok, c->ntok);
+      e->ok = bufflush(&scratch->out) == 0;
+      memcpy(e->end, scratch, EMSTATE);
+      if (!e->ok) {                                     /* Out of memory: emit it straight out. */
+        if (c->ntok > 0)
+          em->fmt->emit(em, c->tok, c->ntok);
+        continue;
+      }
+    }
+    if (e->out.len > 0)
+      bufwrite(&em->out, e->out.data, e->out.len);
+    memcpy(em, e->end, EMSTATE);
+  }
+  if (c->section[0] != '\0')
+    memcpy(doc->section, c->section, sizeof(doc->section));
+  mergewhatis(&doc->whatis, &c->whatis);
+}
+
+/**
+ * dropincr --
+ *      Release the sections an incremental context keeps.
+ */
+static void dropincr(struct incr *incr) {
+  clearchunks(incr->chunk, incr->nchunk);
+  free(incr->chunk);
+  free(incr->text);
+  free(incr->spare);
+  free(incr->sparetext);
+  incr->chunk = incr->spare = NULL;
+  incr->nchunk = incr->chunkcap = incr->sparecap = 0;
+  incr->text = incr->sparetext = NULL;
+  incr->textcap = incr->sparetextcap = 0;
+}
+
+/**
+ * clearchunks --
+ *      Release what sections hold (their tokens and output), keeping
+ *      the array of them.
+ */
+static void clearchunks(struct chunk *chunk, size_t n) {
+  size_t i, k;
+
+  for (i = 0; i < n; i++) {
+    free(chunk[i].tok);
+    for (k = 0; k < MD2MDOC_NFORMATS; k++)
+      free(chunk[i].em[k].out.data);
+  }
+}
+
+/**
+ * include --
+ *      Splice in the file named on an `include:` line, as if its lines
+ *      stood in place of this one. In the state a document starts in,
+ *      the fragment's cached tokens are copied; in any other state (a
+ *      list or comment running into the line) its text is parsed anew.
+ *      A failure is remembered in `incerror` and ends the conversion.
+ * Parameters:
+ *  doc     -   document being converted
+ *  str     -   rest of the line: the path
+ *  end     -   end of the line
+ */
+static void include(md2mdoc_ctx *doc, const char *str, const char *end) {
+  const char *dir = doc->incdir;
+  struct fragment *frag = NULL;
+  struct where at;
+  struct token *t;
+  char path[PATH_MAX];
+  size_t i;
+  unsigned int d;
+  int n, error = 0;
+
+  if (doc->incerror != 0)                               /* The conversion has failed already. */
+    return;
+  while (str < end && ISSPACE(*str)) str++;
+  while (end > str && ISSPACE(end[-1])) end--;
+  if (str == end) {                                     /* No path at all. */
+    doc->incerror = EINVAL;
+    doc->incfail[0] = '\0';
+    return;
+  }
+  if (*str == '/' || dir == NULL || *dir == '\0')
+    n = snprintf(path, sizeof(path), "%.*s", (int)(end - str), str);
+  else
+    n = snprintf(path, sizeof(path), "%s/%.*s", dir, (int)(end - str), str);
+  for (d = 0; d < doc->incdepth && strcmp(doc->incopen[d], path) != 0; d++)
+    ;
+  if (n < 0 || (size_t)n >= sizeof(path))
+    error = ENAMETOOLONG;
+  else if (d < doc->incdepth || doc->incdepth >= INCLUDEDEPTH)
+    error = ELOOP;                                      /* A file in a loop of includes, or too deep. */
+  else if ((frag = getfragment(doc, path)) == NULL && doc->incerror == 0)
+    error = errno;                                      /* (Or a failure inside it, already set.) */
+  if (error == 0 && doc->incerror == 0 && doc->loading != NULL && adddep(doc->loading, frag) == -1)
+    error = ENOMEM;                                     /* Its cached tokens depend on this one. */
+  if (error != 0 || doc->incerror != 0) {
+    if (doc->incerror == 0) {
+      doc->incerror = error;
+      snprintf(doc->incfail, sizeof(doc->incfail), "%.*s", (int)(end - str), str);
+    }
+    return;
+  }
+
+  if (freshstate(doc) && (doc->lint.fn == NULL || frag->problems == 0)) {
+    for (i = 0; i < frag->ntok; i++) {
+      t = addtok(doc, frag->tok[i].kind, frag->tok[i].str, frag->tok[i].len);
+      t->flags = frag->tok[i].flags;
+      if (doc->ir.ntok >= doc->flushat)
+        flushir(doc);
+    }
+    doc->codeblock = frag->codeblock;
+    doc->optionslist = frag->optionslist;
+    doc->dashorenumlist = frag->dashorenumlist;
+    doc->nameflag = frag->nameflag;
+    doc->commentflag = frag->commentflag;
+    doc->stripwhitespace = frag->stripwhitespace;
+    lintinclude(doc, frag);
+    if (frag->section[0] != '\0')
+      memcpy(doc->section, frag->section, sizeof(doc->section));
+    mergewhatis(&doc->whatis, &frag->whatis);
+  } else {                                              /* (Lint reports a fragment's problems from here.) */
+    at = doc->lint.at;
+    doc->lint.at.file = frag->path;
+    doc->lint.at.line = 0;
+    doc->incdir = frag->dir;
+    doc->incopen[doc->incdepth++] = frag->path;
+    parse(doc, frag->text, frag->text + frag->len);
+    doc->incdepth--;
+    doc->incdir = dir;
+    doc->lint.at = at;
+  }
+}
+
+/**
+ * getfragment --
+ *      Find a fragment in the cache, loading it on a miss or if its
+ *      file (or one it includes) has changed since it was read. Two
+ *      threads loading the same file at once both load it; the first
+ *      to finish is kept. A fragment replaced is kept until the cache
+ *      is freed, since the tokens of a conversion may point into it.
+ *
+ * Returns:
+ *  The fragment, or NULL on failure (errno set, or `doc->incerror`
+ *  if the failure was in a file it includes).
+ */
+static struct fragment *getfragment(md2mdoc_ctx *doc, const char *path) {
+  md2mdoc_frags *frags = doc->frags;
+  struct fragment *frag, *old, **pp;
+
+  pthread_mutex_lock(&frags->lock);
+  for (old = frags->list; old != NULL; old = old->next)
+    if (strcmp(old->path, path) == 0)
+      break;
+  pthread_mutex_unlock(&frags->lock);
+  if (old != NULL && fragfresh(old))
+    return old;
+  if ((frag = loadfragment(doc, path)) == NULL)
+    return NULL;
+
+  pthread_mutex_lock(&frags->lock);
+  for (pp = &frags->list; *pp != NULL; pp = &(*pp)->next)
+    if (strcmp((*pp)->path, path) == 0)
+      break;
+  if (*pp == old) {                                     /* Nobody got there first. */
+    if (old != NULL) {
+      *pp = old->next;
+      old->next = frags->stale;
+      frags->stale = old;
+    }
+    frag->next = frags->list;
+    frags->list = frag;
+  } else {
+    freefragment(frag);
+    frag = *pp;
+  }
+  pthread_mutex_unlock(&frags->lock);
+  return frag;
+}
+
+/**
+ * fragfresh --
+ *      Whether a fragment's file, and those of the fragments it
+ *      includes, are still what was read.
+ */
+static int fragfresh(const struct fragment *frag) {
+  struct stat st;
+  size_t i;
+
+  if (stat(frag->path, &st) == -1 || st.st_dev != frag->st.st_dev || st.st_ino != frag->st.st_ino ||
+      st.st_size != frag->st.st_size || st.st_mtim.tv_sec != frag->st.st_mtim.tv_sec ||
+      st.st_mtim.tv_nsec != frag->st.st_mtim.tv_nsec || st.st_ctim.tv_sec != frag->st.st_ctim.tv_sec ||
+      st.st_ctim.tv_nsec != frag->st.st_ctim.tv_nsec)
+    return 0;
+  for (i = 0; i < frag->ndeps; i++)
+    if (!fragfresh(frag->deps[i]))
+      return 0;
+  return 1;
+}
+
+/**
+ * adddep --
+ *      Note that `frag` includes `dep`.
+ *
+ * Returns:
+ *  0, or -1 if memory could not be allocated.
+ */
+static int adddep(struct fragment *frag, struct fragment *dep) {
+  struct fragment **p;
+  size_t i;
+
+  for (i = 0; i < frag->ndeps; i++)
+    if (frag->deps[i] == dep)
+      return 0;
+  if ((p = realloc(frag->deps, (frag->ndeps + 1) * sizeof(*p))) == NULL)
+    return -1;
+  frag->deps = p;
+  frag->deps[frag->ndeps++] = dep;
+  return 0;
+}
+
+/**
+ * loadfragment --
+ *      Read a fragment and parse it, from the state a document starts
+ *      in, with a context of its own.
+ *
+ * Returns:
+ *  The fragment, or NULL on failure (see `getfragment`).
+ */
+static struct fragment *loadfragment(md2mdoc_ctx *doc, const char *path) {
+  const struct irblock *blk;
+  struct fragment *frag;
+  md2mdoc_ctx *ctx = NULL;
+  const char *slash = strrchr(path, '/');
+  size_t cap = 4096, n;
+  ssize_t got;
+  int fd = -1, error;
+  char *p;
+
+  if ((frag = calloc(1, sizeof(*frag))) == NULL)
+    return NULL;
+  if ((frag->path = strdup(path)) == NULL ||
+      (frag->dir = slash == NULL ? strdup("") : strndup(path, slash == path ? 1 : (size_t)(slash - path))) == NULL ||
+      (frag->text = malloc(cap)) == NULL || (fd = open(path, O_RDONLY)) == -1 ||
+      fstat(fd, &frag->st) == -1)
+    goto fail;
+  for (;;) {
+    if (frag->len == cap) {
+      if ((p = realloc(frag->text, cap * 2)) == NULL)
+        goto fail;
+      frag->text = p;
+      cap *= 2;
+    }
+    if ((got = read(fd, frag->text + frag->len, cap - frag->len)) == 0)
+      break;
+    if (got == -1) {
+      if (errno == EINTR)
+        continue;
+      goto fail;
+    }
+    frag->len += (size_t)got;
+  }
+  close(fd);
+  fd = -1;
+
+  if ((ctx = md2mdoc_ctx_new()) == NULL)
+    goto fail;
+  ctx->flushat = (size_t)-1;                            /* Keep every token. */
+  ctx->markup = doc->markup;
+  ctx->frags = doc->frags;
+  ctx->incdir = frag->dir;
+  memcpy(ctx->incopen, doc->incopen, doc->incdepth * sizeof(*ctx->incopen));
+  ctx->incopen[doc->incdepth] = frag->path;
+  ctx->incdepth = doc->incdepth + 1;
+  ctx->loading = frag;
+  ctx->lint.fn = countproblem;                          /* Only counted: `include` reports them. */
+  ctx->lint.arg = &frag->problems;
+  ctx->lint.flags = 0;
+  ctx->lint.at.file = frag->path;
+  parse(ctx, frag->text, frag->text + frag->len);
+  if (ctx->incerror != 0) {
+    doc->incerror = ctx->incerror;
+    memcpy(doc->incfail, ctx->incfail, sizeof(doc->incfail));
+    errno = ctx->incerror;
+    goto fail;
+  }
+  if (ctx->ir.error || (ctx->ir.ntok > 0 &&
+                        (frag->tok = malloc(ctx->ir.ntok * sizeof(*frag->tok))) == NULL)) {
+    errno = ENOMEM;
+    goto fail;
+  }
+  for (blk = ctx->ir.first; blk != NULL && blk->n > 0; blk = blk->next) {
+    n = blk->n;
+    memcpy(frag->tok + frag->ntok, blk->tok, n * sizeof(*frag->tok));
+    frag->ntok += n;
+  }
+  frag->codeblock = ctx->codeblock;
+  frag->optionslist = ctx->optionslist;
+  frag->dashorenumlist = ctx->dashorenumlist;
+  frag->nameflag = ctx->nameflag;
+  frag->commentflag = ctx->commentflag;
+  frag->stripwhitespace = ctx->stripwhitespace;
+  frag->lists = ctx->lint.lists;
+  memcpy(frag->section, ctx->section, sizeof(frag->section));
+  frag->whatis = ctx->whatis;
+  md2mdoc_ctx_free(ctx);
+  return frag;
+
+fail:
+  error = errno;
+  if (fd != -1)
+    close(fd);
+  md2mdoc_ctx_free(ctx);
+  freefragment(frag);
+  errno = error;
+  return NULL;
+}
+
+/**
+ * freefragment --
+ *      Release a fragment.
+ */
+static void freefragment(struct fragment *frag) {
+  free(frag->path);
+  free(frag->dir);
+  free(frag->text);
+  free(frag->deps);
+  free(frag->tok);
+  free(frag);
+}
+
+/**
+ * nsnow --
+ *      A monotonic clock, in nanoseconds.
+ */
+static inline unsigned long long nsnow(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/**
+ * cimemcmp --
+ *      Preform a case independent memory region compare.
+ *
+ * Compare up to n bytes from s1 and s2 ignoring ASCII case differences
+ * for alphabetic characters (works by folding space bit).
+ *
+ * Parameters:
+ *  s1   -  pointer to first memory region
+ *  s2   -  pointer to second memory region
+ *  n    -  number of bytes to compare
+ *
+ * Returns: <0 if s1 < s2, 0 if equal, >0 if s1 > s2 (same semantics as memcmp).
+ * Notes: Operates on raw bytes; caller should ensure buffers are at least n bytes.
+ */
+static int cimemcmp(const void *s1, const void *s2, size_t n) {
+  if (n != 0) {
+    const unsigned char *p1 = s1, *p2 = s2;
+
+    do {
+      if ((*p1++ & ~' ') != (*p2++ & ~' '))
+        return (*--p1 - *--p2);
+    } while (--n != 0);
+  }
+  return (0);
+}
+
+/**
+ * read_upto --
+ *      Find the token at *src: the characters up to a delimiter or
+ *      the end of the line. The token is returned in place, so it may
+ *      be any length.
+ * Parameters:
+ *  src      -   Pointer to input pointer; advanced as characters are
+ *               consumed.
+ *  end      -   End of the line.
+ *  delims   -   Delimiter set to stop at (not part of the token).
+ *  tok      -   Receives the start of the token.
+ *  toklen   -   Receives the length of the token.
+ *
+ * Returns 1 if delim was found, 0 otherwise.
+ */
+static int read_upto(const char **src, const char *end, const struct scanset *delims, const char **tok, size_t *toklen, int eatfinalchar) {
+    const char *p = *src;
+
+    *tok = p;
+    *toklen = 0;
+    if (delims == NULL) {                               /* nothing to stop on */
+        return 0;
+    }
+
+    p = scanfind(delims, p, end);                       /* stops on a delimiter, NUL or `end` */
+    *toklen = (size_t)(p - *src);
+
+    if (p < end && *p) {
+      if (eatfinalchar) p++;                           /* consume closing delim */
+      *src = p;
+      return 1;
+    }
+   return 0;
+}
+
+/**
+ * skip_one_space_or_newline --
+ *      If *src points to a single space or newline, advance past it.
+ * Parameters:
+ *  src  -   Pointer to input pointer; may be advanced by one.
+ *  end  -   End of the line.
+ */
+static void skip_one_space_or_newline(const char **src, const char *end) {
+    if (*src < end && (**src == ' ' || **src == '\n'))
+      (*src)++;
+}
+
+/**
+ * classify --
+ *      Recognize the keyword, if any, the line at `str` starts with.
+ *      The first byte picks the candidate from `kwfirst`, so a line
+ *      costs one table lookup and (at most two) compares.
+ * Parameters:
+ *  str  -   Start of the line (after any leading space is stripped).
+ *  end  -   End of the line.
+ *
+ * Returns the `linekind` of the keyword, or LK_TEXT.
+ */
+static enum linekind classify(const char *str, const char *end) {
+  const struct keyword *kw;
+  unsigned int k;
+
+  if (str >= end)
+    return LK_TEXT;
+  for (k = kwfirst[(unsigned char)*str]; k != 0; k = kw->next) {
+    kw = &keywords[k];
+    if ((size_t)(end - str) >= kw->len &&
+        (kw->folded ? cimemcmp(str, kw->lit, kw->len) : memcmp(str, kw->lit, kw->len)) == 0)
+      return (enum linekind)kw->kind;
+  }
+  return LK_TEXT;
+}
+
+/**
+ * hasprefix --
+ *      Case independent check that the line at `str` starts with the
+ *      `n` byte string `lit`.
+ */
+static int hasprefix(const char *str, const char *end, const char *lit, size_t n) {
+  return (size_t)(end - str) >= n && cimemcmp(str, lit, n) == 0;
+}
+
+/**
+ * processnested --
+ *      Process inline (nested) tokens from string `s` and add
+ *      them to the document's IR.
+ *
+ * Parameters:
+ *  doc -   document being converted
+ *  s   -   String to parse
+ *  end -   End of the string
+ */
+static void processnested(md2mdoc_ctx *doc, const char *str, const char *end) {
+    const md2mdoc_markup *mk = doc->markup;
+    const struct macro *mac;
+    const char *p = str, *tok;
+    unsigned cntr = 0;
+    unsigned int act;
+    size_t n, toklen;
+
+    while (p < end && *p) {
+        switch (act = mk->action[(unsigned char)*p]) {  /* What the byte stands for (markup.h). */
+          case MK_MODIFIER:                             /* UNDOCUMENTED - "modifiers"
+                                                           Shortcut for '.Cm' (Command Modifier) */
+            p++;
+            if (cntr >= 1) putnl(doc);
+            read_upto(&p, end, &modifierdelims, &tok, &toklen, FALSE);
+            addtok(doc, TK_MODIFIER, tok, toklen);
+            skip_one_space_or_newline(&p, end);
+            break;
+          case MK_REFERENCE:                            /* UNDOCUMENTED - "reference"
+                                                           Shortcut for '.Nm' (project name) */
+            p++;
+            if (cntr >= 1) putnl(doc);
+            read_upto(&p, end, &referencedelims, &tok, &toklen, FALSE);
+            skip_one_space_or_newline(&p, end);
+            if (toklen >= 4 && memcmp(tok, "name", 4) == 0) {
+              addtok(doc, TK_NAMEREF, NULL, 0);
+            } else {                                    /* UNDOCUMENTED - "section reference" */
+              addtok(doc, TK_SECREF, tok, toklen);
+              skip_one_space_or_newline(&p, end);
+           }
+            break;
+        case MK_BOLD:                                   /* bold -> .Sy %s\n */
+            p++;                                        /* eat '*' */
+//:~              read_upto(&p, end, "*,) \n;:", tok, sizeof(tok), TRUE);
+            read_upto(&p, end, &bolddelims, &tok, &toklen, TRUE);
+            if (cntr >= 1) putnl(doc);
+            addtok(doc, TK_BOLD, tok, toklen);
+            skip_one_space_or_newline(&p, end);
+            break;
+
+        case MK_ITALIC:                                 /* italic -> .Em %s\n */
+            p++;
+//:~              read_upto(&p, end, "_ \n,.;:)", tok, sizeof(tok), TRUE);
+            read_upto(&p, end, &italicdelims, &tok, &toklen, TRUE);
+            if (cntr >= 1) putnl(doc);
+            addtok(doc, TK_ITALIC, tok, toklen);
+            skip_one_space_or_newline(&p, end);
+            break;
+
+        case MK_LITERAL:                                /* inline literal -> .Li %s\n */
+            p++;
+            read_upto(&p, end, &literaldelims, &tok, &toklen, TRUE);
+            if (cntr >= 1) putnl(doc);
+            addtok(doc, TK_LITERAL, tok, toklen);
+            skip_one_space_or_newline(&p, end);
+            break;
+
+        case MK_XREF:                                   /* reference -> .Xr %s\n */
+            p++;
+            read_upto(&p, end, &xrefdelims, &tok, &toklen, TRUE);
+            if (cntr >= 1) putnl(doc);
+            addtok(doc, TK_XREF, tok, toklen);
+            while (AT(p) == ' ' || \
+                AT(p) == ',' || \
+                AT(p) == '.')
+              text(doc, p++, 1);
+            if(AT(p) != '\n') putnl(doc);
+            continue;
+
+        case MK_ESCAPE:                                 /* escape: \x\ -> x (or consume next char if present) */
+            p++;                                        /* eat backslash */
+            if (AT(p) && *p != '\\') {
+                text(doc, p, 1);                        /* copy the single escaped character */
+                p++;                                    /* consume escaped char */
+                if (AT(p) == '\\') p++;                 /* eat backslash if found */
+            } else if (AT(p) == '\\') {
+                /* literal backslash sequence "\\": output single backslash and consume */
+                text(doc, p, 1);
+                p++;
+            } else {
+                /* dangling backslash at end: output it */
+                text(doc, p - 1, 1);
+            }
+            break;
+
+        case MK_TEXT:
+            /* regular characters: copy the whole run up to the next marker */
+            n = (size_t)(scanfind(&mk->markers, p, end) - p);
+            text(doc, p, n);
+            p += n;
+            break;
+
+        default:                                        /* a marker from a mapping file -> .Xx %s\n */
+            mac = &mk->macro[act - MK_MACRO];
+            p++;
+            read_upto(&p, end, &mac->delims, &tok, &toklen, TRUE);
+            if (cntr >= 1) putnl(doc);
+            addtok(doc, TK_MACRO, tok, toklen)->flags = (unsigned char)(act - MK_MACRO);
+            skip_one_space_or_newline(&p, end);
+            break;
+        } /* switch */
+        cntr++;
+    } /* while */
+}
+
+/**
+ * processline --
+ *      This process the current line from the file and handles
+ *      line-level constructs (leading tokens, block state--codeblock,
+ *      optionslist, etc.).
+ *
+ * Parameters:
+ *  doc -   document being converted
+ *  str -   string to search
+ *  end -   end of the line (one past the newline, if any)
+ */
+static void processline(md2mdoc_ctx *doc, const char *str, const char *end) {
+    enum linekind kind;
+    int c, ch;
+    c = *str;
+
+    if(doc->nameflag == 1) {                            /* If we are supposed to process a name... */
+      setnames(doc, str, end);                          /* For whatis(1). */
+      addtok(doc, TK_NAME, NULL, 0);
+      do {                                              /* Print this chars until NOT a dash */
+        if (*str != '-')
+          text(doc, str, 1);
+        ++str;                                          /* Eat the char */
+        if (AT(str) == '-') {                           /* If we've encounted a dash, check for a doubledash. */
+          if(end - str >= 2 && memcmp(str, "--", 2) == 0) { /* double dashes signifies a `namedescription`. */
+            str += 2;                                   /* Eat the `--` string */
+            addtok(doc, TK_DESC, NULL, 0);
+          }
+        }
+      } while (str < end && *str != '\n');
+      doc->nameflag = 0;                                /* turn off the `nameflag`. */
+      putnl(doc);
+    }
+
+    if (doc->codeblock == 0 || doc->stripwhitespace == 1) {
+      stripspaces();
+    }
+    kind = classify(str, end);
+    switch (c) {
+      /* doc->stripwhitespace = 0; */
+      case '\n':                                        // Newlines are replaced with a break.
+        if (doc->dashorenumlist == 1) {
+          listend(doc);
+          doc->optionslist = 0;
+          doc->dashorenumlist = 0;
+        }
+        addtok(doc, TK_PARA, NULL, 0);
+        return;
+
+      case '0':
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7':
+      case '8':
+      case '9':
+        str += 1;
+        if(doc->dashorenumlist == 0) {                  /* Check to see if the `dashorenumlist` flag has been set.
+                                                           if it hasn't, create the list block and set the flag. */
+          doc->dashorenumlist = 1;
+          listbegin(doc, LIST_ENUM);
+         }
+
+        if (doc->dashorenumlist == 1 && AT(str) != '\n') { /* If the dashorenumlist flag has been set, and the next char
+                                                           is NOT a newline, this is just a list item. */
+          while (str < end && !ISALPHA(*str)) str++; /* if the next item is not a (A-Za-z) char. */
+          addtok(doc, TK_ITEM, NULL, 0);                            /* Add a 'list item' macro */
+          putnl(doc); rest(doc, str, end);   /* Print the string */
+        }
+        break;
+
+      case 'a':                                         // Look for the string 'author:'
+        if (kind == LK_AUTHOR) {
+          str += 7;                                     /* Eat the `author:` string. */
+          addtok(doc, TK_AUTHOR, NULL, 0); rest(doc, str, end);
+          return;
+        }
+
+      case 'd':                                         // Date
+        if (kind == LK_DATE) {
+          str += 5;                                     /* Eat the `date:` string */
+          addtok(doc, TK_DATE, NULL, 0); rest(doc, str, end);
+          return;
+        }
+
+      case 't':                                         // Look for the string 'title:'
+        if (kind == LK_TITLE) {
+          str += 6;                                     /* Eat the `title:` string. */
+          setsection(doc, str, end);
+          addtok(doc, TK_TITLE, NULL, 0); rest(doc, str, end); addtok(doc, TK_TITLEEND, NULL, 0);
+          return;
+        }
+
+      case '#':                                         // Section break (heading)
+        if (kind == LK_SUBSECTION) {
+          while (str < end && !ISALPHA(*str)) str++;
+          addtok(doc, TK_SUBSECTION, str, (size_t)(end - str)); /* sanitized when written */
+          return;
+        } else if (kind == LK_SECTION) {
+          while (str < end && !ISALPHA(*str)) str++;
+          addtok(doc, TK_SECTION, str, (size_t)(end - str)); /* sanitized when written */
+          if(hasprefix(str, end, "NAME", 4)) {           /* If we've found a "NAME" heading, we can
+                                                           assume the section looks something like:
+                                                              # NAME
+                                                              ProjectName -- Brief Decription
+                                                              so we set some flags for the default
+                                                              condition of this case statment to set
+                                                              the .Nm and .Nd mdoc macros.  */
+            doc->nameflag = 1;
+          }
+        }
+
+        return;
+      case '[':                                         // Start of an optional argument
+                                                        // EG: to process the "[-abc]"
+        str++;                                          /* Eat the bracket */
+        addtok(doc, TK_OPTIONAL, NULL, 0);
+        if (AT(str) == '-') {
+          str++;
+          addtok(doc, TK_FLAG, NULL, 0);
+          do {                                         /* Print the chars until space char */
+            if (AT(str) != ' ')
+              textat(doc, str, end);
+            ++str;                                     /* eat the dash */
+          } while (AT(str) != ' ' && AT(str) != ']' && AT(str) != '\n' && AT(str) != '\0');
+          if (AT(str) == ' ') {                            /* If we've found a space, this means we've found an
+                                                           optional argument.
+                                                           eg [-abc optional]
+                                                                   ^            */
+            addtok(doc, TK_ARG, NULL, 0)->flags = ARG_SPACED;
+
+
+            do {                                       /* Print the chars until we find the closing bracket */
+              ++str;                                   /* eat the space */
+
+                if(AT(str) == '[') {                      // If we locate a bracket at this
+                                                       // level, we've found another layer
+                                                       // of optional arguments...
+                                                       // EG
+                                                       // [-abc [optional]]
+                                                       //       ^
+                do {                                   /* Print the chars until we find the closing bracket */
+                  ch = AT(str);
+                  textat(doc, str, end);
+                  ++str;
+                } while (ch != ']' && AT(str) != '\n' && AT(str) != '\0');
+                break;
+               }
+
+              if (AT(str) != ']')
+                textat(doc, str, end);
+            } while (AT(str) != ']' && AT(str) != '\n' && AT(str) != '\0');
+          }
+          ++str;                                        /* Eat the last bracket */
+        } else {                                        /* Assume this is just a plain optional arguemnt */
+          addtok(doc, TK_ARG, NULL, 0)->flags = ARG_SPACED;
+           do {                                         /* Print the chars until we find the closing bracket */
+             if (AT(str) != ']')
+               textat(doc, str, end);
+             ++str;                                     /* Eat the closing bracket */
+           } while (AT(str) != ']' && AT(str) != '\n' && AT(str) != '\0');
+        }
+
+        putnl(doc);
+        break;
+
+      case '-':                                         // A list item or a single dash is a list terminator
+                                                        // EG: "-f" or "-f file" or just "-"
+        if (kind == LK_COMMENTCLOSE) {                  /* First check if this is the end of a comment block */
+          doc->commentflag = 0;
+          return;
+        }
+        ++str;                                          /* eat the dash */
+
+        if(doc->optionslist == 0) {                     /* Check to see if the `optionslist` flag has been set.
+                                                           if it hasn't, create the list block and set the flag. */
+          doc->optionslist = 1;
+          listbegin(doc, LIST_TAG);
+         }
+
+        if (doc->optionslist == 1 && AT(str) != '\n') { /* If the optionslist flag has been set, and the next char
+                                                           is NOT a newline, this is just a list item. */
+          addtok(doc, TK_ITEM, NULL, 0);                            /* Add a 'list item' macro */
+
+          if (ISALPHA(AT(str)))                         /* if the next item is (A-Za-z) char. */
+//:~            if (isspace(*str) == 0)                       /* if the next item is a space char. */
+            addtok(doc, TK_FLAG, NULL, 0);                          /* Add a 'flag' macro. */
+
+          textat(doc, str, end);                        /* Print the flag. */
+          ++str;
+
+          if (AT(str) == ' ') {                            /* if we find a space after the flag, this is an argument
+                                                           EG: "-f argument"
+                                                                  ^           */
+
+            if (AT(str + 1) == '-') {                    /* if we find a double dash, we assume there is a "long option" next"
+                                                            EG: "-f --file"
+                                                                    ^       */
+              if (strncmp(str, "--", 2)) {
+                str += 2;
+                addtok(doc, TK_FLAG, NULL, 0);
+                while (str < end && *str != ' ' && *str != '\n') {
+                  text(doc, str, 1);
+                  str++;
+                }
+              }
+              if (AT(str) == '\n') {
+                putnl(doc);
+                break;
+              }
+            }
+
+            addtok(doc, TK_ARG, NULL, 0); rest(doc, str, end);  /* Print the 'argument' macro and the string. */
+          } else {
+            rest(doc, str, end);                     /* else just print the line. */
+          }
+          ++str;
+        }
+
+        if (AT(str) == '\n' && doc->optionslist == 1) { /* However, if the line was only a dash and the optionslist
+                                                           is set then we need to close the item list. */
+          listend(doc);
+          doc->optionslist = 0;
+          doc->dashorenumlist = 0;
+        }
+        break;
+
+      case '~':                                         // An alternate list terminator or list item
+        str++;
+        if (AT(str) == '\n' && doc->optionslist == 1) {
+          listend(doc);
+          doc->optionslist = 0;
+          doc->dashorenumlist = 0;
+          return;
+        }
+        if (doc->optionslist == 0) {
+          doc->optionslist = 1;
+          doc->dashorenumlist = 1;
+          listbegin(doc, LIST_DASH);
+        }
+        if (doc->optionslist == 1 && AT(str) != '\n') {
+          addtok(doc, TK_ITEM, NULL, 0);
+          if (AT(str) == ' ') {
+            putnl(doc); rest(doc, ++str, end);
+            break;
+          }
+        }
+        return;
+
+      case '<':                                         // The start of a `no format` section (this is also the
+                                                        // symbol used in vim's docformat).
+        if (kind == LK_COMMENTOPEN) {                   /* Start of a comment block */
+          doc->commentflag = 1;
+          break;
+        }
+        addtok(doc, TK_LITBEGIN, NULL, 0);
+        doc->stripwhitespace = 0;                       /* Disable stripwhitespace. */
+        doc->codeblock = 1;                             /* Set the `codeblock` flag */
+        break;
+
+      case '>':                                         // The end of a `no format` section
+        addtok(doc, TK_LITEND, NULL, 0);
+        /* doc->stripwhitespace = 1; */
+        doc->codeblock = 0;
+        break;
+
+      case '`':                                         // Code block
+                                                        //   In markdown, READMEs, forum posts, etc.
+                                                        //   codeblocks are defined with three (3) backticks.
+        if (kind == LK_FENCE) {
+          if (doc->codeblock == 0) {                    /* Check to see if the `codeblock` flag has been set. */
+            addtok(doc, TK_LITBEGIN, NULL, 0);
+            doc->stripwhitespace = 0;                   /* Disable stripwhitespace. */
+            doc->codeblock = 1;
+          } else if (doc->codeblock == 1) {
+            addtok(doc, TK_LITEND, NULL, 0);
+            /* doc->stripwhitespace = 1; */
+            doc->codeblock = 0;
+          }
+          return;
+        }
+
+      case 'i':                                         // include: another file
+        if (kind == LK_INCLUDE && doc->frags != NULL && doc->codeblock == 0 && doc->commentflag == 0) {
+          include(doc, str + 8, end);                   /* Eat the `include:` string. */
+          return;
+        }
+        /* FALLTHROUGH */
+
+      default:
+        if (doc->commentflag == 1) {
+          return;
+        }
+
+        if (doc->codeblock == 0) {                      /* If we're not in a clode block... */
+          if (doc->stats != NULL)                       /* Check the rest of the string for nested elements. */
+            nestedcounted(doc, str, end);
+          else
+            processnested(doc, str, end);
+        } else {                                        /* otherwise just print the line. */
+          rest(doc, str, end);
+          break;
+        }
+    }
+} ///:~
@@ -0,0 +1,172 @@
+//===---------------------------------------------------*- C -*---===
+//: md2mdoc.h
+//
+// DESCRIPTION
+// Public interface of libmd2mdoc, the markdown to mdoc converter
+// used by the md2mdoc utility. A conversion context holds all of the
+// state for one document at a time, so a program may convert in
+// several threads at once by giving each thread its own context.
+// Besides mdoc, a page can be written as man(7) or HTML; any of the
+// formats can be produced together from a single parse.
+//
+// Example:
+//      md2mdoc_ctx *ctx = md2mdoc_ctx_new();
+//      md2mdoc_convert(ctx, markdown, length, md2mdoc_file_sink, stdout);
+//      md2mdoc_ctx_free(ctx);
+//===-------------------------------------------------------------===
+#ifndef MD2MDOC_H
+#define MD2MDOC_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//-------------------------------------------------------------------
+// Constants Declarations
+//-------------------------------------------------------------------
+#define MD2MDOC_MDOC 0                                  /* Output formats. */
+#define MD2MDOC_MAN 1
+#define MD2MDOC_HTML 2
+#define MD2MDOC_NFORMATS 3
+
+#define MD2MDOC_LINT_CLOSE 1                            /* `md2mdoc_ctx_lint`: close blocks left open. */
+
+#define MD2MDOC_SPLITMIN (256 * 1024)                   /* Smallest input `md2mdoc_ctx_threads` splits. */
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+typedef struct md2mdoc_ctx md2mdoc_ctx;                 /* Opaque conversion context. */
+typedef struct md2mdoc_frags md2mdoc_frags;             /* Opaque cache of `include:` files. */
+typedef struct md2mdoc_markup md2mdoc_markup;           /* Opaque inline markup table. */
+
+/*
+ * md2mdoc_sink --
+ *      Receives the converted output in blocks. Returns 0 on success
+ *      or -1 to report a write failure back to the caller.
+ */
+typedef int (*md2mdoc_sink)(void *arg, const char *buf, size_t len);
+
+/*
+ * md2mdoc_lint --
+ *      Receives each problem found by a context checking its documents
+ *      (see `md2mdoc_ctx_lint`): the file it is in (NULL for the
+ *      document, or the path of an included file), the line and what
+ *      is wrong. It is called on the thread doing the conversion, once
+ *      for each problem of each file included.
+ */
+typedef void (*md2mdoc_lint)(void *arg, const char *file, unsigned long line, const char *msg);
+
+/*
+ * md2mdoc_buf --
+ *      A growable memory buffer usable as a sink argument together
+ *      with `md2mdoc_buf_sink`. Start it zeroed; release `data` with
+ *      free(3).
+ */
+struct md2mdoc_buf {
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+/*
+ * md2mdoc_stats --
+ *      What the conversions made with a context did, counted while the
+ *      context has been given this structure with `md2mdoc_ctx_stats`
+ *      (the counts add up over conversions). Every field is an
+ *      unsigned long long; times are in nanoseconds.
+ */
+struct md2mdoc_stats {
+  unsigned long long bytes_in;                          /* Markdown read. */
+  unsigned long long bytes_out;                         /* Output written, over all formats. */
+  unsigned long long lines;
+  unsigned long long read_ns;                           /* Mapping or reading the input. */
+  unsigned long long parse_ns;                          /* In processline (nested included). */
+  unsigned long long nested_ns;                         /* In processnested. */
+  unsigned long long emit_ns;                           /* Writing the output formats. */
+  unsigned long long sections;
+  unsigned long long subsections;
+  unsigned long long paragraphs;
+  unsigned long long lists_opened;
+  unsigned long long lists_closed;
+  unsigned long long items;
+  unsigned long long codeblocks;
+  unsigned long long flags;                             /* Option flags in lists and synopses. */
+  unsigned long long optional;                          /* `[...]` synopsis lines. */
+  unsigned long long bold;                              /* Inline markers, by type. */
+  unsigned long long italic;
+  unsigned long long literal;
+  unsigned long long xref;
+  unsigned long long modifier;
+  unsigned long long secref;
+  unsigned long long nameref;
+  unsigned long long macros;                            /* Markers from a mapping file. */
+  unsigned long long long_tokens;                       /* Inline tokens the old tok[512] would cut. */
+};
+
+/*
+ * md2mdoc_output --
+ *      One output of `md2mdoc_convert_to`: a format and the sink that
+ *      receives it.
+ */
+struct md2mdoc_output {
+  int format;                                           /* MD2MDOC_MDOC, _MAN or _HTML. */
+  md2mdoc_sink sink;
+  void *arg;
+};
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+md2mdoc_ctx *md2mdoc_ctx_new(void);                     /* Allocate a context (NULL on failure). */
+void md2mdoc_ctx_free(md2mdoc_ctx *ctx);
+
+int md2mdoc_convert(md2mdoc_ctx *ctx, const char *in, size_t len,
+                    md2mdoc_sink sink, void *arg);      /* Convert a buffer. */
+int md2mdoc_convert_fd(md2mdoc_ctx *ctx, int fd,
+                       md2mdoc_sink sink, void *arg);   /* Convert a whole file or stream. */
+int md2mdoc_convert_to(md2mdoc_ctx *ctx, const char *in, size_t len,
+                       const struct md2mdoc_output *outs, size_t nouts); /* ... to several formats. */
+int md2mdoc_convert_fd_to(md2mdoc_ctx *ctx, int fd,
+                          const struct md2mdoc_output *outs, size_t nouts);
+
+int md2mdoc_format(const char *name);                   /* Format by name, or -1. */
+const char *md2mdoc_format_name(int format);
+
+void md2mdoc_ctx_stats(md2mdoc_ctx *ctx, struct md2mdoc_stats *stats); /* Count into `stats` (NULL: stop). */
+void md2mdoc_ctx_threads(md2mdoc_ctx *ctx, unsigned int n); /* Parse a large buffer on `n` threads. */
+void md2mdoc_ctx_lint(md2mdoc_ctx *ctx, md2mdoc_lint fn, void *arg, int flags); /* Check structure (NULL: stop). */
+void md2mdoc_ctx_incremental(md2mdoc_ctx *ctx, int on); /* Reparse only the sections that changed. */
+
+md2mdoc_frags *md2mdoc_frags_new(void);                 /* Allocate a fragment cache (NULL on failure). */
+void md2mdoc_frags_free(md2mdoc_frags *frags);
+void md2mdoc_frags_each(md2mdoc_frags *frags, void (*fn)(void *arg, const char *path),
+                        void *arg);                    /* Each file in the cache. */
+void md2mdoc_ctx_include(md2mdoc_ctx *ctx, md2mdoc_frags *frags,
+                         const char *dir);              /* Allow `include:` lines. */
+const char *md2mdoc_include_failed(const md2mdoc_ctx *ctx); /* File that failed the conversion. */
+int md2mdoc_has_include(const char *data, size_t len); /* Any `include:` line in the text? */
+
+md2mdoc_markup *md2mdoc_markup_new(const char *text, size_t len,
+                                   unsigned int *line); /* Compile a mapping file (NULL on failure). */
+void md2mdoc_markup_free(md2mdoc_markup *markup);
+void md2mdoc_ctx_markup(md2mdoc_ctx *ctx, const md2mdoc_markup *markup); /* NULL: the built-in markers. */
+
+const char *md2mdoc_section(const md2mdoc_ctx *ctx);    /* Section from the last `title:` line. */
+const char *md2mdoc_names(const md2mdoc_ctx *ctx);      /* Names on the NAME line, before `--`. */
+const char *md2mdoc_description(const md2mdoc_ctx *ctx); /* Description on the NAME line. */
+const char *md2mdoc_title(const md2mdoc_ctx *ctx);      /* Title on the `title:` line. */
+const char *md2mdoc_version(void);
+
+int md2mdoc_file_sink(void *arg, const char *buf, size_t len); /* `arg` is a FILE *. */
+int md2mdoc_fd_sink(void *arg, const char *buf, size_t len);   /* `arg` is an int * (descriptor). */
+int md2mdoc_buf_sink(void *arg, const char *buf, size_t len);  /* `arg` is a struct md2mdoc_buf *. */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MD2MDOC_H */
@@ -0,0 +1,168 @@
+//===---------------------------------------------------*- C -*---===
+//: mdoc.c
+//
+// DESCRIPTION
+// The mdoc(7) emitter: writes the IR built by the parser as mdoc
+// macros. Each token maps onto a fixed macro (or run of text), or
+// for markers from a mapping file onto the macro the file names, so
+// this is a straight walk over the tokens.
+//===-------------------------------------------------------------===
+
+#include "ir.h"
+#include "markup.h"
+
+//-------------------------------------------------------------------
+// Constants Declarations
+//-------------------------------------------------------------------
+#define SECTION ".Sh"
+#define SUBSECTION ".Ss"
+#define BOLD ".Sy"
+#define ITALIC ".Em"
+#define INLINE ".Li"
+#define REFERENCE ".Xr"
+#define OPTIONAL ".Op"
+#define FLAG " Fl "
+#define ARGUMENT " Ar "
+#define ITEM ".It"
+#define AUTHOR ".Au"
+#define DATE ".Dd"
+#define TITLE ".Dt"
+#define NAME ".Nm"
+#define SECTIONREFERENCE ".Sx"
+#define COMMANDMODIFIER ".Cm"
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static void macroline(struct outbuf *out, const char *macro, size_t len, const struct token *t);
+static void emit_mdoc(struct emitter *em, const struct token *tok, size_t n);
+
+//-------------------------------------------------------------------
+// Global Variables
+//-------------------------------------------------------------------
+const struct format fmt_mdoc = { "mdoc", NULL, emit_mdoc, NULL };
+
+/**
+ * macroline --
+ *      Write a macro line carrying the token's text: "<macro> text\n".
+ */
+static void macroline(struct outbuf *out, const char *macro, size_t len, const struct token *t) {
+  bufwrite(out, macro, len);
+  bufwrite(out, t->str, t->len);
+  bufputc(out, '\n');
+}
+
+/**
+ * emit_mdoc --
+ *      Write `n` tokens as mdoc.
+ * Parameters:
+ *  em  -   Emitter (only its output buffer and markup table are used)
+ *  tok -   Tokens to write
+ *  n   -   Number of tokens
+ */
+static void emit_mdoc(struct emitter *em, const struct token *tok, size_t n) {
+  const struct token *t, *end = tok + n;
+  struct outbuf *out = &em->out;
+  const char *name;
+
+  for (t = tok; t < end; t++) {
+    switch (t->kind) {
+      case TK_TEXT:
+        bufref(out, t->str, t->len);
+        break;
+      case TK_SECTION:
+        BUFLIT(out, SECTION " ");
+        bufsanitized(out, t->str, t->len);              /* sanitize rest of string of all hashs */
+        bufputc(out, '\n');
+        break;
+      case TK_SUBSECTION:
+        BUFLIT(out, SUBSECTION " ");
+        bufsanitized(out, t->str, t->len);
+        bufputc(out, '\n');
+        break;
+      case TK_PARA:
+        BUFLIT(out, ".Pp\n");
+        break;
+      case TK_LISTBEGIN:
+        if ((t->flags & ~TOK_NL) == LIST_ENUM)
+          BUFLIT(out, ".Bl -enum -offset indent -compact\n");
+        else if ((t->flags & ~TOK_NL) == LIST_DASH)
+          BUFLIT(out, ".Bl -dash -compact\n");
+        else
+          BUFLIT(out, ".Bl -tag -width Ds\n");
+        break;
+      case TK_ITEM:
+        BUFLIT(out, ITEM);
+        break;
+      case TK_LISTEND:
+        BUFLIT(out, ".El\n");
+        break;
+      case TK_FLAG:
+        BUFLIT(out, FLAG);
+        break;
+      case TK_ARG:
+        if (t->flags & ARG_SPACED)
+          BUFLIT(out, ARGUMENT);
+        else
+          BUFLIT(out, " Ar");
+        break;
+      case TK_OPTIONAL:
+        BUFLIT(out, OPTIONAL);
+        break;
+      case TK_LITBEGIN:
+        BUFLIT(out, ".Bd -literal -offset indent\n");
+        break;
+      case TK_LITEND:
+        BUFLIT(out, ".Ed\n");
+        break;
+      case TK_NAME:
+        BUFLIT(out, NAME " ");
+        break;
+      case TK_DESC:
+        BUFLIT(out, "\n.Nd");
+        break;
+      case TK_NAMEREF:
+        BUFLIT(out, NAME "\n");
+        break;
+      case TK_SECREF:
+        macroline(out, SECTIONREFERENCE " ", sizeof(SECTIONREFERENCE), t);
+        break;
+      case TK_MODIFIER:
+        macroline(out, COMMANDMODIFIER " ", sizeof(COMMANDMODIFIER), t);
+        break;
+      case TK_BOLD:
+        macroline(out, BOLD " ", sizeof(BOLD), t);
+        break;
+      case TK_ITALIC:
+        macroline(out, ITALIC " ", sizeof(ITALIC), t);
+        break;
+      case TK_LITERAL:
+        macroline(out, INLINE " ", sizeof(INLINE), t);
+        break;
+      case TK_XREF:
+        BUFLIT(out, REFERENCE " ");
+        bufsanitized(out, t->str, t->len);
+        break;
+      case TK_MACRO:
+        name = em->markup->macro[t->flags & ~TOK_NL].name;
+        bufputc(out, '.');
+        bufwrite(out, name, strlen(name));
+        macroline(out, " ", 1, t);
+        break;
+      case TK_AUTHOR:
+        BUFLIT(out, AUTHOR);
+        break;
+      case TK_DATE:
+        BUFLIT(out, DATE);
+        break;
+      case TK_TITLE:
+        BUFLIT(out, TITLE);
+        break;
+      case TK_TITLEEND:
+        BUFLIT(out, ".Os\n");
+        break;
+    }
+    if (t->flags & TOK_NL)
+      bufputc(out, '\n');
+  }
+} ///:~
@@ -0,0 +1,167 @@
+//===---------------------------------------------------*- C -*---===
+//: scan.c
+//
+// DESCRIPTION
+// Find the first byte of a small set in a buffer. The SSE2 version
+// compares a whole block against every member of the set and ORs the
+// results together. The SSSE3 version classifies a block by looking
+// the low and high nibble of each byte up in two 16 entry tables (one
+// bit per distinct high nibble), so its cost does not grow with the
+// size of the set. Either way the lowest set bit of the mask is the
+// answer; whatever is left at the end of the buffer goes through the
+// scalar loop.
+//===-------------------------------------------------------------===
+
+#include "scan.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)            /* SSE2 is always there on x86-64. */
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+typedef const char *(*scanfn)(const struct scanset *set, const char *p, const char *end);
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static const char *scan_scalar(const struct scanset *set, const char *p, const char *end);
+#ifdef SCAN_X86
+static const char *scan_sse2(const struct scanset *set, const char *p, const char *end);
+static const char *scan_ssse3(const struct scanset *set, const char *p, const char *end);
+#endif
+
+//-------------------------------------------------------------------
+// Global Variables
+//-------------------------------------------------------------------
+static scanfn scanimpl = scan_scalar;                   /* Chosen by scan_init(). */
+
+/**
+ * scanset_init --
+ *      Build a set from the characters of `chars` (NUL is added).
+ *      Characters beyond SCANSET_MAX are ignored by the vector loops
+ *      but still honoured by the scalar one, so keep sets small.
+ */
+void scanset_init(struct scanset *set, const char *chars) {
+  unsigned int c, bit, ngroups = 0;
+  int group[16];
+
+  memset(set, 0, sizeof(*set));
+  set->chars[set->nchars++] = '\0';
+  set->member[0] = 1;
+  for (; *chars; chars++) {
+    if (set->member[(unsigned char)*chars])
+      continue;
+    set->member[(unsigned char)*chars] = 1;
+    if (set->nchars < SCANSET_MAX)
+      set->chars[set->nchars++] = *chars;
+  }
+
+  set->nibbles = 1;                                     /* Give each high nibble in use a bit. */
+  memset(group, -1, sizeof(group));
+  for (c = 0; c < 256; c++) {
+    if (!set->member[c])
+      continue;
+    if (group[c >> 4] == -1) {
+      if (ngroups == 8) {                               /* Too many to fit a byte; compare instead. */
+        set->nibbles = 0;
+        break;
+      }
+      group[c >> 4] = (int)ngroups++;
+    }
+    bit = 1u << group[c >> 4];
+    set->hitab[c >> 4] = (unsigned char)bit;
+    set->lotab[c & 15] |= (unsigned char)bit;
+  }
+}
+
+/**
+ * scan_init --
+ *      Select the fastest search the processor supports.
+ */
+void scan_init(void) {
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3"))                  /* scan_ssse3() falls back on sets */
+    scanimpl = scan_ssse3;                              /*   that do not fit the nibble tables. */
+  else
+    scanimpl = scan_sse2;
+#endif
+}
+
+/**
+ * scanfind --
+ *      Find the first byte of `set` in [p, end).
+ *
+ * Returns a pointer to it, or `end` if there is none.
+ */
+const char *scanfind(const struct scanset *set, const char *p, const char *end) {
+  if (end - p < 16)                                     /* Not worth a vector. */
+    return scan_scalar(set, p, end);
+  return scanimpl(set, p, end);
+}
+
+/**
+ * scan_scalar --
+ *      One byte at a time with a table lookup.
+ */
+static const char *scan_scalar(const struct scanset *set, const char *p, const char *end) {
+  for (; p < end; p++)
+    if (set->member[(unsigned char)*p])
+      return p;
+  return end;
+}
+
+#ifdef SCAN_X86
+/**
+ * scan_sse2 --
+ *      Sixteen bytes at a time.
+ */
+static const char *scan_sse2(const struct scanset *set, const char *p, const char *end) {
+  __m128i want[SCANSET_MAX], block, hit;
+  unsigned int i, n = set->nchars;
+  int mask;
+
+  for (i = 0; i < n; i++)
+    want[i] = _mm_set1_epi8(set->chars[i]);
+  for (; end - p >= 16; p += 16) {
+    block = _mm_loadu_si128((const __m128i *)p);
+    hit = _mm_cmpeq_epi8(block, want[0]);
+    for (i = 1; i < n; i++)
+      hit = _mm_or_si128(hit, _mm_cmpeq_epi8(block, want[i]));
+    if ((mask = _mm_movemask_epi8(hit)) != 0)
+      return p + __builtin_ctz((unsigned int)mask);
+  }
+  return scan_scalar(set, p, end);
+}
+
+/**
+ * scan_ssse3 --
+ *      Sixteen bytes at a time using the nibble tables.
+ */
+__attribute__((target("ssse3")))
+static const char *scan_ssse3(const struct scanset *set, const char *p, const char *end) {
+  __m128i lotab, hitab, low, block, lo, hi, hit;
+  int mask;
+
+  if (!set->nibbles)
+    return scan_sse2(set, p, end);
+  lotab = _mm_loadu_si128((const __m128i *)set->lotab);
+  hitab = _mm_loadu_si128((const __m128i *)set->hitab);
+  low = _mm_set1_epi8(0x0f);
+  for (; end - p >= 16; p += 16) {
+    block = _mm_loadu_si128((const __m128i *)p);
+    lo = _mm_and_si128(block, low);
+    hi = _mm_and_si128(_mm_srli_epi16(block, 4), low);
+    hit = _mm_and_si128(_mm_shuffle_epi8(lotab, lo), _mm_shuffle_epi8(hitab, hi));
+    hit = _mm_cmpeq_epi8(hit, _mm_setzero_si128());
+    if ((mask = _mm_movemask_epi8(hit) ^ 0xffff) != 0)
+      return p + __builtin_ctz((unsigned int)mask);
+  }
+  return scan_scalar(set, p, end);
+}
+#endif /* SCAN_X86 */
@@ -0,0 +1,36 @@
+//===---------------------------------------------------*- C -*---===
+//: scan.h
+//
+// DESCRIPTION
+// Byte set search used by the converter to find the next inline
+// marker or token delimiter in a line. On x86-64 the search is done
+// 16 bytes at a time with SSE2 or SSSE3; the implementation is picked
+// once at run time. Other machines use a table driven scalar loop.
+//===-------------------------------------------------------------===
+#ifndef MD2MDOC_SCAN_H
+#define MD2MDOC_SCAN_H
+
+#include <stddef.h>
+
+#define SCANSET_MAX 16                                  /* Most characters a set may hold. */
+
+/*
+ * scanset --
+ *      A set of bytes to search for. NUL is always a member, so a
+ *      search stops at an embedded NUL the way the string functions
+ *      it replaces did.
+ */
+struct scanset {
+  unsigned int nchars;                                  /* Number of entries used in `chars`. */
+  char chars[SCANSET_MAX];                              /* The members (for the compare loop). */
+  int nibbles;                                          /* Set if `lotab`/`hitab` describe the set. */
+  unsigned char lotab[16];                              /* Nibble tables for the shuffle loop: */
+  unsigned char hitab[16];                              /*   b is a member if lotab[b & 15] & hitab[b >> 4]. */
+  unsigned char member[256];                            /* Membership table (for the scalar loop). */
+};
+
+void scanset_init(struct scanset *set, const char *chars); /* Build a set from a string of members. */
+void scan_init(void);                                   /* Pick the implementation; call once. */
+const char *scanfind(const struct scanset *set, const char *p, const char *end); /* First member in [p, end). */
+
+#endif /* MD2MDOC_SCAN_H */
@@ -0,0 +1,407 @@
+//===---------------------------------------------------*- C -*---===
+//: serve.c
+//
+// DESCRIPTION
+// A long running conversion server on a Unix domain socket (see
+// serve.h for the framing). Every connection is served by a thread
+// of its own holding its own md2mdoc context, request buffer and
+// reply buffer, all reused from one request to the next. The context
+// is incremental, so a page sent again with a small edit has only
+// the sections that changed parsed again. The only state shared
+// between connections is the set of counters and the cache of
+// included files. --stream-docs serves a single connection made of
+// the process's standard input and output, on the main thread.
+//===-------------------------------------------------------------===
+
+#include "serve.h"
+#include "md2mdoc.h"
+
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+/*
+ * counters --
+ *      What the server has done since it started.
+ */
+struct counters {
+  unsigned long long connections;                       /* Accepted. */
+  unsigned long long active;                            /* Open now. */
+  unsigned long long requests;                          /* Frames answered. */
+  unsigned long long errors;                            /* Answered with SERVE_ERROR. */
+  unsigned long long bytesin;                           /* Markdown converted. */
+  unsigned long long bytesout;                          /* Pages sent back. */
+  pthread_mutex_t lock;
+};
+
+/*
+ * conn --
+ *      One client connection.
+ */
+struct conn {
+  int in;                                               /* Requests come from here, */
+  int out;                                              /*   replies go here (the same socket). */
+  int format;                                           /* Output format of the server. */
+  md2mdoc_frags *frags;                                 /* Files read by `include:` lines. */
+  const md2mdoc_markup *markup;                         /* Inline markers, or NULL for the built-in ones. */
+};
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static void *serveconn(void *arg);                      /* Connection thread. */
+static int serveloop(const struct conn *c);             /* Answer the requests of a connection. */
+static int readfull(int fd, void *buf, size_t len);
+static int sendall(int fd, const char *data, size_t len);
+static int reply(int fd, int type, const char *data, size_t len);
+static void count(int type, size_t in, size_t out);
+static size_t formatstats(char *buf, size_t cap);
+
+//-------------------------------------------------------------------
+// Global Variables
+//-------------------------------------------------------------------
+static struct counters stats = { 0, 0, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * readfull --
+ *      Read exactly `len` bytes.
+ *
+ * Returns:
+ *  1 on success, 0 at end of file before anything was read, -1 on
+ *  failure or a short read.
+ */
+static int readfull(int fd, void *buf, size_t len) {
+  char *p = buf;
+  size_t got = 0;
+  ssize_t n;
+
+  while (got < len) {
+    if ((n = read(fd, p + got, len - got)) == 0)
+      return got == 0 ? 0 : -1;
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    got += (size_t)n;
+  }
+  return 1;
+}
+
+/**
+ * sendall --
+ *      Write all of `len` bytes to the socket.
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+static int sendall(int fd, const char *data, size_t len) {
+  ssize_t n;
+
+  while (len > 0) {
+    if ((n = write(fd, data, len)) == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/**
+ * reply --
+ *      Send one frame.
+ *
+ * Returns:
+ *  0 on success, -1 on failure.
+ */
+static int reply(int fd, int type, const char *data, size_t len) {
+  unsigned char hdr[SERVE_HDRSIZE];
+
+  hdr[0] = (unsigned char)type;
+  hdr[1] = (unsigned char)(len >> 24);
+  hdr[2] = (unsigned char)(len >> 16);
+  hdr[3] = (unsigned char)(len >> 8);
+  hdr[4] = (unsigned char)len;
+  if (sendall(fd, (const char *)hdr, sizeof(hdr)) == -1 || sendall(fd, data, len) == -1)
+    return -1;
+  return 0;
+}
+
+/**
+ * count --
+ *      Add an answered request to the counters.
+ * Parameters:
+ *  type    -   type of the reply
+ *  in      -   markdown bytes converted
+ *  out     -   page bytes sent
+ */
+static void count(int type, size_t in, size_t out) {
+  pthread_mutex_lock(&stats.lock);
+  stats.requests++;
+  if (type == SERVE_ERROR)
+    stats.errors++;
+  stats.bytesin += in;
+  stats.bytesout += out;
+  pthread_mutex_unlock(&stats.lock);
+}
+
+/**
+ * formatstats --
+ *      Write the counters as text.
+ *
+ * Returns:
+ *  The length of the text.
+ */
+static size_t formatstats(char *buf, size_t cap) {
+  int n;
+
+  pthread_mutex_lock(&stats.lock);
+  n = snprintf(buf, cap,
+               "connections %llu\nactive %llu\nrequests %llu\nerrors %llu\n"
+               "bytes_in %llu\nbytes_out %llu\n",
+               stats.connections, stats.active, stats.requests, stats.errors,
+               stats.bytesin, stats.bytesout);
+  pthread_mutex_unlock(&stats.lock);
+  return n < 0 ? 0 : (size_t)n >= cap ? cap - 1 : (size_t)n;
+}
+
+/**
+ * serveconn --
+ *      Serve one socket connection, then close it.
+ * Parameters:
+ *  arg     -   the connection (struct conn *, freed here)
+ *
+ * Returns:
+ * NULL
+ */
+static void *serveconn(void *arg) {
+  struct conn *c = arg;
+
+  serveloop(c);
+  close(c->in);
+  free(c);
+  pthread_mutex_lock(&stats.lock);
+  stats.active--;
+  pthread_mutex_unlock(&stats.lock);
+  return NULL;
+}
+
+/**
+ * serveloop --
+ *      Answer the requests of one connection until the client closes
+ *      it, sends something malformed or cannot be written to. Each
+ *      page is the one a fresh context would write, but the context is
+ *      incremental: it keeps the sections of the last document, so one
+ *      sent again with a small edit has only those that changed parsed
+ *      again.
+ * Parameters:
+ *  c       -   the connection
+ *
+ * Returns:
+ *  0 if the requests ended between two frames, -1 otherwise.
+ */
+static int serveloop(const struct conn *c) {
+  struct md2mdoc_buf page = { NULL, 0, 0 };
+  struct md2mdoc_output out;
+  unsigned char hdr[SERVE_HDRSIZE];
+  char *req = NULL, *p, text[PATH_MAX + 256];
+  const char *inc;
+  size_t len, cap = 0;
+  md2mdoc_ctx *ctx;
+  int rv, eof;
+
+  if ((ctx = md2mdoc_ctx_new()) == NULL) {
+    warn(NULL);
+    return -1;
+  }
+  md2mdoc_ctx_include(ctx, c->frags, NULL);
+  md2mdoc_ctx_markup(ctx, c->markup);
+  md2mdoc_ctx_incremental(ctx, 1);                      /* Editors send the same page again and again. */
+  out.format = c->format;
+  out.sink = md2mdoc_buf_sink;
+  out.arg = &page;
+
+  while ((eof = readfull(c->in, hdr, sizeof(hdr))) == 1) { /* Left by `break` only on a failure. */
+    len = (size_t)hdr[1] << 24 | (size_t)hdr[2] << 16 | (size_t)hdr[3] << 8 | hdr[4];
+    if (len > SERVE_MAXREQ) {
+      reply(c->out, SERVE_ERROR, "request too large", 17);
+      count(SERVE_ERROR, 0, 0);
+      break;
+    }
+    if (len > cap) {
+      if ((p = realloc(req, len)) == NULL) {
+        reply(c->out, SERVE_ERROR, "out of memory", 13);
+        count(SERVE_ERROR, 0, 0);
+        break;
+      }
+      req = p;
+      cap = len;
+    }
+    if (len > 0 && readfull(c->in, req, len) != 1)
+      break;
+
+    switch (hdr[0]) {
+      case SERVE_CONVERT:
+        page.len = 0;
+        if (md2mdoc_convert_to(ctx, req, len, &out, 1) == -1) {
+          if ((inc = md2mdoc_include_failed(ctx)) != NULL)
+            len = (size_t)snprintf(text, sizeof(text), "include: %s: %s", inc, strerror(errno));
+          else
+            len = (size_t)snprintf(text, sizeof(text), "%s", strerror(errno));
+          if (len >= sizeof(text))
+            len = sizeof(text) - 1;
+          rv = reply(c->out, SERVE_ERROR, text, len);
+          count(SERVE_ERROR, 0, 0);
+        } else {
+          rv = reply(c->out, SERVE_OK, page.data, page.len);
+          count(SERVE_OK, len, page.len);
+        }
+        break;
+      case SERVE_STATS:
+        count(SERVE_OK, 0, 0);
+        len = formatstats(text, sizeof(text));
+        rv = reply(c->out, SERVE_OK, text, len);
+        break;
+      default:
+        rv = reply(c->out, SERVE_ERROR, "unknown request", 15);
+        count(SERVE_ERROR, 0, 0);
+        break;
+    }
+    if (rv == -1)
+      break;
+  }
+
+  free(req);
+  free(page.data);
+  md2mdoc_ctx_free(ctx);
+  return eof == 0 ? 0 : -1;
+}
+
+/**
+ * serve_run --
+ *      Listen on `path` and serve conversions forever. A socket left
+ *      behind by an earlier server is replaced; any other file at
+ *      `path` is an error.
+ * Parameters:
+ *  path    -   name of the socket
+ *  format  -   MD2MDOC_* format the pages are converted to
+ *  frags   -   cache for the files named by `include:` lines, or NULL
+ *              to leave the lines as text
+ *  markup  -   inline markers (--markup), or NULL for the built-in ones
+ */
+void serve_run(const char *path, int format, struct md2mdoc_frags *frags,
+               const struct md2mdoc_markup *markup) {
+  struct sockaddr_un sun;
+  struct stat st;
+  pthread_attr_t attr;
+  pthread_t tid;
+  struct conn *c;
+  int s, fd;
+
+  memset(&sun, 0, sizeof(sun));
+  sun.sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(sun.sun_path))
+    errx(1, "%s: socket name too long", path);
+  strcpy(sun.sun_path, path);
+  if (lstat(path, &st) == 0) {
+    if (!S_ISSOCK(st.st_mode))
+      errx(1, "%s: exists and is not a socket", path);
+    unlink(path);
+  }
+
+  if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+    err(1, "socket");
+  if (bind(s, (struct sockaddr *)&sun, sizeof(sun)) == -1 || listen(s, SOMAXCONN) == -1)
+    err(1, "%s", path);
+  signal(SIGPIPE, SIG_IGN);                             /* A client that goes away is not fatal. */
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  for (;;) {
+    if ((fd = accept(s, NULL, NULL)) == -1) {
+      if (errno != EINTR && errno != ECONNABORTED) {
+        warn("accept");
+        sleep(1);                                       /* Out of descriptors, say: let some close. */
+      }
+      continue;
+    }
+    if ((c = malloc(sizeof(*c))) == NULL) {
+      warn(NULL);
+      close(fd);
+      continue;
+    }
+    c->in = c->out = fd;
+    c->format = format;
+    c->frags = frags;
+    c->markup = markup;
+    pthread_mutex_lock(&stats.lock);
+    stats.connections++;
+    stats.active++;
+    pthread_mutex_unlock(&stats.lock);
+    if (pthread_create(&tid, &attr, serveconn, c) != 0) {
+      warnx("cannot start a thread for a connection");
+      pthread_mutex_lock(&stats.lock);
+      stats.active--;
+      pthread_mutex_unlock(&stats.lock);
+      close(fd);
+      free(c);
+    }
+  }
+}
+
+/**
+ * serve_stream --
+ *      Serve the requests framed on `in` until it ends, replying on
+ *      `out`: md2mdoc as a coprocess of a caller that can only talk
+ *      to it over pipes.
+ * Parameters:
+ *  in      -   where the requests come from
+ *  out     -   where the replies go
+ *  format  -   MD2MDOC_* format the pages are converted to
+ *  frags   -   cache for the files named by `include:` lines, or NULL
+ *              to leave the lines as text
+ *  markup  -   inline markers (--markup), or NULL for the built-in ones
+ *
+ * Returns:
+ *  0 if `in` ended between two requests and every reply was written,
+ *  -1 otherwise (reported).
+ */
+int serve_stream(int in, int out, int format, struct md2mdoc_frags *frags,
+                 const struct md2mdoc_markup *markup) {
+  struct conn c;
+  int rv;
+
+  c.in = in;
+  c.out = out;
+  c.format = format;
+  c.frags = frags;
+  c.markup = markup;
+  signal(SIGPIPE, SIG_IGN);                             /* A caller that goes away ends the loop. */
+  pthread_mutex_lock(&stats.lock);
+  stats.connections++;
+  stats.active++;
+  pthread_mutex_unlock(&stats.lock);
+  if ((rv = serveloop(&c)) == -1)
+    warnx("--stream-docs: malformed request, or the replies cannot be written");
+  pthread_mutex_lock(&stats.lock);
+  stats.active--;
+  pthread_mutex_unlock(&stats.lock);
+  return rv;
+} ///:~
@@ -0,0 +1,43 @@
+//===---------------------------------------------------*- C -*---===
+//: serve.h
+//
+// DESCRIPTION
+// Conversion server behind md2mdoc's --serve option. It listens on a
+// Unix domain socket and converts pages for any number of clients at
+// once, each connection with its own conversion context, so a caller
+// pays for the process start once rather than per page.
+//
+// Requests and replies are frames: a type byte followed by a 32 bit
+// big-endian length and that many bytes of payload. A connection may
+// carry any number of requests, answered in order.
+//
+//      'C' markdown    ->  'O' page, or 'E' message
+//      'S' (empty)     ->  'O' the counters, one "name value" per line
+//
+// `include:` lines name files relative to the server's directory; the
+// files are read once and shared by every connection.
+//
+// `serve_stream` speaks the same frames over a pair of descriptors
+// (md2mdoc's --stream-docs: standard input and output), for a caller
+// that keeps md2mdoc running as a coprocess.
+//===-------------------------------------------------------------===
+#ifndef MD2MDOC_SERVE_H
+#define MD2MDOC_SERVE_H
+
+#define SERVE_HDRSIZE 5                                 /* Type byte and length of a frame. */
+#define SERVE_MAXREQ (64 * 1024 * 1024)                 /* Largest markdown accepted. */
+
+#define SERVE_CONVERT 'C'                               /* Request types. */
+#define SERVE_STATS 'S'
+#define SERVE_OK 'O'                                    /* Reply types. */
+#define SERVE_ERROR 'E'
+
+struct md2mdoc_frags;
+struct md2mdoc_markup;
+
+void serve_run(const char *path, int format, struct md2mdoc_frags *frags,
+               const struct md2mdoc_markup *markup);    /* Does not return. */
+int serve_stream(int in, int out, int format, struct md2mdoc_frags *frags,
+                 const struct md2mdoc_markup *markup);  /* Until `in` ends; -1 on failure. */
+
+#endif /* MD2MDOC_SERVE_H */
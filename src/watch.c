@@ -0,0 +1,303 @@
+//===---------------------------------------------------*- C -*---===
+//: watch.c
+//
+// DESCRIPTION
+// Wait for files to be written and report them. On Linux the
+// directories holding the files are watched with inotify(7) (editors
+// often save by writing a new file and renaming it over the old one,
+// which a watch on the file itself would miss); events that arrive
+// together are coalesced so a page is reported once per save. Other
+// systems poll every file with stat(2). Files may be added while the
+// watch runs (the files a page includes are only known once it has
+// been converted), so the lists grow.
+//===-------------------------------------------------------------===
+
+#include "watch.h"
+
+#include <err.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+//-------------------------------------------------------------------
+// Constants Declarations
+//-------------------------------------------------------------------
+#define SETTLEMS 20                                     /* Quiet time that ends a burst of events. */
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+/*
+ * watched --
+ *      One file being watched.
+ */
+struct watched {
+  char *path;                                           /* As given; what polling stats. */
+  const char *base;                                     /* Name within its directory. */
+  size_t dir;                                           /* Index into `watcher.dirs`. */
+  int pending;                                          /* Written since it was last reported. */
+  struct stat st;                                       /* Last seen status (polling only). */
+};
+
+/*
+ * watcher --
+ *      The files and the distinct directories they live in.
+ */
+struct watcher {
+  struct watched *files;
+  size_t nfiles;
+  size_t capfiles;
+  char **dirs;
+  int *wds;                                             /* inotify watch of each directory. */
+  size_t ndirs;
+  size_t capdirs;
+  int fd;                                               /* inotify, or -1 until it is set up. */
+  int polling;                                          /* Set once files are polled instead. */
+  watch_fn changed;
+  void *arg;
+};
+
+//-------------------------------------------------------------------
+// Global Variables
+//-------------------------------------------------------------------
+static struct watcher watcher;                          /* What `watch_run` watches. */
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static size_t adddir(struct watcher *w, const char *path, size_t len);
+static void addfile(struct watcher *w, const char *path);
+static void report(struct watcher *w);
+static int statchanged(const struct stat *a, const struct stat *b);
+static void watch_poll(struct watcher *w);
+#ifdef __linux__
+static int watch_inotify(struct watcher *w);
+#endif
+
+/**
+ * adddir --
+ *      Find or add the directory `path` (`len` bytes long).
+ *
+ * Returns:
+ *  Its index in `w->dirs`.
+ */
+static size_t adddir(struct watcher *w, const char *path, size_t len) {
+  size_t i;
+
+  for (i = w->ndirs; i-- > 0; )                         /* Inputs come grouped by directory, */
+    if (strlen(w->dirs[i]) == len && memcmp(w->dirs[i], path, len) == 0) /* so look from the end. */
+      return i;
+  if (w->ndirs == w->capdirs) {
+    w->capdirs = w->capdirs ? w->capdirs * 2 : 16;
+    if ((w->dirs = realloc(w->dirs, w->capdirs * sizeof(*w->dirs))) == NULL ||
+        (w->wds = realloc(w->wds, w->capdirs * sizeof(*w->wds))) == NULL)
+      err(1, NULL);
+  }
+  if ((w->dirs[w->ndirs] = malloc(len + 1)) == NULL)
+    err(1, NULL);
+  memcpy(w->dirs[w->ndirs], path, len);
+  w->dirs[w->ndirs][len] = '\0';
+  w->wds[w->ndirs] = -1;
+#ifdef __linux__
+  if (w->fd != -1 &&                                    /* Added while watching. */
+      (w->wds[w->ndirs] = inotify_add_watch(w->fd, w->dirs[w->ndirs], IN_CLOSE_WRITE | IN_MOVED_TO)) == -1)
+    warn("inotify: %s", w->dirs[w->ndirs]);
+#endif
+  return w->ndirs++;
+}
+
+/**
+ * addfile --
+ *      Add `path` to the files watched, with the next index.
+ */
+static void addfile(struct watcher *w, const char *path) {
+  struct watched *f;
+  const char *slash;
+
+  if (w->nfiles == w->capfiles) {
+    w->capfiles = w->capfiles ? w->capfiles * 2 : 16;
+    if ((w->files = realloc(w->files, w->capfiles * sizeof(*w->files))) == NULL)
+      err(1, NULL);
+  }
+  f = &w->files[w->nfiles];
+  memset(f, 0, sizeof(*f));
+  if ((f->path = strdup(path)) == NULL)
+    err(1, NULL);
+  if ((slash = strrchr(f->path, '/')) != NULL) {
+    f->base = slash + 1;
+    f->dir = adddir(w, f->path, slash == f->path ? 1 : (size_t)(slash - f->path));
+  } else {
+    f->base = f->path;
+    f->dir = adddir(w, ".", 1);
+  }
+  if (w->polling && stat(f->path, &f->st) == -1)        /* Changes from now on. */
+    memset(&f->st, 0, sizeof(f->st));
+  w->nfiles++;
+}
+
+/**
+ * report --
+ *      Hand every pending file to the callback.
+ */
+static void report(struct watcher *w) {
+  size_t i;
+
+  for (i = 0; i < w->nfiles; i++) {
+    if (!w->files[i].pending)
+      continue;
+    w->files[i].pending = 0;
+    w->changed(w->arg, i);
+  }
+}
+
+#ifdef __linux__
+/**
+ * watch_inotify --
+ *      Watch with inotify until an error occurs.
+ *
+ * Returns:
+ *  -1 if inotify could not be set up (the caller polls instead);
+ *  otherwise it does not return.
+ */
+static int watch_inotify(struct watcher *w) {
+  char buf[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *ev;
+  struct pollfd pfd;
+  ssize_t n;
+  size_t i, d;
+  char *p;
+  int fd;
+
+  if ((fd = inotify_init1(IN_CLOEXEC)) == -1)
+    return -1;
+  for (d = 0; d < w->ndirs; d++) {
+    if ((w->wds[d] = inotify_add_watch(fd, w->dirs[d], IN_CLOSE_WRITE | IN_MOVED_TO)) == -1) {
+      warn("inotify: %s", w->dirs[d]);
+      close(fd);
+      return -1;
+    }
+  }
+  w->fd = fd;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  for (;;) {
+    if ((n = read(fd, buf, sizeof(buf))) == -1) {
+      if (errno == EINTR)
+        continue;
+      err(1, "inotify");
+    }
+    for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+      ev = (const struct inotify_event *)p;
+      if (ev->mask & IN_Q_OVERFLOW) {                   /* Lost events: assume everything changed. */
+        for (i = 0; i < w->nfiles; i++)
+          w->files[i].pending = 1;
+        continue;
+      }
+      if (ev->len == 0)
+        continue;
+      for (d = 0; d < w->ndirs && w->wds[d] != ev->wd; d++)
+        ;
+      for (i = 0; i < w->nfiles; i++)
+        if (w->files[i].dir == d && strcmp(w->files[i].base, ev->name) == 0)
+          w->files[i].pending = 1;
+    }
+    if (poll(&pfd, 1, SETTLEMS) > 0)                    /* More on the way; collect them first. */
+      continue;
+    report(w);
+  }
+}
+#endif
+
+/**
+ * statchanged --
+ *      Whether a file looks different from when it was last seen.
+ */
+static int statchanged(const struct stat *a, const struct stat *b) {
+  return a->st_ino != b->st_ino || a->st_size != b->st_size ||
+         a->st_mtime != b->st_mtime || a->st_ctime != b->st_ctime;
+}
+
+/**
+ * watch_poll --
+ *      Poll every file with stat(2) every WATCH_POLLMS milliseconds.
+ *      Does not return.
+ */
+static void watch_poll(struct watcher *w) {
+  struct timespec ts = { WATCH_POLLMS / 1000, (WATCH_POLLMS % 1000) * 1000000L };
+  struct stat st;
+  size_t i;
+
+  w->polling = 1;
+  for (i = 0; i < w->nfiles; i++)
+    if (stat(w->files[i].path, &w->files[i].st) == -1)
+      memset(&w->files[i].st, 0, sizeof(st));
+  for (;;) {
+    nanosleep(&ts, NULL);
+    for (i = 0; i < w->nfiles; i++) {
+      if (stat(w->files[i].path, &st) == -1)            /* Mid-rename, or removed; look again later. */
+        continue;
+      if (statchanged(&st, &w->files[i].st)) {
+        w->files[i].st = st;
+        w->files[i].pending = 1;
+      }
+    }
+    report(w);
+  }
+}
+
+/**
+ * watch_run --
+ *      Watch `files` and call `changed` with the index of each one
+ *      that is written.
+ * Parameters:
+ *  files    -   paths of the files
+ *  nfiles   -   number of files
+ *  changed  -   callback
+ *  arg      -   argument for `changed`
+ *
+ * Does not return; errors are fatal.
+ */
+void watch_run(const char *const *files, size_t nfiles, watch_fn changed, void *arg) {
+  struct watcher *w = &watcher;
+  size_t i;
+
+  w->fd = -1;
+  w->changed = changed;
+  w->arg = arg;
+  for (i = 0; i < nfiles; i++)
+    addfile(w, files[i]);
+
+#ifdef __linux__
+  watch_inotify(w);                                     /* Only returns if it could not start. */
+#endif
+  watch_poll(w);
+}
+
+/**
+ * watch_add --
+ *      Also watch `path`, from a `changed` callback. A file not watched
+ *      yet gets the index after the last; one already watched is left
+ *      alone.
+ * Parameters:
+ *  path    -   the file
+ */
+void watch_add(const char *path) {
+  struct watcher *w = &watcher;
+  size_t i;
+
+  for (i = 0; i < w->nfiles; i++)
+    if (strcmp(w->files[i].path, path) == 0)
+      return;
+  addfile(w, path);
+} ///:~
@@ -0,0 +1,23 @@
+//===---------------------------------------------------*- C -*---===
+//: watch.h
+//
+// DESCRIPTION
+// File watcher behind md2mdoc's --watch option. The caller hands
+// over a list of files and is called back with the index of each one
+// that is written; the callback may add more files. inotify(7) is
+// used on Linux; elsewhere (or if it cannot be set up) the files are
+// polled with stat(2).
+//===-------------------------------------------------------------===
+#ifndef MD2MDOC_WATCH_H
+#define MD2MDOC_WATCH_H
+
+#include <stddef.h>
+
+#define WATCH_POLLMS 250                                /* Poll interval when inotify is not used. */
+
+typedef void (*watch_fn)(void *arg, size_t index);      /* Called for a changed `files[index]`. */
+
+void watch_run(const char *const *files, size_t nfiles, watch_fn changed, void *arg); /* Does not return. */
+void watch_add(const char *path);                       /* From `changed`: watch one more file. */
+
+#endif /* MD2MDOC_WATCH_H */
@@ -0,0 +1,368 @@
+//===---------------------------------------------------*- C -*---===
+//: whatis.c
+//
+// DESCRIPTION
+// Writes and searches the whatis indexes (see whatis.h). Both are
+// built in memory and written to a temporary name that is renamed
+// into place, so apropos(1) or `whatis_lookup` never reads half an
+// index, even while --watch rewrites it.
+//===-------------------------------------------------------------===
+
+#include "whatis.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+//-------------------------------------------------------------------
+// Constants Declarations
+//-------------------------------------------------------------------
+#define MAGIC "mdwhat1"                                 /* With its NUL, the first eight bytes. */
+#define HEADER 16                                       /* Magic, byte order and number of names. */
+#define NAMESEP ", \t"                                  /* Between the names of a page. */
+
+//-------------------------------------------------------------------
+// Type Definitions
+//-------------------------------------------------------------------
+/*
+ * strbuf --
+ *      An index while it is being built.
+ */
+struct strbuf {
+  char *data;
+  size_t len;
+  size_t cap;
+};
+
+/*
+ * key --
+ *      A name of the binary index and the line of its page, both as
+ *      offsets into the strings.
+ */
+struct key {
+  const char *s;                                        /* The name, for sorting. */
+  uint32_t name;
+  uint32_t line;
+};
+
+//-------------------------------------------------------------------
+// Function Prototypes
+//-------------------------------------------------------------------
+static const struct whatis_page **sorted(const struct whatis_page *pages, size_t n, size_t *np);
+static int bypage(const void *a, const void *b);
+static int bykey(const void *a, const void *b);
+static int put(struct strbuf *sb, const void *p, size_t n);
+static int putline(struct strbuf *sb, const struct whatis_page *pg);
+static int putindex(const char *path, const char *data, size_t len);
+
+/**
+ * sorted --
+ *      The pages that were converted, sorted by their names.
+ * Parameters:
+ *  pages   -   the pages of the batch
+ *  n       -   how many
+ *  np      -   set to how many were converted
+ *
+ * Returns:
+ *  An allocated array (NULL with errno set on failure).
+ */
+static const struct whatis_page **sorted(const struct whatis_page *pages, size_t n, size_t *np) {
+  const struct whatis_page **v;
+  size_t i;
+
+  if ((v = calloc(n + 1, sizeof(*v))) == NULL)
+    return NULL;
+  for (*np = 0, i = 0; i < n; i++)
+    if (pages[i].names != NULL)
+      v[(*np)++] = &pages[i];
+  qsort(v, *np, sizeof(*v), bypage);
+  return v;
+}
+
+/**
+ * bypage --
+ *      qsort(3) order of pages: by names, then by section.
+ */
+static int bypage(const void *a, const void *b) {
+  const struct whatis_page *x = *(const struct whatis_page *const *)a;
+  const struct whatis_page *y = *(const struct whatis_page *const *)b;
+  int c;
+
+  if ((c = strcmp(x->names, y->names)) != 0)
+    return c;
+  return strcmp(x->section, y->section);
+}
+
+/**
+ * bykey --
+ *      qsort(3) order of the names of the binary index.
+ */
+static int bykey(const void *a, const void *b) {
+  return strcmp(((const struct key *)a)->s, ((const struct key *)b)->s);
+}
+
+/**
+ * put --
+ *      Append `n` bytes to an index.
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+static int put(struct strbuf *sb, const void *p, size_t n) {
+  size_t cap;
+  char *data;
+
+  if (sb->len + n > sb->cap) {
+    for (cap = sb->cap ? sb->cap : 4096; cap < sb->len + n; cap *= 2)
+      ;
+    if ((data = realloc(sb->data, cap)) == NULL)
+      return -1;
+    sb->data = data;
+    sb->cap = cap;
+  }
+  memcpy(sb->data + sb->len, p, n);
+  sb->len += n;
+  return 0;
+}
+
+/**
+ * putline --
+ *      Append the whatis line of a page, without its newline.
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+static int putline(struct strbuf *sb, const struct whatis_page *pg) {
+  if (put(sb, pg->names, strlen(pg->names)) == -1)
+    return -1;
+  if (pg->section[0] != '\0' &&
+      (put(sb, " (", 2) == -1 || put(sb, pg->section, strlen(pg->section)) == -1 ||
+       put(sb, ")", 1) == -1))
+    return -1;
+  if (put(sb, " - ", 3) == -1 || put(sb, pg->desc, strlen(pg->desc)) == -1)
+    return -1;
+  return 0;
+}
+
+/**
+ * whatis_write --
+ *      Write the text index.
+ * Parameters:
+ *  path    -   the index
+ *  pages   -   the pages of the batch (those without names are left
+ *              out)
+ *  n       -   how many
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+int whatis_write(const char *path, const struct whatis_page *pages, size_t n) {
+  const struct whatis_page **v;
+  struct strbuf sb = { NULL, 0, 0 };
+  size_t i, np;
+  int rv = -1;
+
+  if ((v = sorted(pages, n, &np)) == NULL)
+    return -1;
+  for (i = 0; i < np; i++)
+    if (putline(&sb, v[i]) == -1 || put(&sb, "\n", 1) == -1)
+      goto done;
+  rv = putindex(path, sb.data, sb.len);
+
+done:
+  free(sb.data);
+  free(v);
+  return rv;
+}
+
+/**
+ * whatis_writedb --
+ *      Write the binary index: the line of every page once, and every
+ *      name of it pointing there.
+ * Parameters:
+ *  path    -   the index
+ *  pages   -   the pages of the batch (those without names are left
+ *              out)
+ *  n       -   how many
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+int whatis_writedb(const char *path, const struct whatis_page *pages, size_t n) {
+  const struct whatis_page **v;
+  struct strbuf str = { NULL, 0, 0 }, db = { NULL, 0, 0 };
+  struct key *keys = NULL;
+  size_t i, np, nkeys = 0, capkeys = 0, line, len;
+  const char *p;
+  uint32_t hdr[2];
+  void *grown;
+  int rv = -1;
+
+  if ((v = sorted(pages, n, &np)) == NULL)
+    return -1;
+  if (put(&str, "", 1) == -1)                           /* Never empty, even without pages. */
+    goto done;
+  for (i = 0; i < np; i++) {
+    line = str.len;
+    if (putline(&str, v[i]) == -1 || put(&str, "", 1) == -1)
+      goto done;
+    for (p = v[i]->names; *(p += strspn(p, NAMESEP)) != '\0'; p += len) {
+      len = strcspn(p, NAMESEP);
+      if (nkeys == capkeys) {
+        capkeys = capkeys ? capkeys * 2 : 64;
+        if ((grown = realloc(keys, capkeys * sizeof(*keys))) == NULL)
+          goto done;
+        keys = grown;
+      }
+      keys[nkeys].name = (uint32_t)str.len;
+      keys[nkeys++].line = (uint32_t)line;
+      if (put(&str, p, len) == -1 || put(&str, "", 1) == -1)
+        goto done;
+    }
+  }
+  if (str.len > UINT32_MAX || nkeys > (UINT32_MAX - HEADER) / 8) {
+    errno = EFBIG;
+    goto done;
+  }
+  for (i = 0; i < nkeys; i++)
+    keys[i].s = str.data + keys[i].name;                /* The strings no longer move. */
+  qsort(keys, nkeys, sizeof(*keys), bykey);
+
+  hdr[0] = WHATIS_ORDER;
+  hdr[1] = (uint32_t)nkeys;
+  if (put(&db, MAGIC, 8) == -1 || put(&db, hdr, sizeof(hdr)) == -1)
+    goto done;
+  for (i = 0; i < nkeys; i++) {
+    hdr[0] = keys[i].name;
+    hdr[1] = keys[i].line;
+    if (put(&db, hdr, sizeof(hdr)) == -1)
+      goto done;
+  }
+  if (put(&db, str.data, str.len) == -1)
+    goto done;
+  rv = putindex(path, db.data, db.len);
+
+done:
+  free(db.data);
+  free(str.data);
+  free(keys);
+  free(v);
+  return rv;
+}
+
+/**
+ * whatis_lookup --
+ *      Write the line of every page named `name` in a binary index.
+ * Parameters:
+ *  path    -   the index
+ *  name    -   name to look up
+ *  out     -   where the lines go
+ *
+ * Returns:
+ *  The number of lines written, or -1 on failure (errno set; EINVAL
+ *  for a file that is not an index).
+ */
+int whatis_lookup(const char *path, const char *name, FILE *out) {
+  struct stat st;
+  const char *base, *str;
+  uint32_t hdr[2], ent[2];
+  size_t lo, mid, hi, tab, slen;
+  int fd, found = 0;
+
+  if ((fd = open(path, O_RDONLY)) == -1)
+    return -1;
+  if (fstat(fd, &st) == -1 || st.st_size < HEADER) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)
+    return -1;
+
+  memcpy(hdr, base + 8, sizeof(hdr));
+  tab = HEADER + (size_t)hdr[1] * 8;
+  if (memcmp(base, MAGIC, 8) != 0 || hdr[0] != WHATIS_ORDER || tab >= (size_t)st.st_size ||
+      base[st.st_size - 1] != '\0') {
+    munmap((void *)base, (size_t)st.st_size);
+    errno = EINVAL;
+    return -1;
+  }
+  str = base + tab;
+  slen = (size_t)st.st_size - tab;
+
+  for (lo = 0, hi = hdr[1]; lo < hi;) {                 /* First name not below `name`. */
+    mid = lo + (hi - lo) / 2;
+    memcpy(ent, base + HEADER + mid * 8, sizeof(ent));
+    if (ent[0] < slen && strcmp(str + ent[0], name) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for (; lo < hdr[1]; lo++) {
+    memcpy(ent, base + HEADER + lo * 8, sizeof(ent));
+    if (ent[0] >= slen || ent[1] >= slen || strcmp(str + ent[0], name) != 0)
+      break;
+    fprintf(out, "%s\n", str + ent[1]);
+    found++;
+  }
+  munmap((void *)base, (size_t)st.st_size);
+  return found;
+}
+
+/**
+ * putindex --
+ *      Write an index to `path` by way of a temporary file.
+ *
+ * Returns:
+ *  0 on success, -1 on failure (errno set).
+ */
+static int putindex(const char *path, const char *data, size_t len) {
+  char tmp[PATH_MAX];
+  ssize_t n;
+  int fd, saved;
+
+  if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  if ((fd = mkstemp(tmp)) == -1)
+    return -1;
+  fchmod(fd, 0644);
+  while (len > 0) {
+    if ((n = write(fd, data, len)) == -1) {
+      if (errno == EINTR)
+        continue;
+      goto fail;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+  if (close(fd) == -1) {
+    fd = -1;
+    goto fail;
+  }
+  if (rename(tmp, path) == -1) {
+    fd = -1;
+    goto fail;
+  }
+  return 0;
+
+fail:
+  saved = errno;
+  if (fd != -1)
+    close(fd);
+  unlink(tmp);
+  errno = saved;
+  return -1;
+} ///:~
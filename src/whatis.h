@@ -0,0 +1,45 @@
+//===---------------------------------------------------*- C -*---===
+//: whatis.h
+//
+// DESCRIPTION
+// The whatis index behind md2mdoc's --whatis and --whatis-db options,
+// made from what batch mode learns of every page while converting it
+// (no page is read again). The text index has one line per page,
+// sorted:
+//
+//      ls, dir (1) - list directory contents
+//
+// The binary index holds the same lines with a table of every name
+// sorted, so `whatis_lookup` finds a name with a binary search of
+// the mapped file. Its layout, in the byte order of the machine that
+// wrote it:
+//
+//      char      magic[8]      "mdwhat1\0"
+//      uint32_t  order         WHATIS_ORDER
+//      uint32_t  nnames
+//      uint32_t  name, line    nnames times: offsets into the strings
+//      char      strings[]     NUL terminated names and lines
+//===-------------------------------------------------------------===
+#ifndef MD2MDOC_WHATIS_H
+#define MD2MDOC_WHATIS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define WHATIS_ORDER 0x01020304                         /* Reads back otherwise on another byte order. */
+
+/*
+ * whatis_page --
+ *      One page of the index.
+ */
+struct whatis_page {
+  char *names;                                          /* "ls, dir", or NULL for no page. */
+  char *desc;
+  char section[16];                                     /* "" for none. */
+};
+
+int whatis_write(const char *path, const struct whatis_page *pages, size_t n); /* Text index. */
+int whatis_writedb(const char *path, const struct whatis_page *pages, size_t n); /* Binary index. */
+int whatis_lookup(const char *path, const char *name, FILE *out); /* Number of lines written. */
+
+#endif /* MD2MDOC_WHATIS_H */